@@ -0,0 +1,77 @@
+//
+// Arbitrary output variables: per-pixel data recorded at the primary hits alongside the beauty pass.
+//
+
+#include "AOV.hpp"
+#include "ImageIO.hpp"
+#include <limits>
+
+namespace {
+	// Albedo floor, so that demodulating a black surface does not divide by zero
+	constexpr float kMinAlbedo = 1e-3f;
+
+	bool writeVectors(const std::string &path, int width, int height, const std::vector<Vector3f> &v) {
+		return writeImage(path, width, height, 3, reinterpret_cast<const float *>(v.data()));
+	}
+
+	template<typename T>
+	bool writeScalars(const std::string &path, int width, int height, const std::vector<T> &v) {
+		std::vector<float> data(v.begin(), v.end());
+		return writeImage(path, width, height, 1, data.data());
+	}
+}// namespace
+
+void FeatureBuffers::resize(size_t n) {
+	albedo.assign(n, Vector3f(0.0f));
+	normal.assign(n, Vector3f(0.0f));
+	depth.assign(n, std::numeric_limits<float>::infinity());
+	objectId.assign(n, -1);
+	materialId.assign(n, -1);
+	surface.assign(n, 0);
+	lumSum.assign(n, 0.0f);
+	lumSqSum.assign(n, 0.0f);
+	samples.assign(n, 0);
+}
+
+void FeatureBuffers::record(int pixel, const Intersection &hit, int32_t object, int32_t material) {
+	if(!hit.happened)
+		return;
+	albedo[pixel]     = hit.m->getAlbedo();
+	normal[pixel]     = hit.normal;
+	depth[pixel]      = float(hit.distance);
+	objectId[pixel]   = object;
+	materialId[pixel] = material;
+	surface[pixel]    = !hit.m->hasEmission();
+}
+
+void FeatureBuffers::addSample(int pixel, const Vector3f &L) {
+	float l = luminance(demodulate(pixel, L));
+	lumSum[pixel] += l;
+	lumSqSum[pixel] += l * l;
+	++samples[pixel];
+}
+
+float FeatureBuffers::variance(int pixel) const {
+	uint32_t n = samples[pixel];
+	if(n < 2)
+		return 0;
+	float mean = lumSum[pixel] / n;
+	// Unbiased sample variance, divided by n for the variance of the mean
+	return std::max(0.0f, (lumSqSum[pixel] - n * mean * mean) / (n - 1)) / n;
+}
+
+Vector3f FeatureBuffers::modulation(int pixel) const {
+	return surface[pixel] ? Vector3f::Max(albedo[pixel], Vector3f(kMinAlbedo)) : Vector3f(1.0f);
+}
+
+bool FeatureBuffers::write(const std::string &prefix, const std::string &extension, int width, int height,
+                           const std::vector<Vector3f> &beauty) const {
+	bool ok = writeVectors(prefix + "beauty" + extension, width, height, beauty);
+	ok &= writeVectors(prefix + "albedo" + extension, width, height, albedo);
+	ok &= writeVectors(prefix + "normal" + extension, width, height, normal);
+	ok &= writeScalars(prefix + "depth" + extension, width, height, depth);
+	ok &= writeScalars(prefix + "object" + extension, width, height, objectId);
+	ok &= writeScalars(prefix + "material" + extension, width, height, materialId);
+	ok &= writeScalars(prefix + "samples" + extension, width, height, samples);
+	return ok;
+}
@@ -0,0 +1,48 @@
+//
+// Arbitrary output variables: per-pixel data recorded at the primary hits alongside the beauty pass.
+//
+
+#ifndef RAYTRACING_AOV_H
+#define RAYTRACING_AOV_H
+
+#include "Intersection.hpp"
+#include "Vector.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+inline float luminance(const Vector3f &c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+
+/**
+ * @brief 每个像素主光线第一个交点处的特征（AOV），以及该像素各样本的亮度统计。
+ *
+ * 渲染时与颜色在同一次遍历中写入（每个像素只由一个线程写）。这些缓冲既可以作为浮点图像输出给合成流程
+ * （遮罩、深度等不必再渲染一遍），也供去噪器区分几何 / 材质边缘和噪声。
+ */
+struct FeatureBuffers {
+	std::vector<Vector3f> albedo;      // reflectance of the surface first hit (0 for misses)
+	std::vector<Vector3f> normal;      // shading normal at the first hit (0 for misses)
+	std::vector<float> depth;          // distance from the eye along the primary ray (infinite for misses)
+	std::vector<int32_t> objectId;     // Scene::objectId of the object first hit (-1 for misses)
+	std::vector<int32_t> materialId;   // Scene::materialId of its material (-1 for misses)
+	std::vector<uint8_t> surface;      // 1: the first hit is a non-emissive surface, lit by the scene
+	std::vector<float> lumSum, lumSqSum;// luminance of the pixel's samples with the albedo divided out, summed
+	std::vector<uint32_t> samples;     // samples taken in the pixel
+
+	void resize(size_t n);
+	void record(int pixel, const Intersection &hit, int32_t object, int32_t material);
+	void addSample(int pixel, const Vector3f &L);
+	// Variance of the mean of the pixel's (demodulated) luminance samples
+	float variance(int pixel) const;
+	// Factor the pixel's lighting is multiplied with: the albedo of lit surfaces, 1 elsewhere
+	Vector3f modulation(int pixel) const;
+	// Lighting at the pixel with the surface colour divided out
+	Vector3f demodulate(int pixel, const Vector3f &L) const { return L / modulation(pixel); }
+
+	// Write the beauty pass and every AOV as float images named <prefix><name><extension> (.pfm or .exr); false if
+	// any write failed
+	bool write(const std::string &prefix, const std::string &extension, int width, int height,
+	           const std::vector<Vector3f> &beauty) const;
+};
+
+#endif//RAYTRACING_AOV_H
@@ -0,0 +1,92 @@
+//
+// Monotonic arena allocation for scene data.
+//
+
+#ifndef RAYTRACING_ARENA_H
+#define RAYTRACING_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 单调（只增不减）的内存池。
+ *
+ * 对象从大块内存中按顺序切出，不能单独释放；池析构（或 reset）时一次性归还所有块。
+ * 平凡析构的对象（如 BVHBuildNode）不产生任何额外开销；其余对象在创建时登记析构函数，
+ * 释放时按创建的逆序调用。分配不是线程安全的，多线程构建请预先用 alloc 取一整段数组。
+ */
+class MemoryArena {
+public:
+	explicit MemoryArena(size_t bytesPerBlock = 256 * 1024): blockSize(bytesPerBlock) {}
+	MemoryArena(const MemoryArena &)            = delete;
+	MemoryArena &operator=(const MemoryArena &) = delete;
+	~MemoryArena() { reset(); }
+
+	// Uninitialized storage for n objects of type T
+	template<typename T>
+	T *alloc(size_t n = 1) {
+		numObjects += n;
+		return static_cast<T *>(allocBytes(n * sizeof(T), alignof(T)));
+	}
+
+	// Construct a T in the arena; its destructor runs when the arena is reset
+	template<typename T, typename... Args>
+	T *make(Args &&...args) {
+		T *obj = new(alloc<T>()) T(std::forward<Args>(args)...);
+		if constexpr(!std::is_trivially_destructible_v<T>)
+			destructors.push_back({obj, [](void *p) { static_cast<T *>(p)->~T(); }});
+		return obj;
+	}
+
+	// Destroy every object made in the arena and give all blocks back at once
+	void reset() {
+		for(auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+			it->destroy(it->obj);
+		destructors.clear();
+		for(void *block: blocks)
+			::operator delete(block);
+		blocks.clear();
+		current = end = nullptr;
+		numObjects = 0;
+		bytesUsed  = 0;
+	}
+
+	size_t objectCount() const { return numObjects; }
+	size_t blockCount() const { return blocks.size(); }
+	size_t bytesAllocated() const { return bytesUsed; }
+
+private:
+	void *allocBytes(size_t size, size_t align) {
+		size_t pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+		if(!current || pad + size > size_t(end - current)) {
+			// Oversized requests get a block of their own
+			size_t bytes = std::max(size + align, blockSize);
+			current      = static_cast<char *>(::operator new(bytes));
+			end          = current + bytes;
+			blocks.push_back(current);
+			pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+		}
+		void *p = current + pad;
+		current += pad + size;
+		bytesUsed += pad + size;
+		return p;
+	}
+
+	struct Destructor {
+		void *obj;
+		void (*destroy)(void *);
+	};
+
+	size_t blockSize;
+	char *current = nullptr, *end = nullptr;
+	std::vector<void *> blocks;
+	std::vector<Destructor> destructors;
+	size_t numObjects = 0, bytesUsed = 0;
+};
+
+#endif//RAYTRACING_ARENA_H
@@ -1,6 +1,9 @@
 #include "BVH.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstring>
+#include <thread>
 
 BVHAccel::BVHAccel(std::vector<Object *> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
@@ -10,8 +13,23 @@ BVHAccel::BVHAccel(std::vector<Object *> p, int maxPrimsInNode,
 	time(&start);
 	if(primitives.empty())
 		return;
+	auto buildStart = std::chrono::steady_clock::now();
 
-	root = recursiveBuild(primitives);
+	MemoryArena arena;
+	std::vector<Object *> orderedPrims;
+	orderedPrims.reserve(primitives.size());
+	BVHBuildNode *root = buildSubtree(primitives, orderedPrims, arena);
+	primitives.swap(orderedPrims);
+
+	// Compute representation of depth-first traversal of BVH tree
+	nodeStorage.resize(2 * primitives.size());
+	int offset = 1;
+	flattenBVHTree(root, 0, &offset);
+	nodeStorage.resize(offset);
+	nodes      = nodeStorage.data();
+	totalNodes = offset;
+	measureDepth();
+	buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
 
 	time(&stop);
 	double diff = difftime(stop, start);
@@ -24,8 +42,20 @@ BVHAccel::BVHAccel(std::vector<Object *> p, int maxPrimsInNode,
 	        hrs, mins, secs);
 }
 
-BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Object *> objects) {
-	BVHBuildNode *node = new BVHBuildNode();
+BVHAccel::BVHAccel(std::vector<Object *> p, LinearBVHNode *linearNodes, int nodeCount, const uint32_t *primOrder,
+                   int primRefCount, std::shared_ptr<void> keepAlive, int maxPrims, SplitMethod method)
+    : maxPrimsInNode(std::min(255, maxPrims)), splitMethod(method),
+      nodes(linearNodes), totalNodes(nodeCount), nodeOwner(std::move(keepAlive)) {
+	primitives.resize(primRefCount);
+	for(int i = 0; i < primRefCount; ++i)
+		primitives[i] = p[primOrder[i]];
+	measureDepth();
+}
+
+BVHAccel::~BVHAccel() = default;
+
+BVHBuildNode *BVHAccel::recursiveBuild(PrimitiveRange objects, std::vector<Object *> &orderedPrims, MemoryArena &arena) {
+	BVHBuildNode *node = arena.make<BVHBuildNode>();
 
 	// Compute bounds of all primitives in BVH node
 	Bounds3 bounds;
@@ -38,10 +68,14 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Object *> objects) {
 		node->left   = nullptr;
 		node->right  = nullptr;
 		node->area   = objects[0]->getArea();
+
+		node->firstPrimOffset = orderedPrims.size();
+		node->nPrimitives     = 1;
+		orderedPrims.push_back(objects[0]);
 		return node;
-	} else if(objects.size() == 2) {
-		node->left  = recursiveBuild(std::vector{objects[0]});
-		node->right = recursiveBuild(std::vector{objects[1]});
+	} else if(objects.size() == 2 && splitMethod == SplitMethod::NAIVE) {
+		node->left  = recursiveBuild({objects.begin(), objects.begin() + 1}, orderedPrims, arena);
+		node->right = recursiveBuild({objects.begin() + 1, objects.end()}, orderedPrims, arena);
 
 		node->bounds = Union(node->left->bounds, node->right->bounds);
 		node->area   = node->left->area + node->right->area;
@@ -51,39 +85,104 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Object *> objects) {
 		for(int i = 0; i < objects.size(); ++i)
 			centroidBounds =
 			        Union(centroidBounds, objects[i]->getBounds().Centroid());
-		int dim = centroidBounds.maxExtent();
-		switch(dim) {
-			case 0:
-				std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-					return f1->getBounds().Centroid().x <
-					       f2->getBounds().Centroid().x;
-				});
-				break;
-			case 1:
-				std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-					return f1->getBounds().Centroid().y <
-					       f2->getBounds().Centroid().y;
-				});
-				break;
-			case 2:
-				std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-					return f1->getBounds().Centroid().z <
-					       f2->getBounds().Centroid().z;
-				});
-				break;
-		}
+		int dim         = centroidBounds.maxExtent();
+		node->splitAxis = dim;
 
 		auto beginning = objects.begin();
 		auto middling  = objects.begin() + (objects.size() / 2);
 		auto ending    = objects.end();
 
-		auto leftshapes  = std::vector<Object *>(beginning, middling);
-		auto rightshapes = std::vector<Object *>(middling, ending);
+		bool partitioned = false;
+		float cMin       = (&centroidBounds.pMin.x)[dim];
+		float cExtent    = (&centroidBounds.pMax.x)[dim] - cMin;
+		if((splitMethod == SplitMethod::SAH || splitMethod == SplitMethod::SBVH) && cExtent > 0) {
+			// Bucketed surface area heuristic along the largest centroid extent
+			constexpr int nBuckets = 12;
+			struct BucketInfo {
+				int count = 0;
+				Bounds3 bounds;
+			};
+			BucketInfo buckets[nBuckets];
+			auto bucketOf = [&](Object *obj) {
+				Vector3f c = obj->getBounds().Centroid();
+				int b      = nBuckets * (((&c.x)[dim] - cMin) / cExtent);
+				return std::min(std::max(b, 0), nBuckets - 1);
+			};
+			for(auto *obj: objects) {
+				int b = bucketOf(obj);
+				buckets[b].count++;
+				buckets[b].bounds = Union(buckets[b].bounds, obj->getBounds());
+			}
+
+			// Cost of splitting after each bucket, relative to one intersection test
+			float minCost         = std::numeric_limits<float>::max();
+			int minCostSplitBucket = 0;
+			for(int i = 0; i < nBuckets - 1; ++i) {
+				Bounds3 b0, b1;
+				int count0 = 0, count1 = 0;
+				for(int j = 0; j <= i; ++j) {
+					b0 = Union(b0, buckets[j].bounds);
+					count0 += buckets[j].count;
+				}
+				for(int j = i + 1; j < nBuckets; ++j) {
+					b1 = Union(b1, buckets[j].bounds);
+					count1 += buckets[j].count;
+				}
+				float cost = 0.125f + ((count0 ? count0 * b0.SurfaceArea() : 0) +
+				                       (count1 ? count1 * b1.SurfaceArea() : 0)) /
+				                              bounds.SurfaceArea();
+				if(cost < minCost) {
+					minCost            = cost;
+					minCostSplitBucket = i;
+				}
+			}
+
+			// Create a leaf when splitting does not pay off
+			if((int) objects.size() <= maxPrimsInNode && minCost >= (float) objects.size()) {
+				node->bounds          = bounds;
+				node->object          = objects[0];
+				node->area            = 0;
+				node->firstPrimOffset = orderedPrims.size();
+				node->nPrimitives     = objects.size();
+				for(auto *obj: objects) {
+					node->area += obj->getArea();
+					orderedPrims.push_back(obj);
+				}
+				return node;
+			}
+			middling    = std::partition(beginning, ending, [&](Object *obj) { return bucketOf(obj) <= minCostSplitBucket; });
+			partitioned = middling != beginning && middling != ending;
+		}
+
+		if(!partitioned) {
+			middling = objects.begin() + (objects.size() / 2);
+			switch(dim) {
+				case 0:
+					std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+						return f1->getBounds().Centroid().x <
+						       f2->getBounds().Centroid().x;
+					});
+					break;
+				case 1:
+					std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+						return f1->getBounds().Centroid().y <
+						       f2->getBounds().Centroid().y;
+					});
+					break;
+				case 2:
+					std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+						return f1->getBounds().Centroid().z <
+						       f2->getBounds().Centroid().z;
+					});
+					break;
+			}
+		}
 
-		assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+		// Both halves are partitioned in place, so children reuse the parent's range instead of copying it
+		assert(beginning < middling && middling < ending);
 
-		node->left  = recursiveBuild(leftshapes);
-		node->right = recursiveBuild(rightshapes);
+		node->left  = recursiveBuild({beginning, middling}, orderedPrims, arena);
+		node->right = recursiveBuild({middling, ending}, orderedPrims, arena);
 
 		node->bounds = Union(node->left->bounds, node->right->bounds);
 		node->area   = node->left->area + node->right->area;
@@ -92,53 +191,1230 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Object *> objects) {
 	return node;
 }
 
-Intersection BVHAccel::Intersect(const Ray &ray) const {
+void BVHAccel::flattenBVHTree(BVHBuildNode *node, int nodeIndex, int *offset, int primBase) {
+	// The node's slot was reserved by its parent; its children get the next two free slots
+	LinearBVHNode *linearNode = &nodeStorage[nodeIndex];
+	for(int i = 0; i < 3; ++i) {
+		linearNode->bounds[0][i] = (&node->bounds.pMin.x)[i];
+		linearNode->bounds[1][i] = (&node->bounds.pMax.x)[i];
+	}
+	linearNode->area = node->area;
+	linearNode->pad  = 0;
+	if(node->nPrimitives > 0) {
+		linearNode->primitivesOffset = primBase + node->firstPrimOffset;
+		linearNode->nPrimitives      = node->nPrimitives;
+		linearNode->axis             = 0;
+	} else {
+		// Create interior flattened BVH node
+		linearNode->axis        = node->splitAxis;
+		linearNode->nPrimitives = 0;
+		linearNode->childOffset = *offset;
+		*offset += 2;
+		flattenBVHTree(node->left, linearNode->childOffset, offset, primBase);
+		flattenBVHTree(node->right, linearNode->childOffset + 1, offset, primBase);
+	}
+}
+
+namespace {
+	float surfaceArea(const LinearBVHNode &node) {
+		float dx = node.bounds[1][0] - node.bounds[0][0];
+		float dy = node.bounds[1][1] - node.bounds[0][1];
+		float dz = node.bounds[1][2] - node.bounds[0][2];
+		return 2 * (dx * dy + dx * dz + dy * dz);
+	}
+
+	// Traversal cost relative to one primitive intersection, as in the SAH builder
+	constexpr float kTraversalCost = 0.125f;
+}// namespace
+
+namespace {
+	// Run body(t) for t in [0, n) on n threads (inline when n == 1)
+	template<typename F>
+	void parallelFor(int n, const F &body) {
+		if(n <= 1) {
+			body(0);
+			return;
+		}
+		std::vector<std::thread> threads;
+		for(int t = 1; t < n; ++t)
+			threads.emplace_back(body, t);
+		body(0);
+		for(auto &thread: threads)
+			thread.join();
+	}
+
+	int hardwareThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+	struct MortonPrimitive {
+		uint64_t code;
+		uint32_t index;
+	};
+
+	// Insert two zero bits between each of the low 10 (resp. 21) bits of x
+	uint64_t leftShift3(uint64_t x, int bitsPerAxis) {
+		if(bitsPerAxis <= 10) {
+			x &= 0x3ff;
+			x = (x | (x << 16)) & 0x30000ff;
+			x = (x | (x << 8)) & 0x300f00f;
+			x = (x | (x << 4)) & 0x30c30c3;
+			x = (x | (x << 2)) & 0x9249249;
+			return x;
+		}
+		x &= 0x1fffff;
+		x = (x | (x << 32)) & 0x1f00000000ffffull;
+		x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+		x = (x | (x << 8)) & 0x100f00f00f00f00full;
+		x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+		x = (x | (x << 2)) & 0x1249249249249249ull;
+		return x;
+	}
+
+	// p in [0, 1]^3; bit 3k + a of the code belongs to axis a
+	uint64_t encodeMorton3(const Vector3f &p, int bitsPerAxis) {
+		float scale   = (float) (1u << bitsPerAxis);
+		uint64_t maxQ = (1u << bitsPerAxis) - 1;
+		auto quantize = [&](float v) { return std::min<uint64_t>((uint64_t) std::max(0.0f, v * scale), maxQ); };
+		return (leftShift3(quantize(p.z), bitsPerAxis) << 2) | (leftShift3(quantize(p.y), bitsPerAxis) << 1) |
+		       leftShift3(quantize(p.x), bitsPerAxis);
+	}
+
+	// Stable LSD radix sort on the low `bits` bits of the codes, 8 bits per pass. Each thread histograms and
+	// scatters its own contiguous chunk; offsets are laid out digit-major, thread-minor to keep the sort stable.
+	void radixSort(std::vector<MortonPrimitive> &v, int bits, int nThreads) {
+		constexpr int kDigitBits = 8, kBuckets = 1 << kDigitBits;
+		std::vector<MortonPrimitive> tmp(v.size());
+		std::vector<std::array<size_t, kBuckets>> offsets(nThreads);
+		auto chunkBegin = [&](int t) { return v.size() * t / nThreads; };
+		for(int shift = 0; shift < bits; shift += kDigitBits) {
+			parallelFor(nThreads, [&](int t) {
+				offsets[t].fill(0);
+				for(size_t i = chunkBegin(t); i < chunkBegin(t + 1); ++i)
+					offsets[t][(v[i].code >> shift) & (kBuckets - 1)]++;
+			});
+			size_t sum = 0;
+			for(int b = 0; b < kBuckets; ++b) {
+				for(int t = 0; t < nThreads; ++t) {
+					size_t count = offsets[t][b];
+					offsets[t][b] = sum;
+					sum += count;
+				}
+			}
+			parallelFor(nThreads, [&](int t) {
+				for(size_t i = chunkBegin(t); i < chunkBegin(t + 1); ++i)
+					tmp[offsets[t][(v[i].code >> shift) & (kBuckets - 1)]++] = v[i];
+			});
+			v.swap(tmp);
+		}
+	}
+
+	struct LBVHBuildInput {
+		const std::vector<Object *> &sorted;// primitives in Morton order
+		const std::vector<MortonPrimitive> &morton;
+		int primBase;// offset of sorted[0] in orderedPrims
+		int maxPrimsInNode;
+		int parallelDepth;
+		BVHBuildNode *nodePool;// room for the at most 2n - 1 nodes, shared by the emitting threads
+		std::atomic<int> *nextNode;
+	};
+
+	BVHBuildNode *newNode(const LBVHBuildInput &in) { return new(&in.nodePool[(*in.nextNode)++]) BVHBuildNode(); }
+
+	BVHBuildNode *makeLeaf(const LBVHBuildInput &in, int begin, int end) {
+		BVHBuildNode *node    = newNode(in);
+		node->object          = in.sorted[begin];
+		node->area            = 0;
+		node->firstPrimOffset = in.primBase + begin;
+		node->nPrimitives     = end - begin;
+		for(int i = begin; i < end; ++i) {
+			node->bounds = Union(node->bounds, in.sorted[i]->getBounds());
+			node->area += in.sorted[i]->getArea();
+		}
+		node->sahCost = node->nPrimitives * node->bounds.SurfaceArea();
+		return node;
+	}
+
+	// Split [begin, end) where the highest differing bit below `bit` flips. Codes are sorted, so that position
+	// is found by binary search; ranges of identical codes are split in the middle.
+	BVHBuildNode *emitLBVH(const LBVHBuildInput &in, int begin, int end, int bit, int depth) {
+		if(end - begin <= in.maxPrimsInNode)
+			return makeLeaf(in, begin, end);
+
+		int split = begin + (end - begin) / 2, axis = 0;
+		for(; bit >= 0; --bit) {
+			uint64_t mask = uint64_t(1) << bit;
+			if((in.morton[begin].code & mask) == (in.morton[end - 1].code & mask))
+				continue;
+			split = std::partition_point(in.morton.begin() + begin, in.morton.begin() + end,
+			                             [&](const MortonPrimitive &m) { return (m.code & mask) == 0; }) -
+			        in.morton.begin();
+			axis = bit % 3;
+			--bit;
+			break;
+		}
+
+		BVHBuildNode *node = newNode(in);
+		node->splitAxis    = axis;
+		if(depth < in.parallelDepth && end - begin > 16384) {
+			std::thread left([&] { node->left = emitLBVH(in, begin, split, bit, depth + 1); });
+			node->right = emitLBVH(in, split, end, bit, depth + 1);
+			left.join();
+		} else {
+			node->left  = emitLBVH(in, begin, split, bit, depth + 1);
+			node->right = emitLBVH(in, split, end, bit, depth + 1);
+		}
+		node->bounds  = Union(node->left->bounds, node->right->bounds);
+		node->area    = node->left->area + node->right->area;
+		node->sahCost = kTraversalCost * node->bounds.SurfaceArea() + node->left->sahCost + node->right->sahCost;
+		return node;
+	}
+
+	// Treelet restructuring (Karras & Aila 2013): grow a treelet of up to kTreeletLeaves subtrees below `root` by
+	// repeatedly opening the largest one, then find the binary topology over them with the lowest SAH cost by
+	// dynamic programming over all subsets and rewire the treelet's interior nodes if it is cheaper.
+	constexpr int kTreeletLeaves = 7;
+
+	void restructureTreelet(BVHBuildNode *root) {
+		BVHBuildNode *leaves[kTreeletLeaves] = {root->left, root->right};
+		BVHBuildNode *interior[kTreeletLeaves - 1] = {root};
+		int nLeaves = 2, nInterior = 1;
+		while(nLeaves < kTreeletLeaves) {
+			int largest = -1;
+			for(int i = 0; i < nLeaves; ++i) {
+				if(leaves[i]->nPrimitives == 0 &&
+				   (largest < 0 || leaves[i]->bounds.SurfaceArea() > leaves[largest]->bounds.SurfaceArea()))
+					largest = i;
+			}
+			if(largest < 0)
+				break;
+			BVHBuildNode *opened  = leaves[largest];
+			interior[nInterior++] = opened;
+			leaves[largest]       = opened->left;
+			leaves[nLeaves++]     = opened->right;
+		}
+		if(nLeaves < 3)
+			return;
+
+		constexpr int kSubsets = 1 << kTreeletLeaves;
+		Bounds3 bounds[kSubsets];
+		float cost[kSubsets];
+		int bestSplit[kSubsets] = {};
+		int full = (1 << nLeaves) - 1;
+		for(int s = 1; s <= full; ++s) {
+			int low = s & -s;
+			if(s == low) {
+				int i     = __builtin_ctz(s);
+				bounds[s] = leaves[i]->bounds;
+				cost[s]   = leaves[i]->sahCost;
+				continue;
+			}
+			bounds[s] = Union(bounds[s ^ low], bounds[low]);
+			// Each unordered partition is visited once: the side holding the lowest leaf is enumerated
+			float best = std::numeric_limits<float>::max();
+			for(int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+				if(!(p & low))
+					continue;
+				float c = cost[p] + cost[s ^ p];
+				if(c < best) {
+					best         = c;
+					bestSplit[s] = p;
+				}
+			}
+			cost[s] = kTraversalCost * bounds[s].SurfaceArea() + best;
+		}
+		if(cost[full] >= root->sahCost * 0.9999f)
+			return;
+
+		int nextInterior = 1;
+		auto rebuild = [&](auto &&self, BVHBuildNode *node, int s) -> void {
+			BVHBuildNode *children[2];
+			int sides[2] = {bestSplit[s], s ^ bestSplit[s]};
+			for(int k = 0; k < 2; ++k) {
+				if((sides[k] & (sides[k] - 1)) == 0) {
+					children[k] = leaves[__builtin_ctz(sides[k])];
+				} else {
+					children[k] = interior[nextInterior++];
+					self(self, children[k], sides[k]);
+				}
+			}
+			node->left      = children[0];
+			node->right     = children[1];
+			node->bounds    = bounds[s];
+			node->area      = children[0]->area + children[1]->area;
+			node->sahCost   = cost[s];
+			node->splitAxis = Bounds3(children[0]->bounds.Centroid(), children[1]->bounds.Centroid()).maxExtent();
+		};
+		rebuild(rebuild, root, full);
+	}
+
+	// Bottom-up restructuring pass; returns the number of primitives below node
+	int restructureLBVH(BVHBuildNode *node, int depth, int parallelDepth) {
+		if(node->nPrimitives > 0)
+			return node->nPrimitives;
+		int nLeft = 0, nRight = 0;
+		if(depth < parallelDepth) {
+			std::thread left([&] { nLeft = restructureLBVH(node->left, depth + 1, parallelDepth); });
+			nRight = restructureLBVH(node->right, depth + 1, parallelDepth);
+			left.join();
+		} else {
+			nLeft  = restructureLBVH(node->left, depth + 1, parallelDepth);
+			nRight = restructureLBVH(node->right, depth + 1, parallelDepth);
+		}
+		node->bounds  = Union(node->left->bounds, node->right->bounds);
+		node->sahCost = kTraversalCost * node->bounds.SurfaceArea() + node->left->sahCost + node->right->sahCost;
+		if(nLeft + nRight >= kTreeletLeaves)
+			restructureTreelet(node);
+		return nLeft + nRight;
+	}
+
+	// Restructuring moves subtrees around: renumber the leaves so every subtree's primitives stay contiguous
+	void compactLeaves(BVHBuildNode *node, std::vector<Object *> &orderedPrims, std::vector<Object *> &out) {
+		if(node->nPrimitives > 0) {
+			int first = out.size();
+			for(int i = 0; i < node->nPrimitives; ++i)
+				out.push_back(orderedPrims[node->firstPrimOffset + i]);
+			node->firstPrimOffset = first;
+			return;
+		}
+		compactLeaves(node->left, orderedPrims, out);
+		compactLeaves(node->right, orderedPrims, out);
+	}
+}// namespace
+
+BVHBuildNode *BVHAccel::buildSubtree(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena) {
+	if(splitMethod == SplitMethod::LBVH && !objects.empty())
+		return buildLBVH(std::move(objects), orderedPrims, arena);
+	if(splitMethod == SplitMethod::SBVH && !objects.empty())
+		return buildSBVH(std::move(objects), orderedPrims, arena);
+	return recursiveBuild({objects.data(), objects.data() + objects.size()}, orderedPrims, arena);
+}
+
+BVHBuildNode *BVHAccel::buildLBVH(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena) {
+	int n        = objects.size();
+	int nThreads = std::min(hardwareThreads(), std::max(1, n / 65536));
+	// 30-bit codes (10 bits per axis) sort in four passes; big meshes need 63-bit codes to avoid collisions
+	int bitsPerAxis = n > (1 << 16) ? 21 : 10;
+
+	Bounds3 centroidBounds;
+	for(auto *obj: objects)
+		centroidBounds = Union(centroidBounds, obj->getBounds().Centroid());
+	std::vector<MortonPrimitive> morton(n);
+	parallelFor(nThreads, [&](int t) {
+		for(int i = (int64_t) n * t / nThreads; i < (int64_t) n * (t + 1) / nThreads; ++i)
+			morton[i] = {encodeMorton3(centroidBounds.Offset(objects[i]->getBounds().Centroid()), bitsPerAxis), (uint32_t) i};
+	});
+	radixSort(morton, 3 * bitsPerAxis, nThreads);
+
+	int primBase = orderedPrims.size();
+	std::vector<Object *> sorted(n);
+	for(int i = 0; i < n; ++i)
+		sorted[i] = objects[morton[i].index];
+	int parallelDepth = 0;
+	while((1 << parallelDepth) < hardwareThreads())
+		++parallelDepth;
+	std::atomic<int> nextNode{0};
+	LBVHBuildInput in{sorted, morton, primBase, maxPrimsInNode, parallelDepth, arena.alloc<BVHBuildNode>(2 * n - 1), &nextNode};
+	BVHBuildNode *node = emitLBVH(in, 0, n, 3 * bitsPerAxis - 1, 0);
+	orderedPrims.insert(orderedPrims.end(), sorted.begin(), sorted.end());
+
+	if(lbvhTreeletPasses > 0 && n >= kTreeletLeaves) {
+		for(int pass = 0; pass < lbvhTreeletPasses; ++pass)
+			restructureLBVH(node, 0, parallelDepth);
+		std::vector<Object *> compacted;
+		compacted.reserve(orderedPrims.size());
+		compacted.assign(orderedPrims.begin(), orderedPrims.begin() + primBase);
+		compactLeaves(node, orderedPrims, compacted);
+		orderedPrims.swap(compacted);
+	}
+	return node;
+}
+
+namespace {
+	// A (possibly clipped) reference to a primitive during the SBVH build
+	struct PrimitiveRef {
+		Object *prim;
+		Bounds3 bounds;
+	};
+
+	struct SBVHBuildState {
+		int maxPrimsInNode;
+		float minOverlapArea;// object split overlap above which spatial splits are tried
+		int64_t budget;      // extra references spatial splits may still create
+		std::vector<Object *> &orderedPrims;
+		MemoryArena &arena;
+	};
+
+	struct SBVHSplit {
+		float cost     = std::numeric_limits<float>::max();
+		int axis       = 0;
+		int bucket     = 0;// object split: last bucket on the left
+		bool spatial   = false;
+		float position = 0;// spatial split: plane position
+		Bounds3 left, right;
+		int nLeft = 0, nRight = 0;
+	};
+
+	constexpr int kSBVHBuckets = 12;
+
+	float component(const Vector3f &v, int axis) { return (&v.x)[axis]; }
+
+	// box restricted to the half space on one side of the plane axis = position
+	Bounds3 halfSpace(Bounds3 box, int axis, float position, bool upper) {
+		(&(upper ? box.pMin : box.pMax).x)[axis] = position;
+		return box;
+	}
+
+	bool isEmpty(const Bounds3 &b) { return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z; }
+
+	BVHBuildNode *sbvhLeaf(const std::vector<PrimitiveRef> &refs, const Bounds3 &bounds, SBVHBuildState &state) {
+		BVHBuildNode *node    = state.arena.make<BVHBuildNode>();
+		node->bounds          = bounds;
+		node->object          = refs[0].prim;
+		node->area            = 0;
+		node->firstPrimOffset = state.orderedPrims.size();
+		node->nPrimitives     = refs.size();
+		for(const PrimitiveRef &ref: refs) {
+			node->area += ref.prim->getArea();
+			state.orderedPrims.push_back(ref.prim);
+		}
+		return node;
+	}
+
+	BVHBuildNode *sbvhBuild(std::vector<PrimitiveRef> refs, SBVHBuildState &state) {
+		Bounds3 bounds, centroidBounds;
+		for(PrimitiveRef &ref: refs) {
+			bounds         = Union(bounds, ref.bounds);
+			centroidBounds = Union(centroidBounds, ref.bounds.Centroid());
+		}
+		int n = refs.size();
+		if(n == 1)
+			return sbvhLeaf(refs, bounds, state);
+		float invArea = bounds.SurfaceArea() > 0 ? 1 / bounds.SurfaceArea() : 0;
+
+		// Object split: bucketed SAH over reference centroids on every axis
+		SBVHSplit best;
+		auto bucketOf = [&](const PrimitiveRef &ref, int axis) {
+			float cMin = component(centroidBounds.pMin, axis), cExtent = component(centroidBounds.Diagonal(), axis);
+			int b      = kSBVHBuckets * ((component(ref.bounds.Centroid(), axis) - cMin) / cExtent);
+			return std::min(std::max(b, 0), kSBVHBuckets - 1);
+		};
+		for(int axis = 0; axis < 3; ++axis) {
+			if(component(centroidBounds.Diagonal(), axis) <= 0)
+				continue;
+			int count[kSBVHBuckets] = {};
+			Bounds3 boxes[kSBVHBuckets];
+			for(const PrimitiveRef &ref: refs) {
+				int b = bucketOf(ref, axis);
+				count[b]++;
+				boxes[b] = Union(boxes[b], ref.bounds);
+			}
+			Bounds3 rightBounds[kSBVHBuckets];
+			int rightCount[kSBVHBuckets] = {};
+			for(int i = kSBVHBuckets - 1; i > 0; --i) {
+				rightBounds[i - 1] = Union(i < kSBVHBuckets - 1 ? rightBounds[i] : Bounds3(), boxes[i]);
+				rightCount[i - 1]  = (i < kSBVHBuckets - 1 ? rightCount[i] : 0) + count[i];
+			}
+			Bounds3 leftBounds;
+			int leftCount = 0;
+			for(int i = 0; i < kSBVHBuckets - 1; ++i) {
+				leftBounds = Union(leftBounds, boxes[i]);
+				leftCount += count[i];
+				if(leftCount == 0 || rightCount[i] == 0)
+					continue;
+				float cost = kTraversalCost + (leftCount * leftBounds.SurfaceArea() + rightCount[i] * rightBounds[i].SurfaceArea()) * invArea;
+				if(cost < best.cost) {
+					best.cost   = cost;
+					best.axis   = axis;
+					best.bucket = i;
+					best.left   = leftBounds;
+					best.right  = rightBounds[i];
+					best.nLeft  = leftCount;
+					best.nRight = rightCount[i];
+				}
+			}
+		}
+
+		// Spatial split: only worth trying when the object split children overlap noticeably
+		Bounds3 overlap = best.cost < std::numeric_limits<float>::max() ? best.left.Intersect(best.right) : bounds;
+		if(state.budget > 0 && !isEmpty(overlap) && overlap.SurfaceArea() > state.minOverlapArea) {
+			for(int axis = 0; axis < 3; ++axis) {
+				float lo = component(bounds.pMin, axis), extent = component(bounds.Diagonal(), axis);
+				if(extent <= 0)
+					continue;
+				float width = extent / kSBVHBuckets;
+				auto binOf  = [&](float x) { return std::min(std::max(int((x - lo) / width), 0), kSBVHBuckets - 1); };
+				int enter[kSBVHBuckets] = {}, exit[kSBVHBuckets] = {};
+				Bounds3 bins[kSBVHBuckets];
+				for(const PrimitiveRef &ref: refs) {
+					int first = binOf(component(ref.bounds.pMin, axis)), last = binOf(component(ref.bounds.pMax, axis));
+					if(first == last) {
+						bins[first] = Union(bins[first], ref.bounds);
+					} else {
+						// Chop the reference into the bins it spans
+						for(int b = first; b <= last; ++b) {
+							Bounds3 slab = halfSpace(halfSpace(ref.bounds, axis, lo + b * width, true), axis, lo + (b + 1) * width, false);
+							Bounds3 part = ref.prim->getClippedBounds(slab);
+							if(!isEmpty(part))
+								bins[b] = Union(bins[b], part.Intersect(slab));
+						}
+					}
+					enter[first]++;
+					exit[last]++;
+				}
+				Bounds3 rightBounds[kSBVHBuckets];
+				int rightCount[kSBVHBuckets] = {};
+				for(int i = kSBVHBuckets - 1; i > 0; --i) {
+					rightBounds[i - 1] = Union(i < kSBVHBuckets - 1 ? rightBounds[i] : Bounds3(), bins[i]);
+					rightCount[i - 1]  = (i < kSBVHBuckets - 1 ? rightCount[i] : 0) + exit[i];
+				}
+				Bounds3 leftBounds;
+				int leftCount = 0;
+				for(int i = 0; i < kSBVHBuckets - 1; ++i) {
+					leftBounds = Union(leftBounds, bins[i]);
+					leftCount += enter[i];
+					if(leftCount == 0 || rightCount[i] == 0 || leftCount + rightCount[i] - n > state.budget)
+						continue;
+					float cost = kTraversalCost + (leftCount * leftBounds.SurfaceArea() + rightCount[i] * rightBounds[i].SurfaceArea()) * invArea;
+					if(cost < best.cost) {
+						best.cost     = cost;
+						best.axis     = axis;
+						best.spatial  = true;
+						best.position = lo + (i + 1) * width;
+						best.left     = leftBounds;
+						best.right    = rightBounds[i];
+						best.nLeft    = leftCount;
+						best.nRight   = rightCount[i];
+					}
+				}
+			}
+		}
+
+		// Create a leaf when splitting does not pay off
+		if(n <= state.maxPrimsInNode && best.cost >= (float) n)
+			return sbvhLeaf(refs, bounds, state);
+
+		std::vector<PrimitiveRef> left, right;
+		if(best.spatial) {
+			float leftArea = best.left.SurfaceArea(), rightArea = best.right.SurfaceArea();
+			for(const PrimitiveRef &ref: refs) {
+				if(component(ref.bounds.pMax, best.axis) <= best.position) {
+					left.push_back(ref);
+				} else if(component(ref.bounds.pMin, best.axis) >= best.position) {
+					right.push_back(ref);
+				} else {
+					Bounds3 lowSide  = halfSpace(ref.bounds, best.axis, best.position, false);
+					Bounds3 highSide = halfSpace(ref.bounds, best.axis, best.position, true);
+					Bounds3 l = ref.prim->getClippedBounds(lowSide).Intersect(lowSide);
+					Bounds3 r = ref.prim->getClippedBounds(highSide).Intersect(highSide);
+					// Reference unsplitting: keep the whole reference on one side if that is cheaper
+					float splitCost = leftArea * best.nLeft + rightArea * best.nRight;
+					float toLeft    = Union(best.left, ref.bounds).SurfaceArea() * best.nLeft + rightArea * (best.nRight - 1);
+					float toRight   = leftArea * (best.nLeft - 1) + Union(best.right, ref.bounds).SurfaceArea() * best.nRight;
+					if(isEmpty(r) || (!isEmpty(l) && toLeft < splitCost && toLeft <= toRight)) {
+						left.push_back(ref);
+					} else if(isEmpty(l) || toRight < splitCost) {
+						right.push_back(ref);
+					} else {
+						left.push_back({ref.prim, l});
+						right.push_back({ref.prim, r});
+						state.budget--;
+					}
+				}
+			}
+		} else if(best.cost < std::numeric_limits<float>::max()) {
+			for(const PrimitiveRef &ref: refs)
+				(bucketOf(ref, best.axis) <= best.bucket ? left : right).push_back(ref);
+		}
+
+		if(left.empty() || right.empty()) {
+			// No usable split (e.g. identical centroids): halve along the largest centroid extent
+			int axis = centroidBounds.maxExtent();
+			std::sort(refs.begin(), refs.end(), [&](const PrimitiveRef &a, const PrimitiveRef &b) {
+				return component(a.bounds.Centroid(), axis) < component(b.bounds.Centroid(), axis);
+			});
+			left.assign(refs.begin(), refs.begin() + n / 2);
+			right.assign(refs.begin() + n / 2, refs.end());
+			best.axis = axis;
+		}
+		refs.clear();
+		refs.shrink_to_fit();
+
+		BVHBuildNode *node = state.arena.make<BVHBuildNode>();
+		node->splitAxis    = best.axis;
+		node->left         = sbvhBuild(std::move(left), state);
+		node->right        = sbvhBuild(std::move(right), state);
+		node->bounds       = Union(node->left->bounds, node->right->bounds);
+		node->area         = node->left->area + node->right->area;
+		return node;
+	}
+}// namespace
+
+BVHBuildNode *BVHAccel::buildSBVH(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena) {
+	std::vector<PrimitiveRef> refs;
+	refs.reserve(objects.size());
+	Bounds3 bounds;
+	for(auto *obj: objects) {
+		refs.push_back({obj, obj->getBounds()});
+		bounds = Union(bounds, refs.back().bounds);
+	}
+	SBVHBuildState state{maxPrimsInNode, float(sbvhMinOverlap * bounds.SurfaceArea()),
+	                     int64_t(sbvhReferenceBudget * objects.size()), orderedPrims, arena};
+	return sbvhBuild(std::move(refs), state);
+}
+
+void BVHAccel::refit() {
+	// Children are stored after their parent, so a reverse sweep visits them first. SBVH leaves fall back to
+	// the full bounds of their primitives.
+	for(int i = totalNodes - 1; i >= 0; --i) {
+		LinearBVHNode &node = nodes[i];
+		Bounds3 b;
+		float a = 0;
+		if(node.nPrimitives > 0) {
+			for(int k = 0; k < node.nPrimitives; ++k) {
+				b = Union(b, primitives[node.primitivesOffset + k]->getBounds());
+				a += primitives[node.primitivesOffset + k]->getArea();
+			}
+		} else {
+			const LinearBVHNode &l = nodes[node.childOffset], &r = nodes[node.childOffset + 1];
+			b = Union(l.getBounds(), r.getBounds());
+			a = l.area + r.area;
+		}
+		for(int k = 0; k < 3; ++k) {
+			node.bounds[0][k] = (&b.pMin.x)[k];
+			node.bounds[1][k] = (&b.pMax.x)[k];
+		}
+		node.area = a;
+	}
+	if(!wideNodes.empty())
+		refitCompressed();
+}
+
+void BVHAccel::computeSubtreeCosts(std::vector<float> &costNow, std::vector<float> &costRef) const {
+	costNow.resize(totalNodes);
+	costRef.resize(totalNodes);
+	for(int i = totalNodes - 1; i >= 0; --i) {
+		const LinearBVHNode &node = nodes[i];
+		if(node.nPrimitives > 0) {
+			costNow[i] = node.nPrimitives * surfaceArea(node);
+			costRef[i] = node.nPrimitives * refArea[i];
+		} else {
+			int c      = node.childOffset;
+			costNow[i] = kTraversalCost * surfaceArea(node) + costNow[c] + costNow[c + 1];
+			costRef[i] = kTraversalCost * refArea[i] + costRef[c] + costRef[c + 1];
+		}
+	}
+}
+
+void BVHAccel::measureDepth() {
+	// Children are stored after their parent in every layout, so a reverse sweep sees them first
+	std::vector<int> height(totalNodes);
+	for(int i = totalNodes - 1; i >= 0; --i)
+		height[i] = nodes[i].nPrimitives > 0 ? 1 : 1 + std::max(height[nodes[i].childOffset], height[nodes[i].childOffset + 1]);
+	treeDepth = totalNodes > 0 ? height[0] : 0;
+}
+
+float BVHAccel::SAHCost() const {
+	float cost = 0;
+	for(int i = 0; i < totalNodes; ++i) {
+		const LinearBVHNode &node = nodes[i];
+		cost += (node.nPrimitives > 0 ? node.nPrimitives : kTraversalCost) * surfaceArea(node);
+	}
+	return totalNodes > 0 && surfaceArea(nodes[0]) > 0 ? cost / surfaceArea(nodes[0]) : 0;
+}
+
+BVHAccel::UpdateStats BVHAccel::update(float rebuildThreshold) {
+	UpdateStats stats;
+	if(totalNodes == 0)
+		return stats;
+	// Before the first update the nodes still hold their built (or cache-loaded) bounds: use them as the reference
+	if((int) refArea.size() != totalNodes) {
+		refArea.resize(totalNodes);
+		for(int i = 0; i < totalNodes; ++i)
+			refArea[i] = surfaceArea(nodes[i]);
+	}
+
+	auto refitStart = std::chrono::steady_clock::now();
+	refit();
+	auto refitStop = std::chrono::steady_clock::now();
+	stats.refitMs  = std::chrono::duration<double, std::milli>(refitStop - refitStart).count();
+
+	// Quality of each subtree: SAH cost normalized by its own area, relative to the same value at build time
+	std::vector<float> costNow, costRef;
+	computeSubtreeCosts(costNow, costRef);
+	auto quality = [&](int i) {
+		float now = surfaceArea(nodes[i]), ref = refArea[i];
+		if(now <= 0 || ref <= 0 || costRef[i] <= 0)
+			return 1.0f;
+		return (costNow[i] / now) / (costRef[i] / ref);
+	};
+	stats.costRatio = quality(0);
+	if(stats.costRatio <= rebuildThreshold)
+		return stats;
+
+	// Descend into degraded children; a degraded node whose children are fine is rebuilt as a whole
+	std::vector<int> firstPrim(totalNodes), nPrims(totalNodes);
+	for(int i = totalNodes - 1; i >= 0; --i) {
+		if(nodes[i].nPrimitives > 0) {
+			firstPrim[i] = nodes[i].primitivesOffset;
+			nPrims[i]    = nodes[i].nPrimitives;
+		} else {
+			int c        = nodes[i].childOffset;
+			firstPrim[i] = std::min(firstPrim[c], firstPrim[c + 1]);
+			nPrims[i]    = nPrims[c] + nPrims[c + 1];
+		}
+	}
+	std::vector<int> degraded, stack = {0};
+	while(!stack.empty()) {
+		int i = stack.back();
+		stack.pop_back();
+		if(quality(i) <= rebuildThreshold || nodes[i].nPrimitives > 0)
+			continue;
+		int l = nodes[i].childOffset, r = l + 1;
+		bool childDegraded = false;
+		for(int c: {l, r}) {
+			if(nodes[c].nPrimitives == 0 && quality(c) > rebuildThreshold) {
+				stack.push_back(c);
+				childDegraded = true;
+			}
+		}
+		if(!childDegraded)
+			degraded.push_back(i);
+	}
+	if(degraded.empty())
+		return stats;
+
+	auto rebuildStart = std::chrono::steady_clock::now();
+	MemoryArena arena;
+	std::vector<std::pair<int, BVHBuildNode *>> rebuilt;
+	size_t extraNodes = 0;
+	for(int i: degraded) {
+		// A subtree's primitives are contiguous, so the rebuilt order is written back in place. Spatial splits
+		// would change the number of references, so SBVH subtrees are rebuilt with plain SAH.
+		std::vector<Object *> prims(primitives.begin() + firstPrim[i], primitives.begin() + firstPrim[i] + nPrims[i]);
+		std::vector<Object *> orderedPrims;
+		orderedPrims.reserve(prims.size());
+		rebuilt.emplace_back(i, splitMethod == SplitMethod::SBVH ? recursiveBuild({prims.data(), prims.data() + prims.size()}, orderedPrims, arena)
+		                                                         : buildSubtree(prims, orderedPrims, arena));
+		std::copy(orderedPrims.begin(), orderedPrims.end(), primitives.begin() + firstPrim[i]);
+		extraNodes += 2 * nPrims[i];
+		stats.rebuiltPrims += nPrims[i];
+	}
+	std::sort(rebuilt.begin(), rebuilt.end());
+
+	std::vector<LinearBVHNode> old(nodes, nodes + totalNodes);
+	std::vector<float> oldRefArea;
+	oldRefArea.swap(refArea);
+	nodeStorage.assign(old.size() + extraNodes, LinearBVHNode());
+	refArea.assign(nodeStorage.size(), 0);
+	int offset = 1;
+	relinkBVHTree(old, oldRefArea, 0, 0, rebuilt, firstPrim, refArea, &offset);
+	nodeStorage.resize(offset);
+	refArea.resize(offset);
+	nodes      = nodeStorage.data();
+	totalNodes = offset;
+	nodeOwner.reset();
+	measureDepth();
+	if(vebLayout)
+		reorderNodes();
+	if(!wideNodes.empty())
+		compress();
+
+	stats.rebuildMs       = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - rebuildStart).count();
+	stats.rebuiltSubtrees = rebuilt.size();
+	computeSubtreeCosts(costNow, costRef);
+	stats.costRatio = quality(0);
+	return stats;
+}
+
+void BVHAccel::relinkBVHTree(const std::vector<LinearBVHNode> &old, const std::vector<float> &oldRefArea, int oldIndex, int nodeIndex,
+                             const std::vector<std::pair<int, BVHBuildNode *>> &rebuilt, const std::vector<int> &firstPrim,
+                             std::vector<float> &newRefArea, int *offset) {
+	auto it = std::lower_bound(rebuilt.begin(), rebuilt.end(), std::make_pair(oldIndex, (BVHBuildNode *) nullptr));
+	if(it != rebuilt.end() && it->first == oldIndex) {
+		// Freshly built subtree: its current areas become the new reference
+		int first = *offset;
+		flattenBVHTree(it->second, nodeIndex, offset, firstPrim[oldIndex]);
+		newRefArea[nodeIndex] = surfaceArea(nodeStorage[nodeIndex]);
+		for(int i = first; i < *offset; ++i)
+			newRefArea[i] = surfaceArea(nodeStorage[i]);
+		return;
+	}
+
+	nodeStorage[nodeIndex] = old[oldIndex];
+	newRefArea[nodeIndex]  = oldRefArea[oldIndex];
+	if(old[oldIndex].nPrimitives == 0) {
+		int c                              = *offset;
+		nodeStorage[nodeIndex].childOffset = c;
+		*offset += 2;
+		relinkBVHTree(old, oldRefArea, old[oldIndex].childOffset, c, rebuilt, firstPrim, newRefArea, offset);
+		relinkBVHTree(old, oldRefArea, old[oldIndex].childOffset + 1, c + 1, rebuilt, firstPrim, newRefArea, offset);
+	}
+}
+
+void BVHAccel::reorderNodes() {
+	vebLayout = true;
+	if(totalNodes <= 1)
+		return;
+
+	// Lay out units rather than nodes so that siblings stay adjacent: the root on its own, then the child pairs,
+	// named by the index of their first node. A unit's children are the child pairs of its (up to two) nodes.
+	std::vector<int> height(totalNodes);
+	for(int i = totalNodes - 1; i >= 0; --i)
+		height[i] = nodes[i].nPrimitives > 0 ? 1 : 1 + std::max(height[nodes[i].childOffset], height[nodes[i].childOffset + 1]);
+	std::vector<int> size(totalNodes);
+	for(int i = totalNodes - 1; i >= 0; --i)
+		size[i] = nodes[i].nPrimitives > 0 ? 1 : 1 + size[nodes[i].childOffset] + size[nodes[i].childOffset + 1];
+	auto unitSize     = [&](int unit) { return unit == 0 ? 1 : 2; };
+	auto unitHeight   = [&](int unit) { return unit == 0 ? height[0] : std::max(height[unit], height[unit + 1]); };
+	auto unitNodes    = [&](int unit) { return unit == 0 ? size[0] : size[unit] + size[unit + 1]; };
+	auto forEachChild = [&](int unit, auto &&f) {
+		for(int i = unit; i < unit + unitSize(unit); ++i)
+			if(nodes[i].nPrimitives == 0)
+				f(nodes[i].childOffset);
+	};
+
+	std::vector<int> newIndex(totalNodes, -1);
+	int next = 0;
+	auto emit = [&](int unit) {
+		for(int i = unit; i < unit + unitSize(unit); ++i)
+			newIndex[i] = next++;
+	};
+	// Subtrees that fit in a page keep the depth-first order of the build: at that scale it touches slightly
+	// fewer cache lines than recursing further
+	constexpr int kPageNodes = 4096 / sizeof(LinearBVHNode);
+	auto depthFirst          = [&](auto &&self, int node) -> void {
+		if(nodes[node].nPrimitives == 0) {
+			emit(nodes[node].childOffset);
+			self(self, nodes[node].childOffset);
+			self(self, nodes[node].childOffset + 1);
+		}
+	};
+
+	// Above that, van Emde Boas order: the top half of the levels first, then each subtree below them, recursively
+	std::vector<int> frontier;
+	auto layout = [&](auto &&self, int unit, int levels) -> void {
+		if(levels >= unitHeight(unit) && unitNodes(unit) <= kPageNodes) {
+			emit(unit);
+			for(int i = unit; i < unit + unitSize(unit); ++i)
+				depthFirst(depthFirst, i);
+			return;
+		}
+		if(levels == 1) {
+			emit(unit);
+			return;
+		}
+		int top = levels / 2;
+		self(self, unit, top);
+		// Units exactly top levels below this one root the bottom subtrees
+		size_t begin = frontier.size();
+		frontier.push_back(unit);
+		for(int depth = 0; depth < top; ++depth) {
+			size_t end = frontier.size();
+			for(size_t k = begin; k < end; ++k)
+				forEachChild(frontier[k], [&](int child) { frontier.push_back(child); });
+			frontier.erase(frontier.begin() + begin, frontier.begin() + end);
+		}
+		std::vector<int> bottoms(frontier.begin() + begin, frontier.end());
+		frontier.resize(begin);
+		for(int child: bottoms)
+			self(self, child, std::min(levels - top, unitHeight(child)));
+	};
+	layout(layout, 0, height[0]);
+	assert(next == totalNodes);
+
+	std::vector<LinearBVHNode> reordered(totalNodes);
+	for(int i = 0; i < totalNodes; ++i) {
+		reordered[newIndex[i]] = nodes[i];
+		if(nodes[i].nPrimitives == 0)
+			reordered[newIndex[i]].childOffset = newIndex[nodes[i].childOffset];
+	}
+	if((int) refArea.size() == totalNodes) {
+		std::vector<float> reorderedArea(totalNodes);
+		for(int i = 0; i < totalNodes; ++i)
+			reorderedArea[newIndex[i]] = refArea[i];
+		refArea.swap(reorderedArea);
+	}
+	nodeStorage.swap(reordered);
+	nodes = nodeStorage.data();
+	nodeOwner.reset();
+	if(!wideNodes.empty())
+		compress();
+}
+
+namespace {
+	// 2^e for the exponent range of a normal float, built directly from its bits
+	float exp2i(int e) {
+		uint32_t bits = uint32_t(e + 127) << 23;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	// Set wide's origin and exponents for the parent box and quantize its numChildren child boxes against them
+	void quantizeChildren(QuantizedBVHNode &wide, const Bounds3 &parent, const Bounds3 *children) {
+		for(int axis = 0; axis < 3; ++axis) {
+			// Smallest power of two step that spans the parent box in 255 steps, even after float rounding
+			float origin = (&parent.pMin.x)[axis], extent = (&parent.pMax.x)[axis] - origin;
+			int e        = extent > 0 ? std::max((int) std::ceil(std::log2(extent / 255.0f)), -126) : -126;
+			while(e < 127 && origin + 255 * exp2i(e) < (&parent.pMax.x)[axis])
+				++e;
+			float scale         = exp2i(e);
+			wide.origin[axis]   = origin;
+			wide.exponent[axis] = e;
+			for(int k = 0; k < wide.numChildren; ++k) {
+				float cMin = (&children[k].pMin.x)[axis], cMax = (&children[k].pMax.x)[axis];
+				// Round outwards, and keep stepping while float decoding would still land inside the child box
+				int lo = (int) std::floor((cMin - origin) / scale);
+				int hi = (int) std::ceil((cMax - origin) / scale);
+				lo     = std::min(std::max(lo, 0), 255);
+				hi     = std::min(std::max(hi, lo), 255);
+				while(lo > 0 && origin + lo * scale > cMin)
+					--lo;
+				while(hi < 255 && origin + hi * scale < cMax)
+					++hi;
+				wide.qMin[axis][k] = lo;
+				wide.qMax[axis][k] = hi;
+			}
+		}
+	}
+}// namespace
+
+void BVHAccel::compress() {
+	wideNodes.clear();
+	if(totalNodes == 0)
+		return;
+	wideNodes.reserve(totalNodes / 2 + 1);
+	compressNode(0);
+}
+
+int BVHAccel::compressNode(int nodeIndex) {
+	// Collapse the binary subtree into up to four children by repeatedly opening the largest interior child
+	int children[4], n = 0;
+	if(nodes[nodeIndex].nPrimitives > 0) {
+		children[n++] = nodeIndex;
+	} else {
+		children[n++] = nodes[nodeIndex].childOffset;
+		children[n++] = nodes[nodeIndex].childOffset + 1;
+	}
+	while(n < 4) {
+		int largest = -1;
+		for(int k = 0; k < n; ++k) {
+			if(nodes[children[k]].nPrimitives == 0 && (largest < 0 || surfaceArea(nodes[children[k]]) > surfaceArea(nodes[children[largest]])))
+				largest = k;
+		}
+		if(largest < 0)
+			break;
+		int opened        = children[largest];
+		children[largest] = nodes[opened].childOffset;
+		children[n++]     = nodes[opened].childOffset + 1;
+	}
+
+	QuantizedBVHNode wide{};
+	const LinearBVHNode &parent = nodes[nodeIndex];
+	wide.numChildren            = n;
+	Bounds3 childBounds[4];
+	for(int k = 0; k < n; ++k)
+		childBounds[k] = nodes[children[k]].getBounds();
+	quantizeChildren(wide, parent.getBounds(), childBounds);
+	for(int k = 0; k < n; ++k) {
+		const LinearBVHNode &c = nodes[children[k]];
+		assert(c.nPrimitives <= 255);
+		wide.childPrims[k] = c.nPrimitives;
+		wide.child[k]      = c.nPrimitives > 0 ? c.primitivesOffset : -1;
+	}
+
+	int myIndex = wideNodes.size();
+	wideNodes.push_back(wide);
+	for(int k = 0; k < n; ++k) {
+		if(nodes[children[k]].nPrimitives == 0) {
+			int childIndex              = compressNode(children[k]);
+			wideNodes[myIndex].child[k] = childIndex;
+		}
+	}
+	return myIndex;
+}
+
+void BVHAccel::refitCompressed() {
+	// Wide children are stored after their parent too. Only the boxes move, so each node keeps its children and is
+	// quantized again against its new box, which is the union of theirs.
+	std::vector<Bounds3> wideBounds(wideNodes.size());
+	for(int i = (int) wideNodes.size() - 1; i >= 0; --i) {
+		QuantizedBVHNode &wide = wideNodes[i];
+		Bounds3 childBounds[4], b;
+		for(int k = 0; k < wide.numChildren; ++k) {
+			if(wide.childPrims[k] > 0) {
+				for(int p = 0; p < wide.childPrims[k]; ++p)
+					childBounds[k] = Union(childBounds[k], primitives[wide.child[k] + p]->getBounds());
+			} else {
+				childBounds[k] = wideBounds[wide.child[k]];
+			}
+			b = Union(b, childBounds[k]);
+		}
+		quantizeChildren(wide, b, childBounds);
+		wideBounds[i] = b;
+	}
+}
+
+namespace {
+	// Traversal stack of at least capacity entries: on the call stack for trees of any usual depth, on the heap for
+	// deeper (degenerate) ones
+	template<typename T, int N>
+	class TraversalStack {
+	public:
+		explicit TraversalStack(int capacity) {
+			if(capacity > N) {
+				heap.resize(capacity);
+				entries = heap.data();
+			}
+		}
+		T &operator[](int i) { return entries[i]; }
+
+	private:
+		T local[N];
+		std::vector<T> heap;
+		T *entries = local;
+	};
+
+	// Node memory touched by one ray in measurement mode, as 64-byte line numbers
+	struct MemoryTouches {
+		std::vector<uintptr_t> lines;
+		uint64_t visits = 0;
+
+		void touch(const void *p, size_t size) {
+			++visits;
+			uintptr_t first = reinterpret_cast<uintptr_t>(p) >> 6, last = (reinterpret_cast<uintptr_t>(p) + size - 1) >> 6;
+			for(uintptr_t line = first; line <= last; ++line)
+				lines.push_back(line);
+		}
+		void addTo(BVHAccel::TraversalStats &stats) {
+			std::sort(lines.begin(), lines.end());
+			lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+			stats.rays++;
+			stats.nodes += visits;
+			stats.cacheLines += lines.size();
+			for(size_t i = 0; i < lines.size(); ++i)
+				stats.pages += i == 0 || lines[i] >> 6 != lines[i - 1] >> 6;
+		}
+	};
+}// namespace
+
+template<bool CountMemory>
+Intersection BVHAccel::traverseCompressed(Ray &ray, TraversalStats *stats) const {
 	Intersection isect;
-	if(!root)
+	if(wideNodes.empty())
 		return isect;
-	isect = BVHAccel::getIntersection(root, ray);
+
+	MemoryTouches touched;
+	float origin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+	float invDir[3] = {ray.direction_inv.x, ray.direction_inv.y, ray.direction_inv.z};
+	// Every node visited pushes at most three more entries than it pops
+	TraversalStack<int, 256> toVisit(3 * treeDepth + 1);
+	int toVisitOffset        = 0;
+	toVisit[toVisitOffset++] = 0;
+	while(toVisitOffset > 0) {
+		const QuantizedBVHNode &node = wideNodes[toVisit[--toVisitOffset]];
+		if constexpr(CountMemory)
+			touched.touch(&node, sizeof(node));
+
+		// Decode and slab-test all children, skipping those that start beyond the closest hit so far
+		float t0[4] = {ray.tMin, ray.tMin, ray.tMin, ray.tMin}, t1[4] = {ray.tMax, ray.tMax, ray.tMax, ray.tMax};
+		for(int axis = 0; axis < 3; ++axis) {
+			// Slab distances are affine in the quantized coordinates
+			float scale = exp2i(node.exponent[axis]) * invDir[axis];
+			float base  = (node.origin[axis] - origin[axis]) * invDir[axis];
+			for(int k = 0; k < 4; ++k) {
+				float tNear = base + node.qMin[axis][k] * scale;
+				float tFar  = base + node.qMax[axis][k] * scale;
+				t0[k]       = std::max(t0[k], std::min(tNear, tFar));
+				t1[k]       = std::min(t1[k], std::max(tNear, tFar));
+			}
+		}
+		float tEnter[4];
+		int hit[4], nHit = 0;
+		for(int k = 0; k < node.numChildren; ++k) {
+			if(t0[k] <= t1[k]) {
+				// Insertion sort, nearest first
+				int i = nHit++;
+				for(; i > 0 && tEnter[i - 1] > t0[k]; --i) {
+					tEnter[i] = tEnter[i - 1];
+					hit[i]    = hit[i - 1];
+				}
+				tEnter[i] = t0[k];
+				hit[i]    = k;
+			}
+		}
+
+		// Leaves are intersected right away; interior children are pushed far to near
+		for(int i = 0; i < nHit; ++i) {
+			int k = hit[i];
+			if(node.childPrims[k] == 0 || tEnter[i] > ray.tMax)
+				continue;
+			for(int p = 0; p < node.childPrims[k]; ++p) {
+				Intersection h = primitives[node.child[k] + p]->getIntersection(ray);
+				if(h.happened && h.distance < isect.distance) {
+					isect    = h;
+					ray.tMax = h.distance;
+				}
+			}
+		}
+		for(int i = nHit - 1; i >= 0; --i) {
+			if(node.childPrims[hit[i]] == 0 && tEnter[i] <= ray.tMax)
+				toVisit[toVisitOffset++] = node.child[hit[i]];
+		}
+	}
+	if constexpr(CountMemory)
+		touched.addTo(*stats);
 	return isect;
 }
 
-Intersection BVHAccel::getIntersection(BVHBuildNode *node, const Ray &ray) const {
-	// Traverse the BVH to find intersection
+Intersection BVHAccel::IntersectCompressed(Ray ray) const {
+	return traverseCompressed<false>(ray, nullptr);
+}
+
+template<bool CountMemory>
+Intersection BVHAccel::traverseBinary(Ray &ray, TraversalStats *stats) const {
 	Intersection isect;
-	if(!node || !node->bounds.IntersectP(ray, ray.direction_inv, {ray.direction.x < 0, ray.direction.y < 0, ray.direction.z < 0}))
+	if(!nodes)
 		return isect;
 
-	if(node->left == nullptr && node->right == nullptr) {
-		return node->object->getIntersection(ray);
+	// Traverse the flattened BVH front to back, keeping the closest hit
+	MemoryTouches touched;
+	std::array<int, 3> dirIsNeg = {ray.direction.x < 0, ray.direction.y < 0, ray.direction.z < 0};
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	TraversalStack<int, 64> nodesToVisit(treeDepth);
+	while(true) {
+		const LinearBVHNode *node = &nodes[currentNodeIndex];
+		if constexpr(CountMemory)
+			touched.touch(node, sizeof(*node));
+		if(node->getBounds().IntersectP(ray, ray.direction_inv, dirIsNeg)) {
+			if(node->nPrimitives > 0) {
+				for(int i = 0; i < node->nPrimitives; ++i) {
+					Intersection hit = primitives[node->primitivesOffset + i]->getIntersection(ray);
+					if(hit.happened && hit.distance < isect.distance) {
+						isect    = hit;
+						ray.tMax = hit.distance;
+					}
+				}
+				if(toVisitOffset == 0)
+					break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			} else {
+				// Put far BVH node on nodesToVisit stack, advance to near node
+				nodesToVisit[toVisitOffset++] = node->childOffset + !dirIsNeg[node->axis];
+				currentNodeIndex              = node->childOffset + dirIsNeg[node->axis];
+			}
+		} else {
+			if(toVisitOffset == 0)
+				break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
 	}
+	if constexpr(CountMemory)
+		touched.addTo(*stats);
+	return isect;
+}
 
-	Intersection leftIsect  = getIntersection(node->left, ray);
-	Intersection rightIsect = getIntersection(node->right, ray);
+Intersection BVHAccel::Intersect(Ray ray) const {
+	if(!wideNodes.empty())
+		return traverseCompressed<false>(ray, nullptr);
+	return traverseBinary<false>(ray, nullptr);
+}
 
-	if(leftIsect.happened && rightIsect.happened) {
-		return leftIsect.distance < rightIsect.distance ? leftIsect : rightIsect;
-	} else if(leftIsect.happened) {
-		return leftIsect;
-	} else if(rightIsect.happened) {
-		return rightIsect;
-	} else {
-		return {};
+Intersection BVHAccel::Intersect(Ray ray, TraversalStats &stats) const {
+	if(!wideNodes.empty())
+		return traverseCompressed<true>(ray, &stats);
+	return traverseBinary<true>(ray, &stats);
+}
+
+bool BVHAccel::IntersectP(const Ray &ray) const {
+	if(!nodes)
+		return false;
+
+	// Any hit ends the traversal; near-first order just tends to find one sooner
+	std::array<int, 3> dirIsNeg = {ray.direction.x < 0, ray.direction.y < 0, ray.direction.z < 0};
+	int toVisitOffset = 0, currentNodeIndex = 0;
+	TraversalStack<int, 64> nodesToVisit(treeDepth);
+	while(true) {
+		const LinearBVHNode *node = &nodes[currentNodeIndex];
+		if(node->getBounds().IntersectP(ray, ray.direction_inv, dirIsNeg)) {
+			if(node->nPrimitives > 0) {
+				for(int i = 0; i < node->nPrimitives; ++i)
+					if(primitives[node->primitivesOffset + i]->intersect(ray))
+						return true;
+			} else {
+				nodesToVisit[toVisitOffset++] = node->childOffset + !dirIsNeg[node->axis];
+				currentNodeIndex              = node->childOffset + dirIsNeg[node->axis];
+				continue;
+			}
+		}
+		if(toVisitOffset == 0)
+			return false;
+		currentNodeIndex = nodesToVisit[--toVisitOffset];
 	}
 }
 
+void BVHAccel::IntersectPacket(RayPacket &packet, Intersection *hits, uint32_t active, Object *owner) const {
+	if(!nodes || !active)
+		return;
+	const SimdKernels &simd = simdKernels();
+
+	// Near-first order along the first active ray; the rest of a coherent packet mostly agrees
+	int lead                    = __builtin_ctz(active);
+	std::array<int, 3> dirIsNeg = {packet.direction.x[lead] < 0, packet.direction.y[lead] < 0, packet.direction.z[lead] < 0};
+	struct Entry {
+		int node;
+		uint32_t rays;
+	};
+	TraversalStack<Entry, 64> toVisit(treeDepth);
+	int toVisitOffset = 0;
+	Entry current     = {0, active};
+	while(true) {
+		const LinearBVHNode &node = nodes[current.node];
+		// Rays whose closest hit moved in front of the box drop out here
+		uint32_t rays = simd.intersectBox(node.bounds, packet, current.rays);
+		if(rays && node.nPrimitives > 0) {
+			for(int i = 0; i < node.nPrimitives; ++i) {
+				Object *primitive = primitives[node.primitivesOffset + i];
+				primitive->intersectPacket(packet, hits, rays);
+				if(owner)
+					for(uint32_t r = rays; r; r &= r - 1)
+						if(hits[__builtin_ctz(r)].obj == primitive)
+							hits[__builtin_ctz(r)].obj = owner;
+			}
+		} else if(rays) {
+			toVisit[toVisitOffset++] = {node.childOffset + !dirIsNeg[node.axis], rays};
+			current                  = {node.childOffset + dirIsNeg[node.axis], rays};
+			continue;
+		}
+		if(toVisitOffset == 0)
+			break;
+		current = toVisit[--toVisitOffset];
+	}
+}
 
-void BVHAccel::getSample(BVHBuildNode *node, float p, Intersection &pos, float &pdf) {
-	if(node->left == nullptr || node->right == nullptr) {
-		node->object->Sample(pos, pdf);
-		pdf *= node->area;
+void BVHAccel::getSample(int nodeIndex, float p, Intersection &pos, float &pdf) {
+	const LinearBVHNode *node = &nodes[nodeIndex];
+	if(node->nPrimitives > 0) {
+		// Pick a primitive of the leaf proportional to its area
+		int i = 0;
+		for(; i < node->nPrimitives - 1; ++i) {
+			float a = primitives[node->primitivesOffset + i]->getArea();
+			if(p < a)
+				break;
+			p -= a;
+		}
+		primitives[node->primitivesOffset + i]->Sample(pos, pdf);
+		pdf *= primitives[node->primitivesOffset + i]->getArea();
 		return;
 	}
-	if(p < node->left->area)
-		getSample(node->left, p, pos, pdf);
+	const LinearBVHNode *left = &nodes[node->childOffset];
+	if(p < left->area)
+		getSample(node->childOffset, p, pos, pdf);
 	else
-		getSample(node->right, p - node->left->area, pos, pdf);
+		getSample(node->childOffset + 1, p - left->area, pos, pdf);
 }
 
 void BVHAccel::Sample(Intersection &pos, float &pdf) {
-	float p = std::sqrt(get_random_float()) * root->area;
-	getSample(root, p, pos, pdf);
-	pdf /= root->area;
-}
\ No newline at end of file
+	float p = std::sqrt(get_random_float()) * nodes[0].area;
+	getSample(0, p, pos, pdf);
+	pdf /= nodes[0].area;
+}
@@ -5,12 +5,15 @@
 #ifndef RAYTRACING_BVH_H
 #define RAYTRACING_BVH_H
 
+#include "Arena.hpp"
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Vector.hpp"
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <ctime>
 #include <memory>
 #include <vector>
@@ -19,6 +22,63 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 
+// Non-owning view of a contiguous range of primitives that a builder partitions in place
+struct PrimitiveRange {
+	Object **first, **last;
+	size_t size() const { return last - first; }
+	Object *&operator[](size_t i) const { return first[i]; }
+	Object **begin() const { return first; }
+	Object **end() const { return last; }
+};
+
+/**
+ * @brief 展平后的 BVH 节点。
+ *
+ * 内部节点的两个子节点总是相邻存放，位置为 childOffset 和 childOffset + 1，且位于父节点之后；
+ * 除此之外节点顺序不受限制（构建时按深度优先，reorderNodes 之后为 van Emde Boas 布局）。
+ * 叶子节点通过 primitivesOffset/nPrimitives 引用 BVHAccel::primitives 中的一段连续图元。
+ * 该结构是纯 POD，可以直接写入磁盘缓存并通过 mmap 原样使用（见 MeshCache）。
+ */
+struct LinearBVHNode {
+	float bounds[2][3];// bounds[0] = pMin, bounds[1] = pMax
+	union {
+		int32_t primitivesOffset;// leaf
+		int32_t childOffset;     // interior: first of the two adjacent children
+	};
+	uint16_t nPrimitives;// 0 -> interior node
+	uint8_t axis;        // interior node: xyz
+	uint8_t pad;
+	float area;// total surface area of the primitives below this node (SBVH: counted once per reference)
+
+	Bounds3 getBounds() const {
+		Bounds3 b;
+		b.pMin = Vector3f(bounds[0][0], bounds[0][1], bounds[0][2]);
+		b.pMax = Vector3f(bounds[1][0], bounds[1][1], bounds[1][2]);
+		return b;
+	}
+};
+static_assert(sizeof(LinearBVHNode) == 36, "LinearBVHNode is part of the on-disk mesh cache format");
+
+/**
+ * @brief 压缩的四叉 BVH 节点，恰好占一条 64 字节缓存行。
+ *
+ * 四个子节点的包围盒相对于本节点包围盒量化为 8 位整数：子包围盒在 axis 轴上的范围是
+ * origin[axis] + q * 2^exponent[axis]，量化时向外取整，保证解码后的盒子只会更大。
+ * 内部子节点的 child 是 wideNodes 中的下标；叶子子节点的 child 是 primitives 中的偏移，
+ * childPrims 为其图元数（0 表示内部节点）。
+ */
+struct alignas(64) QuantizedBVHNode {
+	float origin[3];
+	int8_t exponent[3];
+	uint8_t numChildren;
+	uint8_t qMin[3][4];// [axis][child]
+	uint8_t qMax[3][4];
+	int32_t child[4];
+	uint8_t childPrims[4];
+	uint8_t pad[4];
+};
+static_assert(sizeof(QuantizedBVHNode) == 64, "a compressed node must fill exactly one cache line");
+
 // BVHAccel Declarations
 inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
 class BVHAccel {
@@ -26,27 +86,121 @@ class BVHAccel {
 public:
 	// BVHAccel Public Types
 	enum class SplitMethod { NAIVE,
-		                     SAH };
+		                     SAH,
+		                     LBVH,
+		                     SBVH };
+
+	// Treelet restructuring passes run after an LBVH build (0 keeps the raw Morton hierarchy)
+	inline static int lbvhTreeletPasses = 1;
+	// SBVH: extra primitive references spatial splits may create, as a fraction of the primitive count, and the
+	// overlap of the object split children (relative to the root's surface area) above which spatial splits are tried
+	inline static float sbvhReferenceBudget = 0.3f;
+	inline static float sbvhMinOverlap      = 1e-5f;
 
 	// BVHAccel Public Methods
 	BVHAccel(std::vector<Object *> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
+	// Adopt an already flattened hierarchy (e.g. memory mapped from a mesh cache). primOrder[i] is the index
+	// into p of the i-th of primRefCount primitives referenced by the leaves; keepAlive owns the memory behind
+	// linearNodes.
+	BVHAccel(std::vector<Object *> p, LinearBVHNode *linearNodes, int nodeCount, const uint32_t *primOrder,
+	         int primRefCount, std::shared_ptr<void> keepAlive, int maxPrims = 1, SplitMethod method = SplitMethod::NAIVE);
 	Bounds3 WorldBound() const;
 	~BVHAccel();
 
-	Intersection Intersect(const Ray &ray) const;
-	Intersection getIntersection(BVHBuildNode *node, const Ray &ray) const;
+	// Closest hit within [ray.tMin, ray.tMax]. The ray is taken by value: traversal clips its tMax to each hit found.
+	Intersection Intersect(Ray ray) const;
+	// Whether anything is hit in (ray.tMin, ray.tMax), from either side of a surface; stops at the first hit found
 	bool IntersectP(const Ray &ray) const;
-	BVHBuildNode *root;
+
+	/**
+	 * @brief 遍历的访存统计（测量模式），按光线累加。
+	 */
+	struct TraversalStats {
+		uint64_t rays       = 0;
+		uint64_t nodes      = 0;// node visits
+		uint64_t cacheLines = 0;// distinct 64-byte lines of node data touched by each ray
+		uint64_t pages      = 0;// distinct 4 KiB pages of node data touched by each ray
+	};
+	// Same result as Intersect, additionally counting the node memory the traversal touches
+	Intersection Intersect(Ray ray, TraversalStats &stats) const;
+	// Trace a packet of rays together: each node's box is tested against all rays still inside it with one SIMD
+	// kernel call, and the traversal follows the first active ray's direction. Coherent packets (primary rays)
+	// share most nodes; hits and packet.tMax are updated as in Object::intersectPacket. Given an owner, the hits
+	// found here name it as the object hit instead of the primitive (a mesh answers for its triangles).
+	void IntersectPacket(RayPacket &packet, Intersection *hits, uint32_t active, Object *owner = nullptr) const;
+
+	// Lay the flattened nodes out in van Emde Boas order: the top half of the tree (by height) first, then each
+	// subtree hanging below it, recursively, so that every subtree is contiguous and the nodes a ray visits
+	// together share cache lines and pages at every scale. Sibling pairs stay adjacent; update() keeps the layout.
+	void reorderNodes();
+
+	// Build the compressed 4-wide layout from the flattened nodes; Intersect uses it from then on and update()
+	// keeps it in sync. The binary nodes stay around for update, sampling and the SAH statistics, so this adds memory:
+	// what it saves is node bytes fetched per ray.
+	void compress();
+	Intersection IntersectCompressed(Ray ray) const;
+	size_t nodeBytes() const { return size_t(totalNodes) * sizeof(LinearBVHNode); }
+	size_t compressedNodeBytes() const { return wideNodes.size() * sizeof(QuantizedBVHNode); }
+
+	/**
+	 * @brief 动画帧之间的更新结果。
+	 */
+	struct UpdateStats {
+		double refitMs      = 0;// bottom-up bounds refit
+		double rebuildMs    = 0;// partial rebuild of degraded subtrees (0 if none)
+		int rebuiltSubtrees = 0;
+		int rebuiltPrims    = 0;
+		float costRatio     = 1;// SAH cost relative to the last (re)build, after the update
+	};
+
+	// Recompute node bounds/areas bottom-up from the primitives' current bounds, O(nodes)
+	void refit();
+	// Refit, then rebuild the subtrees whose SAH cost grew by more than rebuildThreshold since they were built
+	UpdateStats update(float rebuildThreshold = 1.5f);
+	// SAH cost of the current tree normalized by the root's surface area
+	float SAHCost() const;
 
 	// BVHAccel Private Methods
-	BVHBuildNode *recursiveBuild(std::vector<Object *> objects);
+	// Build nodes come from a caller-owned arena and are dropped together once the tree has been flattened
+	BVHBuildNode *buildSubtree(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena);
+	BVHBuildNode *buildLBVH(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena);
+	BVHBuildNode *buildSBVH(std::vector<Object *> objects, std::vector<Object *> &orderedPrims, MemoryArena &arena);
+	BVHBuildNode *recursiveBuild(PrimitiveRange objects, std::vector<Object *> &orderedPrims, MemoryArena &arena);
+	void flattenBVHTree(BVHBuildNode *node, int nodeIndex, int *offset, int primBase = 0);
+	void relinkBVHTree(const std::vector<LinearBVHNode> &old, const std::vector<float> &oldRefArea, int oldIndex, int nodeIndex,
+	                   const std::vector<std::pair<int, BVHBuildNode *>> &rebuilt, const std::vector<int> &firstPrim,
+	                   std::vector<float> &newRefArea, int *offset);
+	void computeSubtreeCosts(std::vector<float> &costNow, std::vector<float> &costRef) const;
+	// Set treeDepth from the flattened nodes
+	void measureDepth();
+	int compressNode(int nodeIndex);
+	// Requantize the compressed nodes in place for the refitted primitive bounds
+	void refitCompressed();
+	// Both clip ray.tMax to the closest hit so far
+	template<bool CountMemory>
+	Intersection traverseBinary(Ray &ray, TraversalStats *stats) const;
+	template<bool CountMemory>
+	Intersection traverseCompressed(Ray &ray, TraversalStats *stats) const;
 
 	// BVHAccel Private Data
 	const int maxPrimsInNode;
 	const SplitMethod splitMethod;
-	std::vector<Object *> primitives;
+	std::vector<Object *> primitives;// in leaf order; an SBVH may list a primitive under several leaves
+
+	// Flattened hierarchy, either owned by nodeStorage or by nodeOwner (mapped file)
+	LinearBVHNode *nodes = nullptr;
+	int totalNodes       = 0;
+	std::vector<LinearBVHNode> nodeStorage;
+	std::shared_ptr<void> nodeOwner;
+	std::vector<QuantizedBVHNode> wideNodes;// empty unless compress() was called
+	bool vebLayout = false;                 // reorderNodes() was called
+	int treeDepth  = 0;                     // nodes on the longest path from the root to a leaf; sizes traversal stacks
+
+	// Wall time of the full build, and each node's surface area when its subtree was last (re)built
+	double buildTimeMs = 0;
+	std::vector<float> refArea;
 
-	void getSample(BVHBuildNode *node, float p, Intersection &pos, float &pdf);
+	void getSample(int nodeIndex, float p, Intersection &pos, float &pdf);
 	void Sample(Intersection &pos, float &pdf);
 };
 
@@ -56,6 +210,7 @@ struct BVHBuildNode {
 	BVHBuildNode *right;
 	Object *object;
 	float area;
+	float sahCost = 0;// unnormalized SAH cost of the subtree, used by LBVH treelet restructuring
 
 public:
 	int splitAxis = 0, firstPrimOffset = 0, nPrimitives = 0;
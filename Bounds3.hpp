@@ -6,6 +6,7 @@
 #define RAYTRACING_BOUNDS3_H
 #include "Ray.hpp"
 #include "Vector.hpp"
+#include "global.hpp"
 #include <array>
 #include <limits>
 
@@ -40,7 +41,7 @@ public:
 		return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
 	}
 
-	Vector3f Centroid() { return 0.5 * pMin + 0.5 * pMax; }
+	Vector3f Centroid() const { return 0.5 * pMin + 0.5 * pMax; }
 	Bounds3 Intersect(const Bounds3 &b) {
 		return Bounds3(Vector3f(fmax(pMin.x, b.pMin.x), fmax(pMin.y, b.pMin.y),
 		                        fmax(pMin.z, b.pMin.z)),
@@ -82,27 +83,23 @@ public:
 inline bool Bounds3::IntersectP(const Ray &ray, const Vector3f &invDir,
                                 const std::array<int, 3> &dirIsNeg) const {
 	// invDir: ray direction(x,y,z), invDir=(1.0/x,1.0/y,1.0/z), use this because Multiply is faster that Division
-	// dirIsNeg: ray direction(x,y,z), dirIsNeg=[int(x>0),int(y>0),int(z>0)], use this to simplify your logic
-	// test if ray bound intersects
-	double t_enter_x = (pMin.x - ray.origin.x) * invDir.x;
-	double t_exit_x  = (pMax.x - ray.origin.x) * invDir.x;
-	if(invDir.x < 0)
-		std::swap(t_enter_x, t_exit_x);
-
-	double t_enter_y = (pMin.y - ray.origin.y) * invDir.y;
-	double t_exit_y  = (pMax.y - ray.origin.y) * invDir.y;
-	if(invDir.y < 0)
-		std::swap(t_enter_y, t_exit_y);
-
-	double t_enter_z = (pMin.z - ray.origin.z) * invDir.z;
-	double t_exit_z  = (pMax.z - ray.origin.z) * invDir.z;
-	if(invDir.z < 0)
-		std::swap(t_enter_z, t_exit_z);
-
-	double t_enter = std::max({t_enter_x, t_enter_y, t_enter_z});
-	double t_exit  = std::min({t_exit_x, t_exit_y, t_exit_z});
-
-	return t_exit >= t_enter && t_exit >= 0;
+	// dirIsNeg: ray direction(x,y,z), dirIsNeg=[int(x<0),int(y<0),int(z<0)], picks the entry and exit planes
+	// without comparing or swapping. The interval is clipped to [ray.tMin, ray.tMax], so boxes behind the origin
+	// or beyond the closest hit so far are rejected.
+	const Bounds3 &b = *this;
+	float tEnterX    = (b[dirIsNeg[0]].x - ray.origin.x) * invDir.x;
+	float tExitX     = (b[1 - dirIsNeg[0]].x - ray.origin.x) * invDir.x;
+	float tEnterY    = (b[dirIsNeg[1]].y - ray.origin.y) * invDir.y;
+	float tExitY     = (b[1 - dirIsNeg[1]].y - ray.origin.y) * invDir.y;
+	float tEnterZ    = (b[dirIsNeg[2]].z - ray.origin.z) * invDir.z;
+	float tExitZ     = (b[1 - dirIsNeg[2]].z - ray.origin.z) * invDir.z;
+
+	// Widen the exit distances by 2 * gamma(3) so rounding never drops a box the ray grazes. Folding the slabs
+	// into the ray's own limits one at a time ignores a NaN from 0 * inf (origin on a slab the ray runs along).
+	constexpr float kExitScale = 1 + 2 * (3 * 0.5f * std::numeric_limits<float>::epsilon());
+	float tEnter               = std::max(std::max(std::max(ray.tMin, tEnterX), tEnterY), tEnterZ);
+	float tExit                = std::min(std::min(std::min(ray.tMax, tExitX * kExitScale), tExitY * kExitScale), tExitZ * kExitScale);
+	return tEnter <= tExit;
 }
 
 inline Bounds3 Union(const Bounds3 &b1, const Bounds3 &b2) {
@@ -119,4 +116,52 @@ inline Bounds3 Union(const Bounds3 &b, const Vector3f &p) {
 	return ret;
 }
 
+/**
+ * @brief 方向锥：与轴 w 夹角不超过 acos(cosTheta) 的所有方向，用来界定一组法向量。
+ *
+ * cosTheta = -1 表示整个球面。
+ */
+struct DirectionCone {
+	Vector3f w;
+	float cosTheta = 1;
+
+	DirectionCone() = default;
+	DirectionCone(const Vector3f &axis, float cosAngle): w(normalize(axis)), cosTheta(cosAngle) {}
+	static DirectionCone EntireSphere() { return DirectionCone(Vector3f(0, 0, 1), -1); }
+};
+
+// Smallest cone (around the bisecting axis) that holds both cones
+inline DirectionCone Union(const DirectionCone &a, const DirectionCone &b) {
+	float thetaA = std::acos(clamp(-1, 1, a.cosTheta)), thetaB = std::acos(clamp(-1, 1, b.cosTheta));
+	float thetaD = std::acos(clamp(-1, 1, dotProduct(a.w, b.w)));
+	if(std::min(thetaD + thetaB, M_PI) <= thetaA)
+		return a;
+	if(std::min(thetaD + thetaA, M_PI) <= thetaB)
+		return b;
+
+	// Spread of the union, and how far a's axis has to turn toward b's to centre it
+	float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+	if(thetaO >= M_PI)
+		return DirectionCone::EntireSphere();
+	float thetaR = thetaO - thetaA;
+	Vector3f wr  = crossProduct(a.w, b.w);
+	if(dotProduct(wr, wr) == 0)
+		return DirectionCone::EntireSphere();
+	wr = normalize(wr);
+	// Rodrigues' rotation of a.w about wr (perpendicular to a.w) by thetaR
+	Vector3f w = a.w * std::cos(thetaR) + crossProduct(wr, a.w) * std::sin(thetaR);
+	return DirectionCone(w, std::cos(thetaO));
+}
+
+// Cone of directions from p that reach the bounds (through their bounding sphere); the entire sphere from inside
+inline DirectionCone BoundSubtendedDirections(const Bounds3 &b, const Vector3f &p) {
+	Vector3f center = b.Centroid(), d = center - p;
+	float radius2   = 0.25f * dotProduct(b.Diagonal(), b.Diagonal());
+	float dist2     = dotProduct(d, d);
+	if(dist2 < radius2)
+		return DirectionCone::EntireSphere();
+	float sinThetaMax2 = radius2 / dist2;
+	return DirectionCone(d, std::sqrt(std::max(0.0f, 1 - sinThetaMax2)));
+}
+
 #endif// RAYTRACING_BOUNDS3_H
@@ -0,0 +1,69 @@
+//
+// Cameras: where the primary rays start and which way they go.
+//
+
+#include "Camera.hpp"
+#include "SIMD.hpp"
+#include "global.hpp"
+#include <algorithm>
+#include <cmath>
+
+Camera Camera::lookAt(const Vector3f &eye, const Vector3f &target, const Vector3f &up, float fov) {
+	Camera camera;
+	camera.eye    = eye;
+	camera.target = target;
+	camera.up     = up;
+	camera.fov    = fov;
+	return camera;
+}
+
+Camera Camera::orthographic(const Vector3f &eye, const Vector3f &target, const Vector3f &up, float viewHeight) {
+	Camera camera;
+	camera.projection = Projection::Orthographic;
+	camera.eye        = eye;
+	camera.target     = target;
+	camera.up         = up;
+	camera.viewHeight = viewHeight;
+	return camera;
+}
+
+bool Camera::valid() const {
+	bool lens = projection == Projection::Perspective ? fov > 0 && fov < 180 : viewHeight > 0;
+	return lens && crossProduct(target - eye, up).norm() > 0;
+}
+
+void Camera::setImage(int width, int height) {
+	imageHeight = height;
+	forward     = normalize(target - eye);
+	// Image x runs along forward x up, which for the default camera is -x: the scene's +x is on the left
+	Vector3f right  = normalize(crossProduct(forward, up));
+	Vector3f upward = crossProduct(right, forward);
+
+	float halfHeight = projection == Projection::Perspective ? std::tan(fov * 0.5f * M_PI / 180) : 0.5f * viewHeight;
+	float halfWidth  = halfHeight * width / float(height);
+	stepX            = right * (2 * halfWidth / width);
+	stepY            = upward * (-2 * halfHeight / height);
+	Vector3f center  = projection == Projection::Perspective ? forward : eye;
+	corner           = center - right * halfWidth + upward * halfHeight + 0.5f * (stepX + stepY);
+}
+
+void Camera::generateRays(int j, int i0, int n, Ray *rays) const {
+	Vector3f row = corner + stepY * float(j);
+	if(projection == Projection::Orthographic) {
+		for(int k = 0; k < n; ++k)
+			rays[k] = Ray(row + stepX * float(i0 + k), forward);
+		return;
+	}
+	Vec3x8 dirs{};
+	for(int k = 0; k < n; ++k)
+		dirs.set(k, row + stepX * float(i0 + k));
+	simdKernels().normalize(dirs.x, dirs.y, dirs.z, n);
+	for(int k = 0; k < n; ++k)
+		rays[k] = Ray(eye, dirs.get(k));
+}
+
+float Camera::pixelAngle() const {
+	if(projection == Projection::Perspective)
+		return 2 * std::tan(fov * 0.5f * M_PI / 180) / imageHeight;
+	return viewHeight / imageHeight / std::max(EPSILON, (target - eye).norm());
+}
@@ -0,0 +1,56 @@
+//
+// Cameras: where the primary rays start and which way they go.
+//
+
+#ifndef RAYTRACING_CAMERA_H
+#define RAYTRACING_CAMERA_H
+
+#include "Ray.hpp"
+#include "Vector.hpp"
+
+/**
+ * @brief 相机：从 eye 看向 target，透视投影或正交投影。
+ *
+ * 图像分辨率确定后调用 setImage，相机预先算好视平面上左上角像素中心的位置和相邻像素之间的步长，
+ * 之后生成每条主光线只需几次乘加。默认值就是 Cornell box 原来固定的视角：从 (278, 273, -800) 沿 +z 看，
+ * 垂直视场角 40 度。
+ */
+class Camera {
+public:
+	enum class Projection { Perspective,
+		                    Orthographic };
+
+	// Perspective camera at eye looking at target; up is the direction that appears upward in the image, fov the
+	// vertical field of view in degrees
+	static Camera lookAt(const Vector3f &eye, const Vector3f &target, const Vector3f &up, float fov);
+	// Orthographic camera: parallel rays along target - eye, starting on the plane through eye; viewHeight is the
+	// height of the view in scene units
+	static Camera orthographic(const Vector3f &eye, const Vector3f &target, const Vector3f &up, float viewHeight);
+
+	// Whether rays can be generated: eye apart from target, up not along the view direction, and a field of view
+	// (or view height) in range
+	bool valid() const;
+	// Set the resolution of the image the rays are generated for
+	void setImage(int width, int height);
+	// Primary rays through the centres of pixels i0 .. i0 + n - 1 (n <= RayPacket::kPacketSize) of row j, row 0
+	// being the top of the image
+	void generateRays(int j, int i0, int n, Ray *rays) const;
+	// Angle between the primary rays of neighbouring pixels; for an orthographic camera, the width of a pixel over the
+	// distance from eye to target
+	float pixelAngle() const;
+
+	Projection projection = Projection::Perspective;
+	Vector3f eye          = Vector3f(278, 273, -800);
+	Vector3f target       = Vector3f(278, 273, 0);
+	Vector3f up           = Vector3f(0, 1, 0);
+	float fov             = 40; // vertical, in degrees (perspective)
+	float viewHeight      = 600;// in scene units (orthographic)
+
+private:
+	int imageHeight = 1;
+	Vector3f forward;      // unit view direction
+	Vector3f corner;       // centre of pixel (0, 0): on the plane one unit ahead of eye, or through eye if orthographic
+	Vector3f stepX, stepY; // from one pixel centre to the next along a row and down a column
+};
+
+#endif//RAYTRACING_CAMERA_H
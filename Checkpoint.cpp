@@ -0,0 +1,122 @@
+//
+// Render checkpoints: the accumulated samples of an unfinished render, kept in a memory-mapped file.
+//
+
+#include "Checkpoint.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	constexpr char kMagic[8]     = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+	constexpr uint32_t kVersion  = 1;
+	constexpr size_t kHeaderSize = 4096;// a page of its own, so it is flushed separately from the slots
+
+	// Bytes of one slot per pixel: the sum of the samples, the luminance sums and the sample count
+	constexpr size_t kPixelBytes = sizeof(Vector3f) + 2 * sizeof(float) + sizeof(uint32_t);
+
+	size_t slotBytes(size_t pixels) {
+		// Page-aligned, so each slot is flushed on its own
+		return (pixels * kPixelBytes + kHeaderSize - 1) / kHeaderSize * kHeaderSize;
+	}
+}// namespace
+
+struct Checkpoint::Header {
+	char magic[8];
+	uint32_t version;
+	int32_t width, height;
+	uint32_t reserved;
+	uint64_t seed;
+	uint64_t saves;// completed saves; the latest is in slot (saves - 1) % 2
+};
+
+Checkpoint::~Checkpoint() {
+	if(base)
+		munmap(base, length);
+}
+
+Checkpoint::Header *Checkpoint::header() const { return reinterpret_cast<Header *>(base); }
+
+unsigned char *Checkpoint::slot(uint64_t index) const { return base + kHeaderSize + (index % 2) * slotBytes(pixels); }
+
+bool Checkpoint::map(int fd, size_t size) {
+	// The mapping keeps the file open, so fd is closed either way
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return false;
+	base   = static_cast<unsigned char *>(p);
+	length = size;
+	return true;
+}
+
+bool Checkpoint::create(const std::string &path, int width, int height, uint64_t seed) {
+	pixels      = size_t(width) * height;
+	size_t size = kHeaderSize + 2 * slotBytes(pixels);
+	int fd      = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return false;
+	if(ftruncate(fd, off_t(size)) != 0) {
+		close(fd);
+		return false;
+	}
+	if(!map(fd, size))
+		return false;
+	Header *h = header();
+	std::memcpy(h->magic, kMagic, sizeof(kMagic));
+	h->version = kVersion;
+	h->width   = width;
+	h->height  = height;
+	h->seed    = seed;
+	h->saves   = 0;
+	return msync(base, kHeaderSize, MS_SYNC) == 0;
+}
+
+bool Checkpoint::open(const std::string &path, int width, int height, uint64_t seed) {
+	pixels = size_t(width) * height;
+	int fd = ::open(path.c_str(), O_RDWR);
+	if(fd < 0)
+		return false;
+	struct stat st{};
+	size_t size = kHeaderSize + 2 * slotBytes(pixels);
+	if(fstat(fd, &st) != 0 || size_t(st.st_size) != size) {
+		close(fd);
+		return false;
+	}
+	if(!map(fd, size))
+		return false;
+	const Header *h = header();
+	return std::memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->version == kVersion && h->width == width &&
+	       h->height == height && h->seed == seed;
+}
+
+bool Checkpoint::load(std::vector<Vector3f> &accumulation, FeatureBuffers &features) const {
+	uint64_t saves = header()->saves;
+	if(saves == 0)
+		return false;
+	const unsigned char *p = slot(saves - 1);
+	std::memcpy(accumulation.data(), p, pixels * sizeof(Vector3f));
+	p += pixels * sizeof(Vector3f);
+	std::memcpy(features.lumSum.data(), p, pixels * sizeof(float));
+	p += pixels * sizeof(float);
+	std::memcpy(features.lumSqSum.data(), p, pixels * sizeof(float));
+	p += pixels * sizeof(float);
+	std::memcpy(features.samples.data(), p, pixels * sizeof(uint32_t));
+	return true;
+}
+
+bool Checkpoint::save(const std::vector<Vector3f> &accumulation, const FeatureBuffers &features) {
+	uint64_t saves   = header()->saves;
+	unsigned char *p = slot(saves);
+	std::memcpy(p, accumulation.data(), pixels * sizeof(Vector3f));
+	std::memcpy(p += pixels * sizeof(Vector3f), features.lumSum.data(), pixels * sizeof(float));
+	std::memcpy(p += pixels * sizeof(float), features.lumSqSum.data(), pixels * sizeof(float));
+	std::memcpy(p += pixels * sizeof(float), features.samples.data(), pixels * sizeof(uint32_t));
+	// The slot must be on disk before the header points at it
+	if(msync(slot(saves), slotBytes(pixels), MS_SYNC) != 0)
+		return false;
+	header()->saves = saves + 1;
+	return msync(base, kHeaderSize, MS_SYNC) == 0;
+}
@@ -0,0 +1,52 @@
+//
+// Render checkpoints: the accumulated samples of an unfinished render, kept in a memory-mapped file.
+//
+
+#ifndef RAYTRACING_CHECKPOINT_H
+#define RAYTRACING_CHECKPOINT_H
+
+#include "AOV.hpp"
+#include "Vector.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 渲染检查点：映射到内存的文件，保存未完成渲染的累积结果。
+ *
+ * 保存的是每个像素的样本颜色之和、样本数和亮度统计。每个样本的随机数由 (seed, 像素, 样本序号) 决定，
+ * 所以这些再加上 seed 就是全部采样器状态：从检查点继续渲染与不中断地渲染结果完全相同。
+ * 文件中有两个槽位，每次保存写入较旧的一个，同步到磁盘后才在文件头中切换到它，
+ * 因此保存途中被杀掉时，上一次保存的内容仍然完整。
+ */
+class Checkpoint {
+public:
+	Checkpoint() = default;
+	~Checkpoint();
+
+	Checkpoint(const Checkpoint &)            = delete;
+	Checkpoint &operator=(const Checkpoint &) = delete;
+
+	// Create (or overwrite) the checkpoint file of a width x height render with the given seed; false on failure
+	bool create(const std::string &path, int width, int height, uint64_t seed);
+	// Open an existing checkpoint to continue it; false if it cannot be read or belongs to a render of a
+	// different size or seed (whose samples would not match)
+	bool open(const std::string &path, int width, int height, uint64_t seed);
+
+	// Copy the last saved state into the render's buffers; false if nothing has been saved yet
+	bool load(std::vector<Vector3f> &accumulation, FeatureBuffers &features) const;
+	// Save the render's state and flush it to disk; false if the flush failed
+	bool save(const std::vector<Vector3f> &accumulation, const FeatureBuffers &features);
+
+private:
+	struct Header;
+	Header *header() const;
+	unsigned char *slot(uint64_t index) const;
+	bool map(int fd, size_t size);
+
+	unsigned char *base = nullptr;
+	size_t length       = 0;
+	size_t pixels       = 0;
+};
+
+#endif//RAYTRACING_CHECKPOINT_H
@@ -0,0 +1,90 @@
+//
+// Edge-avoiding a-trous wavelet denoiser guided by first-hit feature buffers.
+//
+
+#include "Denoiser.hpp"
+
+namespace {
+	// B3 spline taps of one a-trous level
+	constexpr float kKernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+}// namespace
+
+Denoiser::Denoiser(const std::vector<Vector3f> &framebuffer, const FeatureBuffers &featureBuffers, int w, int h, float angle,
+                   const DenoiseOptions &opts)
+    : features(featureBuffers), width(w), height(h), pixelAngle(angle), options(opts) {
+	size_t n = size_t(width) * height;
+	color.resize(n);
+	filtered.resize(n);
+	variance.resize(n);
+	filteredVariance.resize(n);
+	for(size_t p = 0; p < n; ++p) {
+		color[p]    = features.demodulate(p, framebuffer[p]);
+		variance[p] = features.variance(p);
+	}
+}
+
+void Denoiser::filterRows(int iteration, int startY, int endY) {
+	int step = 1 << iteration;
+	for(int y = startY; y < endY; ++y)
+		for(int x = 0; x < width; ++x) {
+			int p = y * width + x;
+			if(!features.surface[p]) {
+				filtered[p]         = color[p];
+				filteredVariance[p] = variance[p];
+				continue;
+			}
+
+			// The luminance tolerance follows the pixel's noise; its variance is blurred over 3x3 first, since a
+			// single pixel's estimate from a few samples is itself noisy
+			float var = 0, varWeight = 0;
+			for(int dy = -1; dy <= 1; ++dy)
+				for(int dx = -1; dx <= 1; ++dx) {
+					int qx = x + dx, qy = y + dy;
+					if(qx < 0 || qx >= width || qy < 0 || qy >= height)
+						continue;
+					float w = kKernel[dx * 2 + 2] * kKernel[dy * 2 + 2];
+					var += w * variance[qy * width + qx];
+					varWeight += w;
+				}
+			float sigmaL = options.sigmaLuminance * std::sqrt(var / varWeight) + 1e-4f;
+
+			float lp          = luminance(color[p]);
+			const Vector3f &n = features.normal[p];
+			float zp          = features.depth[p];
+			Vector3f sum(0.0f);
+			float weightSum = 0, varSum = 0;
+			for(int dy = -2; dy <= 2; ++dy)
+				for(int dx = -2; dx <= 2; ++dx) {
+					int qx = x + dx * step, qy = y + dy * step;
+					if(qx < 0 || qx >= width || qy < 0 || qy >= height)
+						continue;
+					int q = qy * width + qx;
+					if(!features.surface[q])
+						continue;
+					float w = kKernel[dx + 2] * kKernel[dy + 2];
+					if(q != p) {
+						// Depth may change by about the pixel footprint per pixel on a tilted surface; more is an edge
+						float offset = step * std::sqrt(float(dx * dx + dy * dy));
+						float wz     = std::fabs(features.depth[q] - zp) / (options.sigmaDepth * zp * pixelAngle * offset);
+						float wn     = std::pow(std::max(0.0f, dotProduct(n, features.normal[q])), options.sigmaNormal);
+						float wl     = std::fabs(luminance(color[q]) - lp) / sigmaL;
+						w *= wn * std::exp(-wz - wl);
+					}
+					sum += color[q] * w;
+					weightSum += w;
+					varSum += w * w * variance[q];
+				}
+			filtered[p]         = sum / weightSum;
+			filteredVariance[p] = varSum / (weightSum * weightSum);
+		}
+}
+
+void Denoiser::nextPass() {
+	std::swap(color, filtered);
+	std::swap(variance, filteredVariance);
+}
+
+void Denoiser::resolve(std::vector<Vector3f> &framebuffer) const {
+	for(size_t p = 0; p < framebuffer.size(); ++p)
+		framebuffer[p] = color[p] * features.modulation(p);
+}
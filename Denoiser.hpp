@@ -0,0 +1,53 @@
+//
+// Edge-avoiding a-trous wavelet denoiser guided by first-hit feature buffers.
+//
+
+#ifndef RAYTRACING_DENOISER_H
+#define RAYTRACING_DENOISER_H
+
+#include "AOV.hpp"
+#include "Vector.hpp"
+#include <vector>
+
+/**
+ * @brief 去噪参数。
+ */
+struct DenoiseOptions {
+	bool enabled         = false;
+	int iterations       = 5;   // a-trous passes; pass i spaces its 5x5 taps 2^i pixels apart
+	float sigmaLuminance = 8;   // luminance edge-stopping, in standard deviations of the pixel's noise
+	float sigmaNormal    = 128; // exponent on the cosine between normals
+	float sigmaDepth     = 1;   // depth edge-stopping, relative to the depth change a surface facing the eye would show
+};
+
+/**
+ * @brief 边缘保持的 à-trous 小波滤波（Dammertz et al. 2010，方差引导的亮度权重同 SVGF）。
+ *
+ * 先除掉反照率只对光照滤波，纹理和材质边缘因此不会被抹平；每一遍用 5x5 的 B3 样条核，
+ * 采样点间距逐遍翻倍，几遍之后覆盖很大的范围而每个像素的代价不变。每个抽头的权重再乘以
+ * 法向、深度和亮度三个边缘停止项，亮度的容差随该像素的噪声方差缩放，方差也随之一起滤波。
+ * 每一遍按行划分，可以多线程并行执行（filterRows），遍与遍之间调用 nextPass。
+ */
+class Denoiser {
+public:
+	// angle: between the primary rays of adjacent pixels, which sets the depth tolerance
+	Denoiser(const std::vector<Vector3f> &framebuffer, const FeatureBuffers &featureBuffers, int w, int h, float angle,
+	         const DenoiseOptions &opts);
+
+	// Filter rows [startY, endY) for pass iteration (0-based)
+	void filterRows(int iteration, int startY, int endY);
+	// Make the output of the pass just run the input of the next one
+	void nextPass();
+	// Multiply the surface colour back in and write the filtered image
+	void resolve(std::vector<Vector3f> &framebuffer) const;
+
+private:
+	const FeatureBuffers &features;
+	int width, height;
+	float pixelAngle;
+	DenoiseOptions options;
+	std::vector<Vector3f> color, filtered;// demodulated lighting, in and out of the current pass
+	std::vector<float> variance, filteredVariance;
+};
+
+#endif//RAYTRACING_DENOISER_H
@@ -0,0 +1,329 @@
+//
+// Image output: pluggable writers for 8-bit and float formats, fed scanline blocks through one large buffer, and a
+// reader for the images they write.
+//
+
+#include "ImageIO.hpp"
+#include "SIMD.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "PFM (scale -1) and OpenEXR samples are written in host byte order");
+
+namespace {
+	/**
+	 * @brief 带大缓冲区的顺序文件输出。
+	 *
+	 * 写入先拼接到缓冲区，满了（或 seek / close 时）才用一次 pwrite 写到当前文件偏移处；
+	 * 任何一次写失败都会被记住，由 close 返回。
+	 */
+	class BufferedFile {
+	public:
+		static constexpr size_t kCapacity = size_t(16) << 20;
+
+		~BufferedFile() {
+			if(fd >= 0)
+				::close(fd);
+		}
+		bool open(const std::string &path) {
+			fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			buffer.reserve(kCapacity);
+			return fd >= 0;
+		}
+		void write(const void *data, size_t n) {
+			if(buffer.size() + n > kCapacity)
+				flush();
+			const char *p = static_cast<const char *>(data);
+			if(n >= kCapacity) {
+				pwriteAll(p, n);
+				return;
+			}
+			buffer.insert(buffer.end(), p, p + n);
+		}
+		// Continue writing at byte pos of the file
+		void seek(off_t pos) {
+			flush();
+			offset = pos;
+		}
+		bool close() {
+			flush();
+			if(fd >= 0 && ::close(fd) != 0)
+				failed = true;
+			fd = -1;
+			return !failed;
+		}
+
+	private:
+		void flush() {
+			pwriteAll(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+		void pwriteAll(const char *p, size_t n) {
+			while(n > 0 && !failed) {
+				ssize_t written = ::pwrite(fd, p, n, offset);
+				if(written <= 0) {
+					failed = true;
+					break;
+				}
+				p += written;
+				n -= written;
+				offset += written;
+			}
+		}
+
+		int fd      = -1;
+		off_t offset = 0;// file position of buffer[0]
+		bool failed = false;
+		std::vector<char> buffer;
+	};
+
+	class PPMWriter: public ImageWriter {
+	public:
+		bool open(const std::string &path, int w, int h, int channels) override {
+			if(channels != 3 || !file.open(path))
+				return false;
+			width              = w;
+			std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+			file.write(header.data(), header.size());
+			return true;
+		}
+		void writeRows(const float *rows, int count) override {
+			bytes.resize(size_t(count) * width * 3);
+			tonemap(rows, bytes.data(), bytes.size());
+			file.write(bytes.data(), bytes.size());
+		}
+		bool close() override { return file.close(); }
+
+	private:
+		BufferedFile file;
+		int width = 0;
+		std::vector<uint8_t> bytes;
+	};
+
+	class PFMWriter: public ImageWriter {
+	public:
+		bool open(const std::string &path, int w, int h, int c) override {
+			if((c != 1 && c != 3) || !file.open(path))
+				return false;
+			width = w, height = h, channels = c;
+			// A negative scale marks little-endian samples
+			std::string header = std::string(c == 3 ? "PF" : "Pf") + "\n" + std::to_string(w) + " " + std::to_string(h) + "\n-1.0\n";
+			file.write(header.data(), header.size());
+			headerSize = header.size();
+			return true;
+		}
+		void writeRows(const float *rows, int count) override {
+			// PFM stores rows bottom to top, so a block of rows is one contiguous range of the file, reversed
+			size_t rowFloats = size_t(width) * channels;
+			file.seek(headerSize + off_t(height - nextRow - count) * rowFloats * sizeof(float));
+			for(int r = count - 1; r >= 0; --r)
+				file.write(rows + r * rowFloats, rowFloats * sizeof(float));
+			nextRow += count;
+		}
+		bool close() override { return file.close(); }
+
+	private:
+		BufferedFile file;
+		int width = 0, height = 0, channels = 0, nextRow = 0;
+		size_t headerSize = 0;
+	};
+
+	/**
+	 * @brief 最小的 OpenEXR 写出器：单部分扫描线文件，不压缩，32 位浮点通道。
+	 *
+	 * 不压缩时每块恰好一行、大小固定，所以偏移表可以在 open 时一次写好，之后逐行顺序追加。
+	 */
+	class EXRWriter: public ImageWriter {
+	public:
+		bool open(const std::string &path, int w, int h, int c) override {
+			if((c != 1 && c != 3) || !file.open(path))
+				return false;
+			width = w, height = h, channels = c;
+
+			std::string header;
+			auto put = [&](const void *p, size_t n) { header.append(static_cast<const char *>(p), n); };
+			auto putInt = [&](int32_t v) { put(&v, 4); };
+			auto attribute = [&](const char *name, const char *type, int32_t size) {
+				put(name, std::strlen(name) + 1);
+				put(type, std::strlen(type) + 1);
+				putInt(size);
+			};
+			const uint8_t magic[4] = {0x76, 0x2f, 0x31, 0x01};
+			put(magic, 4);
+			putInt(2);// version 2, single-part scanline file
+
+			// Channels are listed (and stored) in alphabetical order: B, G, R
+			const char *names = c == 3 ? "BGR" : "Y";
+			attribute("channels", "chlist", c * (2 + 16) + 1);
+			for(int k = 0; k < c; ++k) {
+				const char name[2] = {names[k], 0};
+				put(name, 2);
+				putInt(2);// FLOAT
+				putInt(0);// pLinear and reserved bytes
+				putInt(1);// x sampling
+				putInt(1);// y sampling
+			}
+			put("", 1);
+			attribute("compression", "compression", 1);
+			put("", 1);// NO_COMPRESSION
+			const int32_t window[4] = {0, 0, w - 1, h - 1};
+			attribute("dataWindow", "box2i", 16);
+			put(window, 16);
+			attribute("displayWindow", "box2i", 16);
+			put(window, 16);
+			attribute("lineOrder", "lineOrder", 1);
+			put("", 1);// INCREASING_Y
+			const float one = 1, center[2] = {0, 0};
+			attribute("pixelAspectRatio", "float", 4);
+			put(&one, 4);
+			attribute("screenWindowCenter", "v2f", 8);
+			put(center, 8);
+			attribute("screenWindowWidth", "float", 4);
+			put(&one, 4);
+			put("", 1);
+
+			// One chunk per scanline: y, data size, then each channel's row
+			uint64_t chunkSize = 8 + uint64_t(w) * c * sizeof(float);
+			uint64_t first     = header.size() + uint64_t(h) * sizeof(uint64_t);
+			for(int y = 0; y < h; ++y) {
+				uint64_t offset = first + y * chunkSize;
+				put(&offset, 8);
+			}
+			file.write(header.data(), header.size());
+			return true;
+		}
+		void writeRows(const float *rows, int count) override {
+			planar.resize(size_t(width) * channels);
+			for(int r = 0; r < count; ++r, ++nextRow) {
+				const float *row = rows + size_t(r) * width * channels;
+				for(int k = 0; k < channels; ++k) {
+					int source = channels - 1 - k;// B, G, R from interleaved R, G, B
+					for(int x = 0; x < width; ++x)
+						planar[size_t(k) * width + x] = row[x * channels + source];
+				}
+				int32_t chunk[2] = {nextRow, int32_t(planar.size() * sizeof(float))};
+				file.write(chunk, sizeof(chunk));
+				file.write(planar.data(), planar.size() * sizeof(float));
+			}
+		}
+		bool close() override { return file.close(); }
+
+	private:
+		BufferedFile file;
+		int width = 0, height = 0, channels = 0, nextRow = 0;
+		std::vector<float> planar;
+	};
+
+	bool endsWith(const std::string &s, const char *suffix) {
+		size_t n = std::strlen(suffix);
+		return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+	}
+}// namespace
+
+void tonemap(const float *in, uint8_t *out, size_t n) {
+	static const std::vector<uint8_t> table = [] {
+		std::vector<uint8_t> t(65536);
+		for(size_t i = 0; i < t.size(); ++i)
+			t[i] = uint8_t(255 * std::pow(i / 65535.0f, 0.6f));
+		return t;
+	}();
+	constexpr size_t kChunk = 4096;
+	uint16_t index[kChunk];
+	for(size_t i = 0; i < n; i += kChunk) {
+		int m = int(std::min(kChunk, n - i));
+		simdKernels().quantize(in + i, index, m);
+		for(int k = 0; k < m; ++k)
+			out[i + k] = table[index[k]];
+	}
+}
+
+std::unique_ptr<ImageWriter> makeImageWriter(const std::string &path) {
+	if(endsWith(path, ".ppm"))
+		return std::make_unique<PPMWriter>();
+	if(endsWith(path, ".pfm"))
+		return std::make_unique<PFMWriter>();
+	if(endsWith(path, ".exr"))
+		return std::make_unique<EXRWriter>();
+	return nullptr;
+}
+
+bool writeImage(const std::string &path, int width, int height, int channels, const float *data) {
+	std::unique_ptr<ImageWriter> writer = makeImageWriter(path);
+	if(!writer || !writer->open(path, width, height, channels))
+		return false;
+	writer->writeRows(data, height);
+	return writer->close();
+}
+
+bool readImage(const std::string &path, int &width, int &height, std::vector<float> &data) {
+	std::ifstream file(path, std::ios::binary);
+	// Header fields are separated by whitespace; PPM headers may have # comments between them
+	auto field = [&](std::string &token) {
+		while(file >> token) {
+			if(token[0] != '#')
+				return true;
+			std::getline(file, token);
+		}
+		return false;
+	};
+	std::string magic, w, h, scale;
+	if(!field(magic) || (magic != "PF" && magic != "P6") || !field(w) || !field(h) || !field(scale))
+		return false;
+	file.get();// the single whitespace character that ends the header
+	width  = std::atoi(w.c_str());
+	height = std::atoi(h.c_str());
+	if(width <= 0 || height <= 0)
+		return false;
+	size_t n = size_t(width) * height * 3;
+	data.resize(n);
+
+	if(magic == "P6") {
+		if(scale != "255")
+			return false;
+		// Each byte decodes to the middle of the range of 16-bit levels tonemap turns into it
+		static const std::vector<float> decode = [] {
+			std::vector<float> level(65536);
+			std::vector<uint8_t> encoded(level.size());
+			for(size_t i = 0; i < level.size(); ++i)
+				level[i] = i / 65535.0f;
+			tonemap(level.data(), encoded.data(), level.size());
+			std::vector<float> t(256, -1), last(256);
+			for(size_t i = 0; i < level.size(); ++i) {
+				if(t[encoded[i]] < 0)
+					t[encoded[i]] = level[i];
+				last[encoded[i]] = level[i];
+			}
+			// Bytes tonemap never produces fall back to the inverse of its curve
+			for(int v = 0; v < 256; ++v)
+				t[v] = t[v] < 0 ? std::pow(v / 255.0f, 1 / 0.6f) : 0.5f * (t[v] + last[v]);
+			return t;
+		}();
+		std::vector<uint8_t> bytes(n);
+		if(!file.read(reinterpret_cast<char *>(bytes.data()), n))
+			return false;
+		std::transform(bytes.begin(), bytes.end(), data.begin(), [](uint8_t b) { return decode[b]; });
+		return true;
+	}
+
+	// PFM: rows bottom to top, little-endian if the scale is negative
+	float sign = std::atof(scale.c_str());
+	if(sign == 0)
+		return false;
+	size_t rowFloats = size_t(width) * 3;
+	for(int y = height - 1; y >= 0; --y)
+		if(!file.read(reinterpret_cast<char *>(data.data() + y * rowFloats), rowFloats * sizeof(float)))
+			return false;
+	if(sign > 0)
+		for(float &value: data) {
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			bits = __builtin_bswap32(bits);
+			std::memcpy(&value, &bits, sizeof(bits));
+		}
+	return true;
+}
@@ -0,0 +1,49 @@
+//
+// Image output: pluggable writers for 8-bit and float formats, fed scanline blocks through one large buffer, and a
+// reader for the images they write.
+//
+
+#ifndef RAYTRACING_IMAGEIO_H
+#define RAYTRACING_IMAGEIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Display encoding of the 8-bit output: clamp to [0, 1], raise to 0.6, quantize. The values are first converted
+// to 16-bit fixed point with the SIMD quantize kernel, then looked up in a 64 KiB table instead of calling pow.
+void tonemap(const float *in, uint8_t *out, size_t n);
+
+/**
+ * @brief 图像写出器：按从上到下的顺序分块接收扫描线，编码为某种文件格式。
+ *
+ * 调用顺序为 open、若干次 writeRows（合计正好 height 行）、close。写出器不需要整幅图像常驻内存，
+ * 超大图像可以边生成边写出。输出先在一个大缓冲区中拼接，每次缓冲区满（或块结束）才调用一次 write，
+ * 而不是每个像素一次。
+ */
+class ImageWriter {
+public:
+	virtual ~ImageWriter() = default;
+	// Start an image of width x height pixels with channels (1 or 3) floats each; false on failure
+	virtual bool open(const std::string &path, int width, int height, int channels) = 0;
+	// Append the next count rows: count * width * channels floats, rows top to bottom, channels interleaved
+	virtual void writeRows(const float *rows, int count) = 0;
+	// Flush and close the file; false if anything failed to be written since open
+	virtual bool close() = 0;
+};
+
+// Writer for the format named by the path's extension: .ppm (tonemapped 8-bit), .pfm (Portable Float Map) or
+// .exr (uncompressed 32-bit float OpenEXR scanlines); nullptr for any other extension
+std::unique_ptr<ImageWriter> makeImageWriter(const std::string &path);
+
+// Write a whole image in the format its path names; false if the format is unknown or the write failed
+bool writeImage(const std::string &path, int width, int height, int channels, const float *data);
+
+// Read a 3-channel image back into width * height * 3 floats, rows top to bottom: .pfm as stored, .ppm decoded
+// through the inverse of tonemap to the middle of each 8-bit step, so that writing it again gives the same bytes.
+// False for other formats (including .exr) and malformed files.
+bool readImage(const std::string &path, int &width, int &height, std::vector<float> &data);
+
+#endif//RAYTRACING_IMAGEIO_H
@@ -0,0 +1,114 @@
+//
+// Instanced geometry: a shared bottom-level object placed with an affine transform.
+//
+
+#ifndef RAYTRACING_INSTANCE_H
+#define RAYTRACING_INSTANCE_H
+
+#include "Material.hpp"
+#include "Object.hpp"
+#include "Transform.hpp"
+
+/**
+ * @brief 场景顶层（TLAS）中的一个实例。
+ *
+ * prototype 是只构建一次的底层对象（通常是带有自己 BVHAccel 的 MeshTriangle，即 BLAS），
+ * 实例本身只保存变换和可选的材质覆盖，因此实例数量增加时内存基本不变。
+ * 求交时把光线变换到物体空间；方向不做归一化，所以返回的 distance 仍然是世界空间光线的参数 t。
+ */
+class Instance: public Object {
+public:
+	Instance(Object *blas, const Transform &objectToWorld, Material *overrideMaterial = nullptr)
+	    : prototype(blas), materialOverride(overrideMaterial) {
+		setTransform(objectToWorld);
+	}
+
+	void setTransform(const Transform &objectToWorld) {
+		toWorld = objectToWorld;
+		toLocal = objectToWorld.inverse();
+		// Area scale is exact for similarity transforms and an estimate otherwise;
+		// it only affects how often this instance is picked as a light
+		areaScale = std::pow(std::fabs(toWorld.det()), 2.0f / 3.0f);
+		bounds    = toWorld.bounds(prototype->getBounds());
+	}
+
+	bool intersect(const Ray &ray) { return prototype->intersect(toLocalRay(ray)); }
+	bool intersect(const Ray &ray, float &tnear, uint32_t &index) const {
+		return prototype->intersect(toLocalRay(ray), tnear, index);
+	}
+
+	Intersection getIntersection(Ray ray) {
+		Intersection isect = prototype->getIntersection(toLocalRay(ray));
+		if(isect.happened) {
+			isect.pError = toWorld.pointError(isect.coords, isect.pError);
+			isect.coords = toWorld.point(isect.coords);
+			isect.normal = normalize(toWorld.normal(isect.normal));
+			isect.obj    = this;
+			if(materialOverride)
+				isect.m = materialOverride;
+		}
+		return isect;
+	}
+
+	void getSurfaceProperties(const Vector3f &P, const Vector3f &I, const uint32_t &index, const Vector2f &uv, Vector3f &N, Vector2f &st) const {
+		prototype->getSurfaceProperties(toLocal.point(P), toLocal.vector(I), index, uv, N, st);
+		N = normalize(toWorld.normal(N));
+	}
+	Vector3f evalDiffuseColor(const Vector2f &st) const { return prototype->evalDiffuseColor(st); }
+
+	Bounds3 getBounds() { return bounds; }
+	float getArea() { return prototype->getArea() * areaScale; }
+	float getEmitArea() {
+		if(materialOverride)
+			return materialOverride->hasEmission() ? getArea() : 0;
+		return prototype->getEmitArea() * areaScale;
+	}
+	bool hasEmit() { return materialOverride ? materialOverride->hasEmission() : prototype->hasEmit(); }
+	void getMaterials(std::vector<Material *> &materials) {
+		if(materialOverride)
+			materials.push_back(materialOverride);
+		else
+			prototype->getMaterials(materials);
+	}
+
+	void Sample(Intersection &pos, float &pdf) {
+		prototype->Sample(pos, pdf);
+		toWorldSample(pos, pdf);
+	}
+	void Sample(const Vector3f &ref, Intersection &pos, float &pdf) {
+		prototype->Sample(toLocal.point(ref), pos, pdf);
+		toWorldSample(pos, pdf);
+	}
+
+	Object *prototype;
+	Material *materialOverride;
+	Transform toWorld, toLocal;
+
+private:
+	// Move a sample of the prototype into world space
+	void toWorldSample(Intersection &pos, float &pdf) const {
+		// Change of area measure under the affine map: dA_world = |det| * |M^-T n| dA_local
+		Vector3f n     = toWorld.normal(pos.normal);
+		float jacobian = std::fabs(toWorld.det()) * n.norm();
+		pos.pError     = toWorld.pointError(pos.coords, pos.pError);
+		pos.coords     = toWorld.point(pos.coords);
+		pos.normal     = normalize(n);
+		if(jacobian > 0)
+			pdf /= jacobian;
+		if(materialOverride)
+			pos.emit = materialOverride->getEmission();
+	}
+
+	Ray toLocalRay(const Ray &ray) const {
+		Ray local(toLocal.point(ray.origin), toLocal.vector(ray.direction), ray.t);
+		// The map is affine and the direction is not renormalized, so distances along both rays agree
+		local.tMin = ray.tMin;
+		local.tMax = ray.tMax;
+		return local;
+	}
+
+	Bounds3 bounds;
+	float areaScale = 1;
+};
+
+#endif//RAYTRACING_INSTANCE_H
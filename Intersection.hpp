@@ -5,7 +5,10 @@
 #ifndef RAYTRACING_INTERSECTION_H
 #define RAYTRACING_INTERSECTION_H
 #include "Material.hpp"
+#include "Ray.hpp"
 #include "Vector.hpp"
+#include <cmath>
+#include <limits>
 class Object;
 class Sphere;
 
@@ -32,10 +35,41 @@ struct Intersection {
 	bool happened;   ///< 表示是否发生了交点
 	Vector3f coords; ///< 交点的坐标
 	Vector3f tcoords;///< 交点的纹理坐标
-	Vector3f normal; ///< 交点处的法向量
+	Vector3f normal; ///< 交点处的（几何）法向量
+	Vector3f pError; ///< coords 每个分量的绝对误差上界
 	Vector3f emit;   ///< 交点处的自发光颜色（发射光）
 	double distance; ///< 光线从发射点到交点的距离
-	Object *obj;     ///< 与交点相交的物体
+	Object *obj;     ///< 与交点相交的物体（网格的交点指向网格本身而不是其中的三角形）
 	Material *m;     ///< 交点处物体的材质
+
+	// Shadow rays stop this fraction short of their target, so they never hit the target surface itself
+	static constexpr float kShadowEpsilon = 1e-4f;
+
+	// Origin for a ray leaving the surface toward w: coords pushed along the geometric normal just past the error
+	// box pError, then rounded away from the surface, so the ray cannot hit the surface it starts on
+	Vector3f spawnOrigin(const Vector3f &w) const {
+		float d         = dotProduct(Vector3f::Abs(normal), pError);
+		Vector3f offset = normal * (dotProduct(w, normal) < 0 ? -d : d);
+		Vector3f po     = coords + offset;
+		for(int i = 0; i < 3; ++i) {
+			if(offset[i] > 0)
+				po[i] = std::nextafter(po[i], std::numeric_limits<float>::infinity());
+			else if(offset[i] < 0)
+				po[i] = std::nextafter(po[i], -std::numeric_limits<float>::infinity());
+		}
+		return po;
+	}
+	Ray spawnRay(const Vector3f &w) const { return Ray(spawnOrigin(w), w); }
+	// Ray from this point to target that ends just before it: the target is visible iff nothing is hit in
+	// [tMin, tMax). Both ends are offset off their surfaces.
+	Ray spawnRayTo(const Intersection &target) const {
+		Vector3f from = spawnOrigin(target.coords - coords);
+		Vector3f to   = target.spawnOrigin(coords - target.coords);
+		Vector3f d    = to - from;
+		float dist    = d.norm();
+		Ray ray(from, d / dist);
+		ray.tMax = dist * (1 - kShadowEpsilon);
+		return ray;
+	}
 };
 #endif//RAYTRACING_INTERSECTION_H
@@ -0,0 +1,207 @@
+//
+// Light BVH construction (surface area orientation heuristic) and stochastic traversal.
+//
+
+#include "LightBVH.hpp"
+#include <algorithm>
+
+namespace {
+	float safeSqrt(float x) { return std::sqrt(std::max(0.0f, x)); }
+
+	// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+	float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		return cosA > cosB ? 1 : cosA * cosB + sinA * sinB;
+	}
+	float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		return cosA > cosB ? 0 : sinA * cosB - cosA * sinB;
+	}
+
+	// Solid-angle measure of the directions a group emits into: normals within thetaO of the axis, each emitting
+	// up to thetaE beyond its normal
+	float orientationMeasure(const LightBounds &b) {
+		float thetaO    = std::acos(clamp(-1, 1, b.cosThetaO));
+		float thetaE    = std::acos(clamp(-1, 1, b.cosThetaE));
+		float thetaW    = std::min(thetaO + thetaE, M_PI);
+		float sinThetaO = safeSqrt(1 - b.cosThetaO * b.cosThetaO);
+		return 2 * M_PI * (1 - b.cosThetaO) +
+		       M_PI / 2 * (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + b.cosThetaO);
+	}
+
+	// Surface area orientation heuristic cost of a child; Kr penalizes thin slices across the parent's long axis
+	float saohCost(const LightBounds &b, const Bounds3 &parent, int dim) {
+		Vector3f d      = parent.Diagonal();
+		float maxExtent = std::max(d.x, std::max(d.y, d.z));
+		float kr        = d[dim] > 0 ? maxExtent / d[dim] : 1;
+		return b.phi * orientationMeasure(b) * b.bounds.SurfaceArea() * kr;
+	}
+}// namespace
+
+float LightBounds::importance(const Vector3f &p, const Vector3f &n) const {
+	// Squared distance to the centre, clamped to the bounds' radius so points inside or beside them stay finite
+	Vector3f pc     = bounds.Centroid();
+	Vector3f diag   = bounds.Diagonal();
+	float d2        = std::max(dotProduct(p - pc, p - pc), 0.25f * dotProduct(diag, diag));
+	Vector3f wi     = normalize(p - pc);
+	float cosThetaW = dotProduct(w, wi);
+	float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+
+	// Half-angle of the bounds seen from p
+	float cosThetaB = BoundSubtendedDirections(bounds, p).cosTheta;
+	float sinThetaB = safeSqrt(1 - cosThetaB * cosThetaB);
+
+	// Smallest angle between an emitter's normal and the direction to p: thetaW - thetaO - thetaB, clamped at 0
+	float sinThetaO = safeSqrt(1 - cosThetaO * cosThetaO);
+	float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+	float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if(cosThetaP <= cosThetaE)
+		return 0;
+	float importance = phi * cosThetaP / d2;
+
+	// Smallest angle between the receiver's normal and a direction into the bounds; nothing above its horizon
+	// means no light from the group can arrive
+	float cosThetaI  = dotProduct(-wi, n);
+	float sinThetaI  = safeSqrt(1 - cosThetaI * cosThetaI);
+	float cosThetaIP = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	return std::max(0.0f, importance * cosThetaIP);
+}
+
+LightBounds Union(const LightBounds &a, const LightBounds &b) {
+	if(a.phi == 0)
+		return b;
+	if(b.phi == 0)
+		return a;
+	DirectionCone cone = Union(DirectionCone(a.w, a.cosThetaO), DirectionCone(b.w, b.cosThetaO));
+	LightBounds ret;
+	ret.bounds    = Union(a.bounds, b.bounds);
+	ret.w         = cone.w;
+	ret.phi       = a.phi + b.phi;
+	ret.cosThetaO = cone.cosTheta;
+	ret.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+	return ret;
+}
+
+LightBVH::LightBVH(std::vector<Object *> emitters) {
+	std::vector<BuildLight> build;
+	build.reserve(emitters.size());
+	for(Object *light: emitters) {
+		// Emission is uniform over each emitter (a material property), so any sampled point gives it
+		Intersection pos;
+		float pdf;
+		light->Sample(pos, pdf);
+		DirectionCone normals = light->getNormalBounds();
+		LightBounds b;
+		b.bounds    = light->getBounds();
+		b.w         = normals.w;
+		b.phi       = M_PI * (pos.emit.x + pos.emit.y + pos.emit.z) / 3 * light->getEmitArea();
+		b.cosThetaO = normals.cosTheta;
+		b.cosThetaE = 0;// diffuse emitters: the whole hemisphere around each normal
+		if(b.phi > 0)
+			build.push_back({light, b});
+	}
+	if(build.empty())
+		return;
+	nodes.reserve(2 * build.size() - 1);
+	lights.reserve(build.size());
+	this->build(build, 0, build.size());
+}
+
+LightBounds LightBVH::build(std::vector<BuildLight> &build, size_t start, size_t end) {
+	int nodeIndex = nodes.size();
+	nodes.push_back({});
+	if(end - start == 1) {
+		nodes[nodeIndex] = {build[start].bounds, (int32_t) lights.size(), true};
+		lights.push_back(build[start].light);
+		return build[start].bounds;
+	}
+
+	Bounds3 bounds, centroidBounds;
+	for(size_t i = start; i < end; ++i) {
+		bounds         = Union(bounds, build[i].bounds.bounds);
+		centroidBounds = Union(centroidBounds, build[i].bounds.bounds.Centroid());
+	}
+
+	// Bucket the centroids along each axis and take the cheapest boundary between buckets
+	constexpr int kBuckets = 12;
+	float minCost = std::numeric_limits<float>::infinity();
+	int minDim = -1, minBucket = -1;
+	auto bucketOf = [&](const BuildLight &l, int dim) {
+		float lo = centroidBounds.pMin[dim], hi = centroidBounds.pMax[dim];
+		int b    = int(kBuckets * (l.bounds.bounds.Centroid()[dim] - lo) / (hi - lo));
+		return std::min(std::max(b, 0), kBuckets - 1);
+	};
+	for(int dim = 0; dim < 3; ++dim) {
+		if(centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+			continue;
+		LightBounds buckets[kBuckets];
+		for(size_t i = start; i < end; ++i) {
+			int b      = bucketOf(build[i], dim);
+			buckets[b] = Union(buckets[b], build[i].bounds);
+		}
+		for(int split = 0; split < kBuckets - 1; ++split) {
+			LightBounds below, above;
+			for(int b = 0; b <= split; ++b)
+				below = Union(below, buckets[b]);
+			for(int b = split + 1; b < kBuckets; ++b)
+				above = Union(above, buckets[b]);
+			if(below.phi == 0 || above.phi == 0)
+				continue;
+			float cost = saohCost(below, bounds, dim) + saohCost(above, bounds, dim);
+			if(cost < minCost) {
+				minCost   = cost;
+				minDim    = dim;
+				minBucket = split;
+			}
+		}
+	}
+
+	size_t mid = (start + end) / 2;
+	if(minDim >= 0) {
+		auto first = build.begin() + start, last = build.begin() + end;
+		mid        = std::partition(first, last, [&](const BuildLight &l) { return bucketOf(l, minDim) <= minBucket; }) - build.begin();
+		if(mid == start || mid == end)
+			mid = (start + end) / 2;
+	}
+
+	LightBounds left  = this->build(build, start, mid);
+	int secondChild   = nodes.size();
+	LightBounds right = this->build(build, mid, end);
+	LightBounds ret   = Union(left, right);
+	nodes[nodeIndex]  = {ret, secondChild, false};
+	return ret;
+}
+
+bool LightBVH::sample(const Vector3f &p, const Vector3f &n, float u, Object *&light, float &pmf) const {
+	if(nodes.empty())
+		return false;
+	constexpr float kOneMinusEpsilon = 1 - std::numeric_limits<float>::epsilon() / 2;
+	int nodeIndex = 0;
+	pmf           = 1;
+	while(true) {
+		const LightBVHNode &node = nodes[nodeIndex];
+		if(node.isLeaf) {
+			// Below the root, the parent already found the leaf worth visiting
+			if(nodeIndex > 0 || node.bounds.importance(p, n) > 0) {
+				light = lights[node.childOrLight];
+				return true;
+			}
+			return false;
+		}
+
+		// Descend into one child with probability proportional to its importance, reusing u rescaled to [0, 1)
+		float c0 = nodes[nodeIndex + 1].bounds.importance(p, n);
+		float c1 = nodes[node.childOrLight].bounds.importance(p, n);
+		if(c0 == 0 && c1 == 0)
+			return false;
+		float p0 = c0 / (c0 + c1);
+		if(u < p0) {
+			nodeIndex = nodeIndex + 1;
+			u         = std::min(u / p0, kOneMinusEpsilon);
+			pmf *= p0;
+		} else {
+			nodeIndex = node.childOrLight;
+			u         = std::min((u - p0) / (1 - p0), kOneMinusEpsilon);
+			pmf *= 1 - p0;
+		}
+	}
+}
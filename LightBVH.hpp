@@ -0,0 +1,72 @@
+//
+// Light BVH: a hierarchy over the emitters for picking one in proportion to its estimated contribution.
+//
+
+#ifndef RAYTRACING_LIGHTBVH_H
+#define RAYTRACING_LIGHTBVH_H
+
+#include "Bounds3.hpp"
+#include "Object.hpp"
+#include "Vector.hpp"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief 一组光源的保守包络：空间包围盒、总功率和法向锥。
+ *
+ * 组内每个发光点的法向与 w 的夹角不超过 thetaO，光从法向向外最多偏 thetaE 发出
+ * （漫反射面光源 thetaE = pi/2）。importance 据此给出该组对着色点贡献的上界估计。
+ */
+struct LightBounds {
+	Bounds3 bounds;
+	Vector3f w;         // axis of the normal cone
+	float phi       = 0;// emitted power (0: empty)
+	float cosThetaO = 1;// spread of the normals around w
+	float cosThetaE = 0;// emission beyond the normals
+	// Estimated contribution to a point p with surface normal n: power over squared distance, scaled by the most
+	// favourable emitter and receiver angles the bounds allow; 0 only if no light from the group can reach p
+	float importance(const Vector3f &p, const Vector3f &n) const;
+};
+
+LightBounds Union(const LightBounds &a, const LightBounds &b);
+
+/**
+ * @brief 光源 BVH 的节点（深度优先存放：第一个子节点紧跟在父节点之后）。
+ */
+struct LightBVHNode {
+	LightBounds bounds;
+	int32_t childOrLight;// interior: index of the second child; leaf: index into LightBVH::lights
+	bool isLeaf;
+};
+
+/**
+ * @brief 覆盖所有发光体的 BVH，按着色点随机遍历来选择光源。
+ *
+ * 每个内部节点处按两个子节点的 importance 之比随机走向其中一个，同一个随机数逐层重新缩放后继续使用；
+ * 走到的叶子即选中的光源，概率为沿途各次选择概率之积。远处、背对着色点或在其地平线以下的光源
+ * 很少被选中，所以噪声几乎不随光源数量增长。
+ */
+class LightBVH {
+public:
+	explicit LightBVH(std::vector<Object *> emitters);
+
+	// Pick an emitter for shading point p with normal n, using the uniform number u; pmf is the probability it
+	// was picked. False if no emitter can light p.
+	bool sample(const Vector3f &p, const Vector3f &n, float u, Object *&light, float &pmf) const;
+
+	size_t lightCount() const { return lights.size(); }
+	size_t nodeCount() const { return nodes.size(); }
+
+private:
+	struct BuildLight {
+		Object *light;
+		LightBounds bounds;
+	};
+	// Split with the surface area orientation heuristic, append the subtree in depth-first order; returns its bounds
+	LightBounds build(std::vector<BuildLight> &build, size_t start, size_t end);
+
+	std::vector<Object *> lights;
+	std::vector<LightBVHNode> nodes;
+};
+
+#endif//RAYTRACING_LIGHTBVH_H
@@ -102,6 +102,8 @@ public:
 	inline Vector3f getColorAt(double u, double v);
 	inline Vector3f getEmission();
 	inline bool hasEmission();
+	// Directional-hemispherical reflectance, the surface colour lighting is multiplied with
+	inline Vector3f getAlbedo();
 
 	// sample a ray by Material properties
 	inline Vector3f sample(const Vector3f &wi, const Vector3f &N);
@@ -127,6 +129,13 @@ bool Material::hasEmission() {
 		return false;
 }
 
+Vector3f Material::getAlbedo() {
+	switch(m_type) {
+		case DIFFUSE: return Kd;
+	}
+	return Vector3f(0.0f);
+}
+
 Vector3f Material::getColorAt(double u, double v) {
 	return Vector3f();
 }
@@ -193,4 +202,10 @@ Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &
 	}
 }
 
+// Shared material for objects created without one
+inline Material *defaultMaterial() {
+	static Material material;
+	return &material;
+}
+
 #endif//RAYTRACING_MATERIAL_H
@@ -0,0 +1,207 @@
+//
+// Binary mesh/BVH cache with mmap loading.
+//
+
+#include "MeshCache.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+	const char kMagic[8] = {'R', 'T', 'M', 'C', 'A', 'C', 'H', 'E'};
+
+	constexpr uint64_t kFnvOffset = 1469598103934665603ull;
+	constexpr uint64_t kFnvPrime  = 1099511628211ull;
+
+	uint64_t fnv1a(const unsigned char *data, size_t size, uint64_t h) {
+		for(size_t i = 0; i < size; ++i) {
+			h ^= data[i];
+			h *= kFnvPrime;
+		}
+		return h;
+	}
+
+	uint64_t align64(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+	// Every index in the cache points inside the array it indexes, and the BVH is a tree whose nodes come after their
+	// parents, so a corrupt file that still has the right hash and sizes is rejected instead of being read out of bounds
+	bool validIndices(const MeshCacheView &view, const MeshCacheHeader &header) {
+		for(uint64_t i = 0; i < uint64_t(header.numTriangles) * 3; ++i)
+			if(view.indices[i] >= header.numVertices)
+				return false;
+		for(uint32_t i = 0; i < header.numPrimRefs; ++i)
+			if(view.primOrder[i] >= header.numTriangles)
+				return false;
+		if(header.numMaterials > 0)
+			for(uint32_t i = 0; i < header.numTriangles; ++i)
+				if(view.materialIds[i] >= header.numMaterials)
+					return false;
+		for(uint32_t i = 0; i < header.numNodes; ++i) {
+			const LinearBVHNode &node = view.nodes[i];
+			bool valid = node.nPrimitives > 0
+			                 ? node.primitivesOffset >= 0 && uint64_t(node.primitivesOffset) + node.nPrimitives <= header.numPrimRefs
+			                 : node.childOffset > int64_t(i) && uint64_t(node.childOffset) + 1 < header.numNodes && node.axis < 3;
+			if(!valid)
+				return false;
+		}
+		return true;
+	}
+}// namespace
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return nullptr;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return nullptr;
+	return std::shared_ptr<MappedFile>(new MappedFile(static_cast<unsigned char *>(p), st.st_size));
+}
+
+MappedFile::~MappedFile() {
+	munmap(base, length);
+}
+
+std::string MeshCache::cachePath(const std::string &sourcePath) {
+	return sourcePath + ".rtcache";
+}
+
+uint64_t MeshCache::sourceHash(const std::string &sourcePath, int maxPrimsInNode, BVHAccel::SplitMethod splitMethod,
+                               bool withMaterials) {
+	auto source = MappedFile::open(sourcePath);
+	if(!source)
+		return 0;
+	uint64_t h = fnv1a(source->data(), source->size(), kFnvOffset);
+
+	// Materials are baked into the cache, so an OBJ's MTL libraries are part of its key
+	const char *text = reinterpret_cast<const char *>(source->data());
+	size_t size      = source->size();
+	std::string dir  = sourcePath.substr(0, sourcePath.find_last_of('/') + 1);
+	for(size_t pos = 0; pos < size;) {
+		size_t eol = pos;
+		while(eol < size && text[eol] != '\n')
+			++eol;
+		if(eol - pos > 7 && memcmp(text + pos, "mtllib ", 7) == 0) {
+			std::string lib(text + pos + 7, eol - pos - 7);
+			while(!lib.empty() && isspace((unsigned char) lib.back()))
+				lib.pop_back();
+			if(auto mtl = MappedFile::open(dir + lib))
+				h = fnv1a(mtl->data(), mtl->size(), h);
+		}
+		pos = eol + 1;
+	}
+
+	uint32_t opts[5] = {kVersion, (uint32_t) maxPrimsInNode, (uint32_t) splitMethod, (uint32_t) sizeof(LinearBVHNode),
+	                    (uint32_t) withMaterials};
+	return fnv1a(reinterpret_cast<const unsigned char *>(opts), sizeof(opts), h);
+}
+
+bool MeshCache::load(const std::string &sourcePath, uint64_t hash, MeshCacheView &view) {
+	if(!enabled || hash == 0)
+		return false;
+	auto file = MappedFile::open(cachePath(sourcePath));
+	if(!file || file->size() < sizeof(MeshCacheHeader))
+		return false;
+
+	const auto *header = reinterpret_cast<const MeshCacheHeader *>(file->data());
+	if(memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion ||
+	   header->headerSize != sizeof(MeshCacheHeader) || header->sourceHash != hash ||
+	   header->fileSize != file->size())
+		return false;
+	// Every array lies inside the file, aligned for its element type
+	auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+		return offset % 4 == 0 && offset <= file->size() && count <= (file->size() - offset) / elementSize;
+	};
+	if(!fits(header->verticesOffset, uint64_t(header->numVertices) * 3, sizeof(float)) ||
+	   !fits(header->indicesOffset, uint64_t(header->numTriangles) * 3, sizeof(uint32_t)) ||
+	   !fits(header->primOrderOffset, header->numPrimRefs, sizeof(uint32_t)) ||
+	   !fits(header->nodesOffset, header->numNodes, sizeof(LinearBVHNode)) ||
+	   !fits(header->materialIdsOffset, header->numMaterials ? header->numTriangles : 0, sizeof(uint32_t)) ||
+	   !fits(header->materialsOffset, header->numMaterials, sizeof(MeshCacheMaterial)))
+		return false;
+
+	unsigned char *base = file->data();
+	view.vertices       = reinterpret_cast<const float *>(base + header->verticesOffset);
+	view.indices        = reinterpret_cast<const uint32_t *>(base + header->indicesOffset);
+	view.primOrder      = reinterpret_cast<const uint32_t *>(base + header->primOrderOffset);
+	view.nodes          = reinterpret_cast<LinearBVHNode *>(base + header->nodesOffset);
+	if(header->numMaterials > 0) {
+		view.materialIds = reinterpret_cast<const uint32_t *>(base + header->materialIdsOffset);
+		view.materials   = reinterpret_cast<const MeshCacheMaterial *>(base + header->materialsOffset);
+	}
+	if(!validIndices(view, *header)) {
+		view = MeshCacheView();
+		return false;
+	}
+	view.numVertices  = header->numVertices;
+	view.numTriangles = header->numTriangles;
+	view.numNodes     = header->numNodes;
+	view.numMaterials = header->numMaterials;
+	view.numPrimRefs  = header->numPrimRefs;
+	view.file         = std::move(file);
+	return true;
+}
+
+bool MeshCache::store(const std::string &sourcePath, uint64_t hash, const MeshCacheView &data) {
+	if(!enabled || hash == 0)
+		return false;
+
+	uint64_t numTriangles = data.numTriangles;
+	uint64_t numMaterials = data.materialIds ? data.numMaterials : 0;
+	uint64_t numPrimRefs  = data.numPrimRefs;
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version           = kVersion;
+	header.headerSize        = sizeof(MeshCacheHeader);
+	header.sourceHash        = hash;
+	header.numVertices       = data.numVertices;
+	header.numTriangles      = data.numTriangles;
+	header.numNodes          = data.numNodes;
+	header.numMaterials      = numMaterials;
+	header.numPrimRefs       = numPrimRefs;
+	header.verticesOffset    = align64(sizeof(MeshCacheHeader));
+	header.indicesOffset     = align64(header.verticesOffset + uint64_t(data.numVertices) * 3 * sizeof(float));
+	header.primOrderOffset   = align64(header.indicesOffset + numTriangles * 3 * sizeof(uint32_t));
+	header.nodesOffset       = align64(header.primOrderOffset + numPrimRefs * sizeof(uint32_t));
+	header.materialIdsOffset = align64(header.nodesOffset + uint64_t(data.numNodes) * sizeof(LinearBVHNode));
+	header.materialsOffset   = align64(header.materialIdsOffset + (numMaterials ? numTriangles : 0) * sizeof(uint32_t));
+	header.fileSize          = header.materialsOffset + numMaterials * sizeof(MeshCacheMaterial);
+
+	// Assemble the whole image in memory and write it with a single call
+	std::vector<unsigned char> image(header.fileSize, 0);
+	memcpy(image.data(), &header, sizeof(header));
+	memcpy(image.data() + header.verticesOffset, data.vertices, uint64_t(data.numVertices) * 3 * sizeof(float));
+	memcpy(image.data() + header.indicesOffset, data.indices, numTriangles * 3 * sizeof(uint32_t));
+	memcpy(image.data() + header.primOrderOffset, data.primOrder, numPrimRefs * sizeof(uint32_t));
+	memcpy(image.data() + header.nodesOffset, data.nodes, uint64_t(data.numNodes) * sizeof(LinearBVHNode));
+	if(numMaterials > 0) {
+		memcpy(image.data() + header.materialIdsOffset, data.materialIds, numTriangles * sizeof(uint32_t));
+		memcpy(image.data() + header.materialsOffset, data.materials, numMaterials * sizeof(MeshCacheMaterial));
+	}
+
+	std::string path    = cachePath(sourcePath);
+	std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+	FILE *fp            = fopen(tmpPath.c_str(), "wb");
+	if(!fp)
+		return false;
+	bool ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+	ok      = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
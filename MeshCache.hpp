@@ -0,0 +1,103 @@
+//
+// Binary mesh/BVH cache with mmap loading.
+//
+
+#ifndef RAYTRACING_MESHCACHE_H
+#define RAYTRACING_MESHCACHE_H
+
+#include "BVH.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @brief 只读（写时复制）映射到内存的文件。
+ *
+ * 映射使用 MAP_PRIVATE，因此调用方可以原地修改映射内容（例如 BVH 节点），而不会写回磁盘。
+ */
+class MappedFile {
+public:
+	static std::shared_ptr<MappedFile> open(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile &)            = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	unsigned char *data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(unsigned char *b, size_t len): base(b), length(len) {}
+	unsigned char *base;
+	size_t length;
+};
+
+/**
+ * @brief 缓存中保存的 MTL 材质参数（与 objl::Material 对应的子集）。
+ */
+struct MeshCacheMaterial {
+	float Kd[3], Ks[3], Ke[3];
+	float Ns, Ni;
+};
+
+/**
+ * @brief 版本化的网格缓存文件头。
+ *
+ * 文件布局：头部之后依次是顶点位置（float[3]）、三角形索引（uint32[3]）、
+ * 叶子图元顺序（uint32）、展平的 BVH 节点（LinearBVHNode），以及可选的逐三角形材质编号（uint32）
+ * 和材质表（MeshCacheMaterial），每段都按 64 字节对齐，因此映射后可以直接使用，无需反序列化。
+ */
+struct MeshCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint64_t sourceHash;// hash of the source file (and its MTL libraries) and the build options
+	uint32_t numVertices;
+	uint32_t numTriangles;
+	uint32_t numNodes;
+	uint32_t numMaterials;// 0 -> no per-triangle materials
+	uint32_t numPrimRefs; // leaf references; more than numTriangles when spatial splits duplicate triangles
+	uint32_t pad;
+	uint64_t verticesOffset;
+	uint64_t indicesOffset;
+	uint64_t primOrderOffset;
+	uint64_t nodesOffset;
+	uint64_t materialIdsOffset;
+	uint64_t materialsOffset;
+	uint64_t fileSize;
+};
+
+/**
+ * @brief 网格缓存的内容。加载时指针均指向 file 内部；写入时由调用方提供。
+ */
+struct MeshCacheView {
+	std::shared_ptr<MappedFile> file;
+	const float *vertices              = nullptr;// numVertices * 3
+	const uint32_t *indices            = nullptr;// numTriangles * 3
+	const uint32_t *primOrder          = nullptr;// numPrimRefs
+	LinearBVHNode *nodes               = nullptr;// numNodes
+	const uint32_t *materialIds        = nullptr;// numTriangles, only if numMaterials > 0
+	const MeshCacheMaterial *materials = nullptr;// numMaterials
+	uint32_t numVertices = 0, numTriangles = 0, numNodes = 0, numMaterials = 0, numPrimRefs = 0;
+};
+
+namespace MeshCache {
+	inline constexpr uint32_t kVersion = 4;
+	// Set to false (e.g. --no-cache) to always parse source files
+	inline bool enabled = true;
+
+	// Cache file that belongs to a source asset
+	std::string cachePath(const std::string &sourcePath);
+	// FNV-1a hash of the source file contents (plus any MTL libraries an OBJ references) mixed with the
+	// BVH build options; 0 if unreadable
+	uint64_t sourceHash(const std::string &sourcePath, int maxPrimsInNode, BVHAccel::SplitMethod splitMethod,
+	                    bool withMaterials = false);
+
+	// Map the cache for sourcePath; returns false if it is missing, corrupt or stale
+	bool load(const std::string &sourcePath, uint64_t hash, MeshCacheView &view);
+	// Write a new cache atomically (temp file + rename); failures are not fatal
+	bool store(const std::string &sourcePath, uint64_t hash, const MeshCacheView &data);
+}// namespace MeshCache
+
+#endif//RAYTRACING_MESHCACHE_H
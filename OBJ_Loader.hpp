@@ -139,6 +139,8 @@ namespace objl {
 		Vector3 Kd;
 		// Specular Color
 		Vector3 Ks;
+		// Emissive Color
+		Vector3 Ke;
 		// Specular Exponent
 		float Ns;
 		// Optical Density
@@ -942,6 +944,18 @@ namespace objl {
 					tempMaterial.Ks.Y = std::stof(temp[1]);
 					tempMaterial.Ks.Z = std::stof(temp[2]);
 				}
+				// Emissive Color
+				if(algorithm::firstToken(curline) == "Ke") {
+					std::vector<std::string> temp;
+					algorithm::split(algorithm::tail(curline), temp, " ");
+
+					if(temp.size() != 3)
+						continue;
+
+					tempMaterial.Ke.X = std::stof(temp[0]);
+					tempMaterial.Ke.Y = std::stof(temp[1]);
+					tempMaterial.Ke.Z = std::stof(temp[2]);
+				}
 				// Specular Exponent
 				if(algorithm::firstToken(curline) == "Ns") {
 					tempMaterial.Ns = std::stof(algorithm::tail(curline));
@@ -8,8 +8,10 @@
 #include "Bounds3.hpp"
 #include "Intersection.hpp"
 #include "Ray.hpp"
+#include "SIMD.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
+#include <vector>
 
 class Object {
 public:
@@ -24,6 +26,34 @@ public:
 	virtual float getArea()                                                                                                                 = 0;
 	virtual void Sample(Intersection &pos, float &pdf)                                                                                      = 0;
 	virtual bool hasEmit()                                                                                                                  = 0;
+	// Bounds of the part of the surface inside box, used by spatial BVH splits; conservative by default
+	virtual Bounds3 getClippedBounds(const Bounds3 &box) { return getBounds().Intersect(box); }
+	// Sample a point for lighting the reference point ref. Shapes that know which part of them ref can see
+	// sample only that part; pdf is per unit area, as for Sample(pos, pdf), which is the default.
+	virtual void Sample(const Vector3f & /*ref*/, Intersection &pos, float &pdf) { Sample(pos, pdf); }
+	// Area of the emitting part of the surface, used to pick lights proportional to area
+	virtual float getEmitArea() { return hasEmit() ? getArea() : 0; }
+	// Separately sampled emitters this object consists of: itself by default, the emissive triangles of a mesh
+	virtual void getEmitters(std::vector<Object *> &emitters) {
+		if(hasEmit())
+			emitters.push_back(this);
+	}
+	// Materials the surface can be hit with, for numbering them in the material ID output
+	virtual void getMaterials(std::vector<Material *> &) {}
+	// Directions the surface normals point in; light is emitted into the hemisphere around each of them
+	virtual DirectionCone getNormalBounds() { return DirectionCone::EntireSphere(); }
+	// Intersect the packet's active rays (bit i = lane i): a closer hit replaces hits[i] and clips packet.tMax[i].
+	// Objects without a batched test trace the rays one at a time.
+	virtual void intersectPacket(RayPacket &packet, Intersection *hits, uint32_t active) {
+		for(; active; active &= active - 1) {
+			int i            = __builtin_ctz(active);
+			Intersection hit = getIntersection(packet.ray(i));
+			if(hit.happened && hit.distance < hits[i].distance) {
+				hits[i]        = hit;
+				packet.tMax[i] = hit.distance;
+			}
+		}
+	}
 };
 
 
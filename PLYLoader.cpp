@@ -0,0 +1,388 @@
+//
+// Streaming binary PLY loader.
+//
+
+#include "PLYLoader.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace {
+	enum class PLYType { Int8,
+		                 UInt8,
+		                 Int16,
+		                 UInt16,
+		                 Int32,
+		                 UInt32,
+		                 Float32,
+		                 Float64,
+		                 Invalid };
+
+	PLYType parseType(const std::string &name) {
+		if(name == "char" || name == "int8") return PLYType::Int8;
+		if(name == "uchar" || name == "uint8") return PLYType::UInt8;
+		if(name == "short" || name == "int16") return PLYType::Int16;
+		if(name == "ushort" || name == "uint16") return PLYType::UInt16;
+		if(name == "int" || name == "int32") return PLYType::Int32;
+		if(name == "uint" || name == "uint32") return PLYType::UInt32;
+		if(name == "float" || name == "float32") return PLYType::Float32;
+		if(name == "double" || name == "float64") return PLYType::Float64;
+		return PLYType::Invalid;
+	}
+
+	size_t typeSize(PLYType type) {
+		switch(type) {
+			case PLYType::Int8:
+			case PLYType::UInt8: return 1;
+			case PLYType::Int16:
+			case PLYType::UInt16: return 2;
+			case PLYType::Int32:
+			case PLYType::UInt32:
+			case PLYType::Float32: return 4;
+			case PLYType::Float64: return 8;
+			default: return 0;
+		}
+	}
+
+	// Decoders are picked once per property when the header is parsed
+	typedef double (*DecodeFn)(const unsigned char *);
+
+	template<typename T>
+	double decode(const unsigned char *p) {
+		T v;
+		memcpy(&v, p, sizeof(T));
+		return double(v);
+	}
+
+	DecodeFn decoder(PLYType type) {
+		switch(type) {
+			case PLYType::Int8: return decode<int8_t>;
+			case PLYType::UInt8: return decode<uint8_t>;
+			case PLYType::Int16: return decode<int16_t>;
+			case PLYType::UInt16: return decode<uint16_t>;
+			case PLYType::Int32: return decode<int32_t>;
+			case PLYType::UInt32: return decode<uint32_t>;
+			case PLYType::Float32: return decode<float>;
+			case PLYType::Float64: return decode<double>;
+			default: return nullptr;
+		}
+	}
+
+	// List counts and vertex indices may be stored as any type, floats and negative integers included: whether v
+	// is a number in [0, limit), which is then cast to out
+	bool decodeIndex(double v, uint64_t limit, uint64_t &out) {
+		if(!(v >= 0 && v < double(limit)))
+			return false;
+		out = (uint64_t) v;
+		return true;
+	}
+	// Largest list count accepted: 32 bits, as no loader writes longer lists
+	constexpr uint64_t kMaxListCount = uint64_t(1) << 32;
+
+	struct PLYProperty {
+		std::string name;
+		PLYType type      = PLYType::Invalid;// item type for lists
+		bool isList       = false;
+		PLYType countType = PLYType::Invalid;
+
+		// Resolved from the types above when the header is parsed
+		size_t size          = 0;
+		size_t countSize     = 0;
+		DecodeFn decode      = nullptr;
+		DecodeFn decodeCount = nullptr;
+	};
+
+	struct PLYElement {
+		std::string name;
+		uint64_t count = 0;
+		std::vector<PLYProperty> props;
+
+		// Byte size of one element if it has no list properties, 0 otherwise
+		size_t fixedStride() const {
+			size_t stride = 0;
+			for(const auto &prop: props) {
+				if(prop.isList)
+					return 0;
+				stride += prop.size;
+			}
+			return stride;
+		}
+	};
+
+	// Large sequential read buffer over a FILE*, refilled only when a request runs past its end
+	class ChunkReader {
+	public:
+		static constexpr size_t kChunkSize = 4 << 20;
+
+		explicit ChunkReader(FILE *f): file(f), buffer(kChunkSize) {}
+
+		// Make at least n bytes available at ptr(); false on premature end of file
+		bool ensure(size_t n) {
+			if(end - pos >= n)
+				return true;
+			memmove(buffer.data(), buffer.data() + pos, end - pos);
+			end -= pos;
+			pos = 0;
+			if(n > buffer.size())
+				buffer.resize(n);
+			while(end < n) {
+				size_t got = fread(buffer.data() + end, 1, buffer.size() - end, file);
+				if(got == 0)
+					return false;
+				end += got;
+			}
+			return true;
+		}
+		// Bytes currently buffered (at least n once ensure(n) succeeded)
+		size_t available() const { return end - pos; }
+		const unsigned char *ptr() const { return buffer.data() + pos; }
+		void advance(size_t n) { pos += n; }
+
+	private:
+		FILE *file;
+		std::vector<unsigned char> buffer;
+		size_t pos = 0, end = 0;
+	};
+
+	std::vector<std::string> splitWords(const std::string &line) {
+		std::vector<std::string> words;
+		size_t i = 0;
+		while(i < line.size()) {
+			while(i < line.size() && isspace((unsigned char) line[i]))
+				++i;
+			size_t j = i;
+			while(j < line.size() && !isspace((unsigned char) line[j]))
+				++j;
+			if(j > i)
+				words.push_back(line.substr(i, j - i));
+			i = j;
+		}
+		return words;
+	}
+
+	bool readLine(FILE *fp, std::string &line) {
+		line.clear();
+		int c;
+		while((c = fgetc(fp)) != EOF) {
+			if(c == '\n')
+				return true;
+			line.push_back((char) c);
+		}
+		return !line.empty();
+	}
+}// namespace
+
+bool PLYLoader::LoadFile(const std::string &path, std::vector<Vector3f> &vertices, std::vector<uint32_t> &indices) {
+	static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "PLYLoader decodes little endian data in place");
+
+	std::unique_ptr<FILE, int (*)(FILE *)> fp(fopen(path.c_str(), "rb"), fclose);
+	if(!fp) {
+		error = "cannot open " + path;
+		return false;
+	}
+
+	// ---- Header: resolve every element's property layout once ----
+	std::string line;
+	if(!readLine(fp.get(), line) || line.compare(0, 3, "ply") != 0) {
+		error = path + " is not a PLY file";
+		return false;
+	}
+	std::vector<PLYElement> elements;
+	bool binaryLE = false;
+	while(true) {
+		if(!readLine(fp.get(), line)) {
+			error = "unexpected end of PLY header";
+			return false;
+		}
+		auto words = splitWords(line);
+		if(words.empty() || words[0] == "comment" || words[0] == "obj_info")
+			continue;
+		if(words[0] == "end_header")
+			break;
+		if(words[0] == "format") {
+			binaryLE = words.size() >= 2 && words[1] == "binary_little_endian";
+		} else if(words[0] == "element" && words.size() >= 3) {
+			PLYElement element;
+			element.name  = words[1];
+			element.count = std::stoull(words[2]);
+			elements.push_back(element);
+		} else if(words[0] == "property" && !elements.empty()) {
+			PLYProperty prop;
+			if(words.size() >= 5 && words[1] == "list") {
+				prop.isList    = true;
+				prop.countType = parseType(words[2]);
+				prop.type      = parseType(words[3]);
+				prop.name      = words[4];
+			} else if(words.size() >= 3) {
+				prop.type = parseType(words[1]);
+				prop.name = words[2];
+			}
+			if(prop.type == PLYType::Invalid || (prop.isList && prop.countType == PLYType::Invalid)) {
+				error = "unsupported PLY property: " + line;
+				return false;
+			}
+			prop.size   = typeSize(prop.type);
+			prop.decode = decoder(prop.type);
+			if(prop.isList) {
+				prop.countSize   = typeSize(prop.countType);
+				prop.decodeCount = decoder(prop.countType);
+			}
+			elements.back().props.push_back(prop);
+		}
+	}
+	if(!binaryLE) {
+		error = path + ": only binary_little_endian PLY files are supported";
+		return false;
+	}
+
+	// ---- Body: stream the elements in file order ----
+	auto truncated = [&]() {
+		error = "unexpected end of PLY data in " + path;
+		return false;
+	};
+	ChunkReader reader(fp.get());
+	const uint32_t vertexBase = vertices.size();
+	uint64_t numVertices      = 0;
+	for(const auto &element: elements) {
+		size_t stride = element.fixedStride();
+
+		if(element.name == "vertex") {
+			if(stride == 0) {
+				error = "PLY vertex elements with list properties are not supported";
+				return false;
+			}
+			size_t offset[3] = {0, 0, 0}, cursor = 0;
+			DecodeFn decodeXYZ[3] = {nullptr, nullptr, nullptr};
+			for(const auto &prop: element.props) {
+				int axis = prop.name == "x" ? 0 : prop.name == "y" ? 1 : prop.name == "z" ? 2 : -1;
+				if(axis >= 0) {
+					offset[axis]    = cursor;
+					decodeXYZ[axis] = prop.decode;
+				}
+				cursor += prop.size;
+			}
+			if(!decodeXYZ[0] || !decodeXYZ[1] || !decodeXYZ[2]) {
+				error = "PLY vertex element has no x/y/z properties";
+				return false;
+			}
+			// Common case: packed float x, y, z
+			bool packedFloat = decodeXYZ[0] == decodeXYZ[1] && decodeXYZ[1] == decodeXYZ[2] &&
+			                   decodeXYZ[0] == decode<float> &&
+			                   offset[1] == offset[0] + 4 && offset[2] == offset[0] + 8;
+
+			vertices.reserve(vertices.size() + element.count);
+			uint64_t remaining = element.count;
+			while(remaining > 0) {
+				if(!reader.ensure(stride)) {
+					error = "unexpected end of PLY vertex data";
+					return false;
+				}
+				uint64_t batch = std::min<uint64_t>(remaining, reader.available() / stride);
+				const unsigned char *p = reader.ptr();
+				for(uint64_t i = 0; i < batch; ++i, p += stride) {
+					if(packedFloat) {
+						float xyz[3];
+						memcpy(xyz, p + offset[0], sizeof(xyz));
+						vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+					} else {
+						vertices.emplace_back(decodeXYZ[0](p + offset[0]), decodeXYZ[1](p + offset[1]),
+						                      decodeXYZ[2](p + offset[2]));
+					}
+				}
+				reader.advance(batch * stride);
+				remaining -= batch;
+			}
+			numVertices = element.count;
+		} else if(element.name == "face") {
+			int listIndex = -1;
+			for(size_t i = 0; i < element.props.size(); ++i) {
+				const auto &prop = element.props[i];
+				if(prop.isList && (prop.name == "vertex_indices" || prop.name == "vertex_index"))
+					listIndex = i;
+			}
+			if(listIndex < 0) {
+				error = "PLY face element has no vertex_indices list";
+				return false;
+			}
+			const PLYProperty &list = element.props[listIndex];
+
+			indices.reserve(indices.size() + 3 * element.count);
+			uint32_t polygon[256];
+			for(uint64_t f = 0; f < element.count; ++f) {
+				for(size_t i = 0; i < element.props.size(); ++i) {
+					const auto &prop = element.props[i];
+					if(!prop.isList) {
+						if(!reader.ensure(prop.size))
+							return truncated();
+						reader.advance(prop.size);
+						continue;
+					}
+					if(!reader.ensure(prop.countSize))
+						return truncated();
+					uint64_t n;
+					if(!decodeIndex(prop.decodeCount(reader.ptr()), kMaxListCount, n)) {
+						error = "bad PLY list count";
+						return false;
+					}
+					reader.advance(prop.countSize);
+					if((int) i == listIndex && n > 256) {
+						error = "PLY face with more than 256 vertices";
+						return false;
+					}
+					if(!reader.ensure(n * prop.size))
+						return truncated();
+					if((int) i != listIndex) {
+						reader.advance(n * prop.size);
+						continue;
+					}
+					const unsigned char *p = reader.ptr();
+					for(size_t k = 0; k < n; ++k) {
+						uint64_t idx;
+						if(!decodeIndex(list.decode(p + k * list.size), numVertices, idx)) {
+							error = "bad PLY face index";
+							return false;
+						}
+						polygon[k] = vertexBase + (uint32_t) idx;
+					}
+					reader.advance(n * list.size);
+					// Fan triangulation
+					for(size_t k = 2; k < n; ++k)
+						indices.insert(indices.end(), {polygon[0], polygon[k - 1], polygon[k]});
+				}
+			}
+		} else if(stride > 0) {
+			// Skip unused fixed size elements in whole chunks
+			uint64_t remaining = element.count * stride;
+			while(remaining > 0) {
+				if(!reader.ensure(1))
+					return truncated();
+				uint64_t n = std::min<uint64_t>(remaining, reader.available());
+				reader.advance(n);
+				remaining -= n;
+			}
+		} else {
+			for(uint64_t e = 0; e < element.count; ++e) {
+				for(const auto &prop: element.props) {
+					size_t size = prop.size;
+					if(prop.isList) {
+						if(!reader.ensure(prop.countSize))
+							return truncated();
+						uint64_t n;
+						if(!decodeIndex(prop.decodeCount(reader.ptr()), kMaxListCount, n)) {
+							error = "bad PLY list count";
+							return false;
+						}
+						size *= n;
+						reader.advance(prop.countSize);
+					}
+					if(!reader.ensure(size))
+						return truncated();
+					reader.advance(size);
+				}
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+//
+// Streaming binary PLY loader.
+//
+
+#ifndef RAYTRACING_PLYLOADER_H
+#define RAYTRACING_PLYLOADER_H
+
+#include "Vector.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 二进制（little endian）PLY 网格读取器。
+ *
+ * 头部只解析一次：每个元素的属性布局（偏移、步长、类型解码函数）在读取数据前就已确定，
+ * 随后以大块缓冲的方式顺序读取文件主体，把 vertex 元素的 x/y/z 与 face 元素的索引列表
+ * 直接写入调用方提供的索引网格数组（与 MeshTriangle 使用的 vertices/vertexIndex 相同）。
+ * 多边形面按扇形三角化，其他元素和属性会被跳过。
+ */
+class PLYLoader {
+public:
+	// Load path into vertices/indices (appending); returns false and fills error on failure
+	bool LoadFile(const std::string &path, std::vector<Vector3f> &vertices, std::vector<uint32_t> &indices);
+
+	std::string error;
+};
+
+#endif//RAYTRACING_PLYLOADER_H
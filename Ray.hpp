@@ -9,16 +9,20 @@ struct Ray {
 	//Destination = origin + t*direction
 	Vector3f origin;
 	Vector3f direction, direction_inv;
-	double t;//transportation time,
-	double t_min, t_max;
+	float t;//transportation time,
+	// Parametric range still of interest. Traversal works on its own copy of the ray and shrinks tMax to the closest
+	// hit found so far, which lets box and primitive tests reject everything farther away.
+	float tMin;
+	float tMax;
 
-	Ray(const Vector3f &ori, const Vector3f &dir, const double _t = 0.0): origin(ori), direction(dir), t(_t) {
-		direction_inv = Vector3f(1. / direction.x, 1. / direction.y, 1. / direction.z);
-		t_min         = 0.0;
-		t_max         = std::numeric_limits<double>::max();
+	Ray(): Ray(Vector3f(), Vector3f(0, 0, 1)) {}
+	Ray(const Vector3f &ori, const Vector3f &dir, const float _t = 0.0f): origin(ori), direction(dir), t(_t) {
+		direction_inv = Vector3f(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		tMin          = 0.0f;
+		tMax          = std::numeric_limits<float>::max();
 	}
 
-	Vector3f operator()(double t) const { return origin + direction * t; }
+	Vector3f operator()(float t) const { return origin + direction * t; }
 
 	friend std::ostream &operator<<(std::ostream &os, const Ray &r) {
 		os << "[origin:=" << r.origin << ", direction=" << r.direction << ", time=" << r.t << "]\n";
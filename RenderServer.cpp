@@ -0,0 +1,304 @@
+//
+// Long-running render service: scenes stay loaded, with their BVHs, between the jobs sent to it.
+//
+
+#include "RenderServer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+/**
+ * @brief 一个客户端：从 in 读命令，向 out 写回复（套接字时两者相同）。
+ *
+ * 回复可能来自读线程（stats）和渲染线程（任务结果），所以写入加锁，每行一次写完。
+ */
+struct RenderServer::Connection {
+	int in, out;
+	bool socket;// a connected socket, closed with the connection
+	std::mutex writeMutex;
+
+	Connection(int inFd, int outFd, bool isSocket): in(inFd), out(outFd), socket(isSocket) {}
+	~Connection() {
+		if(socket)
+			::close(in);
+	}
+
+	void reply(const std::string &line) {
+		std::string text = line + "\n";
+		std::lock_guard<std::mutex> lock(writeMutex);
+		for(size_t done = 0; done < text.size();) {
+			// A client that went away must not kill the server with SIGPIPE
+			ssize_t n = socket ? ::send(out, text.data() + done, text.size() - done, MSG_NOSIGNAL)
+			                   : ::write(out, text.data() + done, text.size() - done);
+			if(n <= 0)
+				return;
+			done += n;
+		}
+	}
+};
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	double milliseconds(Clock::time_point from, Clock::time_point to) {
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	// mean/p50/p95/max of a list of latencies
+	std::string summary(std::vector<double> v) {
+		if(v.empty())
+			return "-";
+		std::sort(v.begin(), v.end());
+		double mean = 0;
+		for(double x: v)
+			mean += x / v.size();
+		auto percentile = [&](double q) { return v[std::min(v.size() - 1, size_t(q * v.size()))]; };
+		char text[128];
+		snprintf(text, sizeof(text), "%.1f/%.1f/%.1f/%.1f", mean, percentile(0.5), percentile(0.95), v.back());
+		return text;
+	}
+
+	// "x,y,z"
+	Vector3f parseVector(const std::string &text) {
+		size_t a = text.find(','), b = text.find(',', a == std::string::npos ? a : a + 1);
+		if(b == std::string::npos || text.find(',', b + 1) != std::string::npos)
+			throw std::invalid_argument(text);
+		return Vector3f(std::stof(text.substr(0, a)), std::stof(text.substr(a + 1, b - a - 1)), std::stof(text.substr(b + 1)));
+	}
+}// namespace
+
+RenderServer::RenderServer(SceneLoader sceneLoader, const Renderer &defaults)
+    : loader(std::move(sceneLoader)), renderDefaults(defaults) {}
+
+void RenderServer::readCommands(const std::shared_ptr<Connection> &client) {
+	std::string pending;
+	char buffer[4096];
+	bool open = true;
+	while(open) {
+		ssize_t n = ::read(client->in, buffer, sizeof(buffer));
+		if(n <= 0)
+			break;
+		pending.append(buffer, n);
+		for(size_t eol; open && (eol = pending.find('\n')) != std::string::npos;) {
+			std::string line = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+			std::istringstream words(line);
+			std::string verb;
+			if(!(words >> verb))
+				continue;
+			if(verb == "render") {
+				std::lock_guard<std::mutex> lock(queueMutex);
+				if(stopping) {
+					client->reply("error shutting down");
+					continue;
+				}
+				queue.push_back({nextId++, client, line, Clock::now()});
+				queueChanged.notify_all();
+			} else if(verb == "stats")
+				client->reply(statsReply());
+			else if(verb == "shutdown") {
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+				// Wakes the accept loop of serveSocket
+				if(listener >= 0)
+					::shutdown(listener, SHUT_RDWR);
+				queueChanged.notify_all();
+				client->reply("ok shutdown");
+				open = false;
+			} else
+				client->reply("error unknown command " + verb);
+		}
+	}
+	std::lock_guard<std::mutex> lock(queueMutex);
+	--readers;
+	queueChanged.notify_all();
+}
+
+void RenderServer::renderJobs() {
+	for(;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueChanged.wait(lock, [&] { return !queue.empty() || stopping || (untilIdle && readers == 0); });
+			if(queue.empty())
+				return;
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+		std::string reply = runJob(job);
+		std::cout << "\n" << reply << std::endl;
+		job.client->reply(reply);
+	}
+}
+
+std::string RenderServer::runJob(const Job &job) {
+	Clock::time_point start = Clock::now();
+	auto error              = [&](const std::string &why) { return "error id=" + std::to_string(job.id) + " " + why; };
+
+	Renderer renderer     = renderDefaults;
+	std::string sceneName = "default";
+	int width = 0, height = 0;
+	std::istringstream words(job.command);
+	std::string word;
+	words >> word;// render
+	while(words >> word) {
+		size_t eq = word.find('=');
+		if(eq == std::string::npos)
+			return error("expected key=value, got " + word);
+		std::string key = word.substr(0, eq), value = word.substr(eq + 1);
+		try {
+			if(key == "scene")
+				sceneName = value;
+			else if(key == "width")
+				width = std::stoi(value);
+			else if(key == "height")
+				height = std::stoi(value);
+			else if(key == "eye")
+				renderer.camera.eye = parseVector(value);
+			else if(key == "target")
+				renderer.camera.target = parseVector(value);
+			else if(key == "up")
+				renderer.camera.up = parseVector(value);
+			else if(key == "fov") {
+				renderer.camera.projection = Camera::Projection::Perspective;
+				renderer.camera.fov        = std::stof(value);
+			} else if(key == "ortho") {
+				renderer.camera.projection = Camera::Projection::Orthographic;
+				renderer.camera.viewHeight = std::stof(value);
+			} else if(key == "spp")
+				renderer.spp = std::stoi(value);
+			else if(key == "seed")
+				renderer.seed = std::stoull(value);
+			else if(key == "crop") {
+				std::istringstream corners(value);
+				char comma[3];
+				Tile &crop = renderer.region.crop;
+				if(!(corners >> crop.x0 >> comma[0] >> crop.y0 >> comma[1] >> crop.x1 >> comma[2] >> crop.y1) ||
+				   std::string(comma, 3) != ",,," || !corners.eof())
+					throw std::invalid_argument(value);
+			} else if(key == "mask")
+				renderer.region.maskPath = value;
+			else if(key == "base")
+				renderer.region.basePath = value;
+			else if(key == "output")
+				renderer.outputPath = value;
+			else
+				return error("unknown setting " + key);
+		} catch(const std::exception &) {
+			return error("bad value for " + key + ": " + value);
+		}
+	}
+	if(width < 0 || height < 0 || renderer.spp <= 0 || !renderer.camera.valid())
+		return error("settings out of range");
+
+	// A scene is loaded, and its BVHs built, by the first job that names it
+	auto found  = scenes.find(sceneName);
+	bool cached = found != scenes.end();
+	if(!cached) {
+		std::unique_ptr<Scene> scene = loader(sceneName);
+		if(!scene)
+			return error("cannot load scene " + sceneName);
+		found = scenes.emplace(sceneName, LoadedScene{std::move(scene), 0, 0}).first;
+		found->second.width  = found->second.scene->width;
+		found->second.height = found->second.scene->height;
+	}
+	// Settings a job leaves out come from the scene as loaded and the server's camera, not from the previous job
+	Scene &scene = *found->second.scene;
+	scene.width  = width ? width : found->second.width;
+	scene.height = height ? height : found->second.height;
+	if(!renderer.region.cropFits(scene.width, scene.height))
+		return error("crop window empty or outside the image");
+	Clock::time_point setup = Clock::now();
+
+	bool written           = renderer.Render(scene);
+	Clock::time_point done = Clock::now();
+	double queued          = milliseconds(job.received, start);
+	double prepared        = milliseconds(start, setup);
+	double rendered        = milliseconds(setup, done);
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		queueMs.push_back(queued);
+		setupMs.push_back(prepared);
+		renderMs.push_back(rendered);
+	}
+	if(!written)
+		return error("could not read the inputs or write " + renderer.outputPath);
+
+	char text[160];
+	snprintf(text, sizeof(text), " cached=%d queue_ms=%.1f setup_ms=%.1f render_ms=%.1f", cached, queued, prepared, rendered);
+	return "ok id=" + std::to_string(job.id) + " scene=" + sceneName + text + " output=" + renderer.outputPath;
+}
+
+std::string RenderServer::statsReply() {
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return "stats jobs=" + std::to_string(renderMs.size()) + " queue_ms=" + summary(queueMs) + " setup_ms=" + summary(setupMs) +
+	       " render_ms=" + summary(renderMs) + " (mean/p50/p95/max)";
+}
+
+void RenderServer::serveStream(int in, int out) {
+	untilIdle = true;
+	readers   = 1;
+	auto client = std::make_shared<Connection>(in, out, false);
+	std::thread reader([this, client] { readCommands(client); });
+	renderJobs();
+	reader.join();
+}
+
+bool RenderServer::serveSocket(const std::string &path) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path))
+		return false;
+	std::copy(path.begin(), path.end(), address.sun_path);
+	listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0)
+		return false;
+	::unlink(path.c_str());
+	if(::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listener, 16) != 0) {
+		::close(listener);
+		listener = -1;
+		return false;
+	}
+
+	std::thread renderThread([this] { renderJobs(); });
+	std::vector<std::weak_ptr<Connection>> clients;
+	for(;;) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		if(fd < 0 && errno == EINTR)
+			continue;
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if(fd < 0 || stopping) {
+			if(fd >= 0)
+				::close(fd);
+			// Stop the render thread too if accept failed for some other reason
+			stopping = true;
+			queueChanged.notify_all();
+			break;
+		}
+		++readers;
+		auto client = std::make_shared<Connection>(fd, fd, true);
+		clients.erase(std::remove_if(clients.begin(), clients.end(), [](const auto &c) { return c.expired(); }), clients.end());
+		clients.push_back(client);
+		std::thread([this, client] { readCommands(client); }).detach();
+	}
+	renderThread.join();
+
+	// Every queued job has been answered: hang up on the clients still connected and wait for their readers
+	for(const auto &c: clients)
+		if(std::shared_ptr<Connection> client = c.lock())
+			::shutdown(client->in, SHUT_RDWR);
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		queueChanged.wait(lock, [&] { return readers == 0; });
+	}
+	::close(listener);
+	listener = -1;
+	::unlink(path.c_str());
+	return true;
+}
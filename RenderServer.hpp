@@ -0,0 +1,88 @@
+//
+// Long-running render service: scenes stay loaded, with their BVHs, between the jobs sent to it.
+//
+
+#ifndef RAYTRACING_RENDERSERVER_H
+#define RAYTRACING_RENDERSERVER_H
+
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 常驻的渲染服务：加载过的场景及其 BVH、光源结构一直留在内存中，之后的任务直接复用。
+ *
+ * 协议是按行的文本，每行一条命令：
+ *   render scene=<名称> width=<宽> height=<高> spp=<样本数> seed=<种子> output=<路径>
+ *          eye=x,y,z target=x,y,z up=x,y,z fov=<度>（透视）或 ortho=<视野高度>（正交）
+ *          crop=x0,y0,x1,y1 mask=<图像> base=<图像>（只重渲染一个区域，其余像素取自 base）
+ *     （除 render 外都可省略，省略的分辨率取场景加载时的值，省略的相机设置取服务启动时命令行的相机）
+ *   stats     回复已完成任务排队、准备、渲染耗时的统计
+ *   shutdown  做完已排队的任务后退出
+ * 每个任务完成后回复一行 "ok id=... queue_ms=... setup_ms=... render_ms=..."，失败时回复 "error id=... 原因"。
+ * 读取命令与渲染在不同线程，任务排队依次执行，每个任务本身用满所有核。
+ */
+class RenderServer {
+public:
+	// Build the named scene, BVHs included, at any resolution (jobs set their own); nullptr if it cannot be loaded
+	using SceneLoader = std::function<std::unique_ptr<Scene>(const std::string &name)>;
+
+	// Jobs are rendered with a copy of defaults, with the job's settings applied
+	RenderServer(SceneLoader sceneLoader, const Renderer &defaults);
+
+	// Serve the commands read from fd in, replying on fd out, until the input ends or says shutdown
+	void serveStream(int in, int out);
+	// Serve every client that connects to a Unix socket at path until one says shutdown; false if the socket could
+	// not be set up
+	bool serveSocket(const std::string &path);
+
+private:
+	struct Connection;
+	struct Job {
+		int id;
+		std::shared_ptr<Connection> client;
+		std::string command;
+		std::chrono::steady_clock::time_point received;
+	};
+
+	// Read commands from a client until it disconnects or says shutdown
+	void readCommands(const std::shared_ptr<Connection> &client);
+	// Render queued jobs until shutdown (or, if untilIdle, until the input is gone) and the queue is empty
+	void renderJobs();
+	// Run one job; the reply line
+	std::string runJob(const Job &job);
+	std::string statsReply();
+
+	// A resident scene, with the resolution it was loaded with
+	struct LoadedScene {
+		std::unique_ptr<Scene> scene;
+		int width, height;
+	};
+
+	SceneLoader loader;
+	Renderer renderDefaults;
+	std::map<std::string, LoadedScene> scenes;// by name; only the render thread touches them
+
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<Job> queue;
+	int nextId     = 1;
+	int readers    = 0;    // clients still being read
+	bool stopping  = false;// shutdown received: no more jobs are accepted
+	bool untilIdle = false;// stop once no reader is left and the queue is empty (stream mode)
+	int listener   = -1;
+
+	// Latencies of the finished jobs, in milliseconds
+	std::mutex statsMutex;
+	std::vector<double> queueMs, setupMs, renderMs;
+};
+
+#endif//RAYTRACING_RENDERSERVER_H
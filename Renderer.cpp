@@ -3,97 +3,475 @@
 //
 
 #include "Renderer.hpp"
+#include "ImageIO.hpp"
 #include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <mutex>
-#include <thread>
 
 // 添加一个互斥锁来保护进度更新的输出
 std::mutex mutex;
 
 float progress = 0;
 
-inline float deg2rad(const float &deg) { return deg * M_PI / 180.0; }
-
 const float EPSILON = 1e-4;
 
+// Primary rays through pixels i0 .. i0 + n - 1 (n <= RayPacket::kPacketSize) of row j, traced as one packet
+static void tracePrimaryRays(const Camera &camera, const Scene &scene, int j, int i0, int n, Ray *rays, Intersection *hits) {
+	camera.generateRays(j, i0, n, rays);
+	RayPacket packet{};
+	for(int k = 0; k < n; ++k)
+		packet.set(k, rays[k]);
+	scene.intersect(packet, hits, (1u << n) - 1);
+}
+
+static void recordFirstHit(const Scene &scene, FeatureBuffers &features, int pixel, const Intersection &hit) {
+	features.record(pixel, hit, scene.objectId(hit.obj), scene.materialId(hit.m));
+}
+
+// Run fn(startY, endY) over blocks of rows on every render thread and wait for all of them
+template<typename Fn>
+static void forEachRowBlock(int height, Fn fn) {
+	ThreadPool &threads = ThreadPool::shared();
+	int blocks          = threads.size();
+	int rowsPerBlock    = height / blocks;
+	threads.run(blocks, [&](int t) {
+		int startY = t * rowsPerBlock;
+		int endY   = (t == blocks - 1) ? height : startY + rowsPerBlock;
+		fn(startY, endY);
+	});
+}
+
+// Run fn(index, tile) over all tiles on every render thread; each thread takes the next tile nobody has started,
+// so threads that get cheap tiles do not sit idle while another finishes an expensive band
+template<typename Fn>
+static void forEachTile(const std::vector<Tile> &tiles, Fn fn) {
+	ThreadPool::shared().run(int(tiles.size()), [&](int i) { fn(i, tiles[i]); });
+}
+
+// Seed of sample s of pixel p: each sample draws its own random numbers, whichever thread or round takes it
+static uint64_t sampleSeed(uint64_t seed, int p, uint32_t s) {
+	// splitmix64 finalizer
+	auto mix = [](uint64_t z) {
+		z += 0x9e3779b97f4a7c15ULL;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	};
+	return mix(seed ^ mix((uint64_t(p) << 32) | s));
+}
+
 /**
- * @brief 渲染指定范围的图像行。
+ * @brief 渲染图像的一个分块。
  *
- * 该函数用于在多线程环境下渲染图像的一部分行。它计算指定行范围内每个像素的颜色并更新帧缓冲区。
+ * 该函数用于在多线程环境下渲染图像的一部分。它为分块内每个像素再取若干个样本，累加到累积缓冲区。
+ * 像素已有的样本数记录在 features.samples 中，第 s 个样本总是使用同一组随机数，所以分几轮取样、
+ * 由哪个线程取样都不影响结果。
  *
- * @param startY 开始渲染的行索引（包含）。
- * @param endY 结束渲染的行索引（不包含）。
- * @param width 图像的宽度（像素）。
- * @param height 图像的高度（像素）。
+ * @param tile 要渲染的像素范围。
  * @param scene 要渲染的场景对象。
- * @param framebuffer 存储渲染结果的帧缓冲区。
- * @param spp 每像素的采样次数，用于抗锯齿。
- * @param m 像素计数器的引用（用于跟踪渲染进度）。
+ * @param accumulation 每个像素样本颜色之和。
+ * @param count 本轮每个像素最多增加的样本数，合计不超过 spp。
+ * @param record 为真时也追踪已经取满样本的像素的主光线，以记录它们第一个交点的特征。
  */
-void renderRows(int startY, int endY, int width, int height, const Scene &scene, std::vector<Vector3f> &framebuffer, int spp, int &m) {
-	float scale            = tan(deg2rad(scene.fov * 0.5));
-	float imageAspectRatio = width / (float) height;
-	Vector3f eye_pos(278, 273, -800);
-
-	for(int j = startY; j < endY; ++j) {
-		for(int i = 0; i < width; ++i) {
-			float x = (2 * (i + 0.5) / (float) width - 1) * imageAspectRatio * scale;
-			float y = (1 - 2 * (j + 0.5) / (float) height) * scale;
-
-			Vector3f dir = normalize(Vector3f(-x, y, 1));
-			for(int k = 0; k < spp; k++) {
-				framebuffer[j * width + i] += scene.castRay(Ray(eye_pos, dir), 0) / spp;
+void Renderer::sampleTile(const Tile &tile, const Scene &scene, std::vector<Vector3f> &accumulation, int count, bool record) {
+	constexpr int kPacket = RayPacket::kPacketSize;
+	int width             = scene.width;
+	size_t taken          = 0;
+
+	for(int j = tile.y0; j < tile.y1; ++j) {
+		// Primary rays of adjacent pixels are traced as one packet. Every sample of a pixel uses the same primary
+		// ray, so its first hit is found once and shared by all of the round's paths.
+		for(int i0 = tile.x0; i0 < tile.x1; i0 += kPacket) {
+			int n       = std::min(kPacket, tile.x1 - i0);
+			bool needed = record;
+			for(int k = 0; k < n && !needed; ++k)
+				needed = selected(j * width + i0 + k) && features.samples[j * width + i0 + k] < uint32_t(spp);
+			if(!needed)
+				continue;
+			Ray rays[kPacket];
+			Intersection hits[kPacket];
+			tracePrimaryRays(view, scene, j, i0, n, rays, hits);
+
+			for(int k = 0; k < n; ++k) {
+				int p = j * width + i0 + k;
+				recordFirstHit(scene, features, p, hits[k]);
+				uint32_t first = features.samples[p], last = selected(p) ? std::max(first, std::min<uint32_t>(spp, first + count)) : first;
+				for(uint32_t s = first; s < last; ++s) {
+					seed_random(sampleSeed(seed, p, s));
+					Vector3f L = scene.castRay(rays[k], 0, hits[k]);
+					features.addSample(p, L);
+					accumulation[p] += L;
+				}
+				taken += last - first;
 			}
 		}
+	}
 
-		// 使用互斥锁来保护进度更新
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			progress += 1 / (float) scene.height;
-			UpdateProgress(progress);
+	// 使用互斥锁来保护进度更新
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		progress += taken / (float(selectedPixels) * spp);
+		UpdateProgress(progress);
+	}
+}
+
+void Renderer::renderTile(const Scene &scene, const Tile &tile, std::vector<Vector3f> &pixels) {
+	size_t n = size_t(scene.width) * scene.height;
+	view     = camera;
+	view.setImage(scene.width, scene.height);
+	selection.clear();
+	selectedPixels = n;
+	if(features.samples.size() != n) {
+		features.resize(n);
+		tileAccumulation.assign(n, Vector3f(0.0f));
+	}
+	sampleTile(tile, scene, tileAccumulation, spp, true);
+	pixels.clear();
+	for(int y = tile.y0; y < tile.y1; ++y)
+		for(int x = tile.x0; x < tile.x1; ++x) {
+			int p = y * scene.width + x;
+			pixels.push_back(features.samples[p] ? tileAccumulation[p] / float(features.samples[p]) : Vector3f(0.0f));
 		}
+}
+
+void Renderer::renderReSTIR(const Scene &scene, std::vector<Vector3f> &accumulation) {
+	constexpr int kPacket = RayPacket::kPacketSize;
+	int width = scene.width, height = scene.height;
+	std::vector<Ray> rays(width * height);
+	std::vector<Intersection> hits(width * height);
+	forEachRowBlock(height, [&](int startY, int endY) {
+		for(int j = startY; j < endY; ++j)
+			for(int i0 = 0; i0 < width; i0 += kPacket)
+				tracePrimaryRays(view, scene, j, i0, std::min(kPacket, width - i0), &rays[j * width + i0], &hits[j * width + i0]);
+		for(int i = startY * width; i < endY * width; ++i)
+			recordFirstHit(scene, features, i, hits[i]);
+	});
+	// Pixels whose first hit is lit by the scene's emitters
+	auto shaded = [&](int i) { return hits[i].happened && !hits[i].m->hasEmission(); };
+
+	// Each pass resamples fresh candidates, merges the pixel's reservoir from the previous pass (the camera is
+	// fixed, so it belongs to the same hit) and then a few neighbours' reservoirs, and traces one shadow ray
+	std::vector<Reservoir> current(width * height), reused(width * height), previous(width * height);
+	float maxHistory = float(restir.maxHistory) * restir.candidates;
+	// Each of a pass's three steps draws a pixel's random numbers from its own seed, whichever thread takes the pixel
+	auto seedStep = [&](int p, int pass, uint32_t step) { seed_random(sampleSeed(seed, p, 3 * uint32_t(pass) + step)); };
+	for(int pass = 0; pass < spp; ++pass) {
+		forEachRowBlock(height, [&](int startY, int endY) {
+			for(int i = startY * width; i < endY * width; ++i) {
+				if(!shaded(i))
+					continue;
+				seedStep(i, pass, 0);
+				Reservoir r;
+				scene.sampleLights(rays[i], hits[i], restir.candidates, r);
+				if(restir.temporal && pass > 0 && previous[i].W > 0) {
+					Reservoir history = previous[i];
+					history.M         = std::min(history.M, maxHistory);
+					r.merge(history, history.pHat, get_random_float());
+				}
+				r.finalize();
+				// Visibility reuse: a sample that is occluded here is worthless to keep or hand on
+				if(r.W > 0) {
+					scene.lightStats.count(scene.lightStats.shadowRays);
+					if(!scene.visible(hits[i], r.y))
+						r.W = 0;
+				}
+				current[i] = r;
+			}
+		});
+
+		forEachRowBlock(height, [&](int startY, int endY) {
+			for(int j = startY; j < endY; ++j)
+				for(int i = 0; i < width; ++i) {
+					int p = j * width + i;
+					if(!shaded(p))
+						continue;
+					seedStep(p, pass, 1);
+					// Merge the pixel's own reservoir like the neighbours' so that one whose sample turned out
+					// occluded (W = 0) carries no weight
+					Reservoir r;
+					r.merge(current[p], current[p].pHat, get_random_float());
+					for(int k = 0; k < restir.spatialNeighbors; ++k) {
+						float radius = restir.spatialRadius * std::sqrt(get_random_float()), phi = 2 * M_PI * get_random_float();
+						int qi = i + int(std::lround(radius * std::cos(phi))), qj = j + int(std::lround(radius * std::sin(phi)));
+						if(qi < 0 || qi >= width || qj < 0 || qj >= height || (qi == i && qj == j))
+							continue;
+						int q = qj * width + qi;
+						// Only neighbours on a similar surface: the merge skips visibility, so reusing across
+						// geometric edges would bleed light (the usual bias of spatial reuse)
+						if(!shaded(q) || current[q].W <= 0 || dotProduct(hits[p].normal, hits[q].normal) < 0.9f ||
+						   std::fabs(hits[q].distance - hits[p].distance) > 0.1f * hits[p].distance)
+							continue;
+						r.merge(current[q], scene.targetPdf(rays[p], hits[p], current[q].y), get_random_float());
+					}
+					r.finalize();
+					reused[p] = r;
+				}
+		});
+
+		forEachRowBlock(height, [&](int startY, int endY) {
+			for(int i = startY * width; i < endY * width; ++i) {
+				seedStep(i, pass, 2);
+				Vector3f L = shaded(i) ? scene.shadeReservoir(rays[i], hits[i], reused[i]) + scene.indirectLight(rays[i], 0, hits[i])
+				                       : scene.castRay(rays[i], 0, hits[i]);
+				features.addSample(i, L);
+				accumulation[i] += L;
+			}
+		});
+		std::swap(previous, reused);
+		UpdateProgress((pass + 1) / (float) spp);
 	}
 }
 
+bool Renderer::selectRegion(const Scene &scene, std::vector<Vector3f> &framebuffer) {
+	size_t pixels = size_t(scene.width) * scene.height;
+	selection.clear();
+	selectedPixels = pixels;
+	if(!region.cropFits(scene.width, scene.height)) {
+		const Tile &crop = region.crop;
+		std::cerr << "Crop window " << crop.x0 << "," << crop.y0 << " - " << crop.x1 << "," << crop.y1 << " is empty or not inside the "
+		          << scene.width << "x" << scene.height << " image\n";
+		return false;
+	}
+	std::vector<float> data;
+	auto read = [&](const std::string &path) {
+		int width, height;
+		if(readImage(path, width, height, data) && width == scene.width && height == scene.height)
+			return true;
+		std::cerr << "Could not read " << path << " as a " << scene.width << "x" << scene.height << " .pfm or .ppm image\n";
+		return false;
+	};
+	if(!region.basePath.empty()) {
+		if(!read(region.basePath))
+			return false;
+		for(size_t p = 0; p < pixels; ++p)
+			framebuffer[p] = Vector3f(data[3 * p], data[3 * p + 1], data[3 * p + 2]);
+	}
+	if(!region.enabled())
+		return true;
+
+	selection.assign(pixels, 1);
+	if(!region.maskPath.empty()) {
+		if(!read(region.maskPath))
+			return false;
+		// Rendered where any channel is at least half on, which a black and white mask of any format gets right
+		for(size_t p = 0; p < pixels; ++p)
+			selection[p] = std::max({data[3 * p], data[3 * p + 1], data[3 * p + 2]}) >= 0.5f;
+	}
+	if(region.cropped())
+		for(int y = 0; y < scene.height; ++y)
+			for(int x = 0; x < scene.width; ++x)
+				if(x < region.crop.x0 || x >= region.crop.x1 || y < region.crop.y0 || y >= region.crop.y1)
+					selection[size_t(y) * scene.width + x] = 0;
+	selectedPixels = std::count(selection.begin(), selection.end(), 1);
+	std::cout << "Region: " << selectedPixels << " of " << pixels << " pixels\n";
+	return true;
+}
+
+void Renderer::denoiseImage(const Scene &scene, std::vector<Vector3f> &framebuffer) {
+	auto start = std::chrono::steady_clock::now();
+	Denoiser denoiser(framebuffer, features, scene.width, scene.height, view.pixelAngle(), denoise);
+	for(int iteration = 0; iteration < denoise.iterations; ++iteration) {
+		forEachRowBlock(scene.height, [&](int startY, int endY) { denoiser.filterRows(iteration, startY, endY); });
+		denoiser.nextPass();
+	}
+	denoiser.resolve(framebuffer);
+	auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("\nDenoise: %d passes, %.1f ms\n", denoise.iterations, ms);
+}
 
 // The main render function. This where we iterate over all pixels in the image,
 // generate primary rays and cast these rays into the scene. The content of the
 // framebuffer is saved to a file.
-void Renderer::Render(const Scene &scene) {
-	std::vector<Vector3f> framebuffer(scene.width * scene.height);
-	int spp = 16;
+bool Renderer::Render(const Scene &scene) {
+	size_t pixels = size_t(scene.width) * scene.height;
+	// Sums of each pixel's samples, and their means: the image
+	std::vector<Vector3f> accumulation(pixels), framebuffer(pixels);
+	features.resize(pixels);
+	view = camera;
+	view.setImage(scene.width, scene.height);
 	std::cout << "SPP: " << spp << "\n";
+	progress     = 0;
+	bool written = true;
 
-	int numThreads = std::thread::hardware_concurrency();
-	std::vector<std::thread> threads;
-	int rowsPerThread = scene.height / numThreads;
+	if(!selectRegion(scene, framebuffer))
+		return false;
+	if(restir.enabled && !selection.empty()) {
+		// Every ReSTIR pass resamples the whole image
+		std::cerr << "Regions are not supported with ReSTIR; rendering every pixel\n";
+		selection.clear();
+		selectedPixels = pixels;
+	}
 
-	int m = 0;
+	Checkpoint saved;
+	bool checkpointing = !checkpoint.path.empty();
+	if(checkpointing && restir.enabled) {
+		// Reservoirs carry state from pass to pass that a checkpoint does not hold
+		std::cerr << "Checkpoints are not supported with ReSTIR\n";
+		checkpointing = false;
+	}
+	if(checkpointing) {
+		bool opened = checkpoint.resume ? saved.open(checkpoint.path, scene.width, scene.height, seed)
+		                                : saved.create(checkpoint.path, scene.width, scene.height, seed);
+		if(!opened) {
+			std::cerr << "Could not " << (checkpoint.resume ? "resume from " : "create ") << checkpoint.path << "\n";
+			return false;
+		}
+		if(checkpoint.resume && saved.load(accumulation, features)) {
+			size_t taken = 0;
+			for(size_t p = 0; p < pixels; ++p) {
+				if(!selected(int(p)))
+					continue;
+				if(region.restart) {
+					accumulation[p]      = Vector3f(0.0f);
+					features.samples[p]  = 0;
+					features.lumSum[p]   = 0;
+					features.lumSqSum[p] = 0;
+				}
+				taken += std::min<uint32_t>(features.samples[p], spp);
+			}
+			progress = taken / (float(selectedPixels) * spp);
+			std::cout << "Resumed " << taken << " of " << selectedPixels * spp << " samples from " << checkpoint.path << "\n";
+			// Pixels outside the region keep the checkpoint's result rather than the base image's
+			for(size_t p = 0; p < pixels; ++p)
+				if(features.samples[p])
+					framebuffer[p] = accumulation[p] / float(features.samples[p]);
+		}
+	}
 
-	// 创建线程
-	for(int t = 0; t < numThreads; ++t) {
-		int startY = t * rowsPerThread;
-		int endY   = (t == numThreads - 1) ? scene.height : startY + rowsPerThread;
-		threads.emplace_back(renderRows, startY, endY, scene.width, scene.height, std::ref(scene), std::ref(framebuffer), spp, std::ref(m));
+	std::vector<Tile> tiles = makeTiles(scene.width, scene.height, tileSize);
+	// The tiles with pixels in the region, cut down to the crop window, and their indices in tiles
+	std::vector<Tile> regionTiles;
+	std::vector<int> regionIndex;
+	for(size_t i = 0; i < tiles.size(); ++i) {
+		Tile tile = tiles[i];
+		if(!selection.empty() && region.cropped())
+			tile = Tile{std::max(tile.x0, region.crop.x0), std::max(tile.y0, region.crop.y0), std::min(tile.x1, region.crop.x1),
+			            std::min(tile.y1, region.crop.y1)};
+		bool any = false;
+		for(int y = tile.y0; y < tile.y1 && !any; ++y)
+			for(int x = tile.x0; x < tile.x1 && !any; ++x)
+				any = selected(y * scene.width + x);
+		if(any) {
+			regionTiles.push_back(tile);
+			regionIndex.push_back(int(i));
+		}
+	}
+	TileFileWriter tileFile;
+	if(!tilePath.empty() && !tileFile.create(tilePath, scene.width, scene.height, tileSize)) {
+		std::cerr << "Could not create " << tilePath << "\n";
+		written = false;
 	}
+	std::mutex tileMutex;
+	auto finishTile = [&](int index, const Tile &tile) {
+		for(int y = tile.y0; y < tile.y1; ++y)
+			for(int x = tile.x0; x < tile.x1; ++x) {
+				// Pixels without samples keep the base image
+				int p = y * scene.width + x;
+				if(features.samples[p])
+					framebuffer[p] = accumulation[p] / float(features.samples[p]);
+			}
+		std::lock_guard<std::mutex> lock(tileMutex);
+		if(!tilePath.empty())
+			tileFile.append(index, tile, framebuffer);
+		if(onTileDone)
+			onTileDone(index, tile, framebuffer);
+	};
 
-	// 等待所有线程完成
-	for(auto &thread: threads) {
-		thread.join();
+	if(restir.enabled) {
+		// Every pass covers the whole image, so no tile is final before the last one
+		renderReSTIR(scene, accumulation);
+		for(size_t i = 0; i < tiles.size(); ++i)
+			finishTile(int(i), tiles[i]);
+	} else {
+		auto complete = [&](const Tile &tile) {
+			for(int y = tile.y0; y < tile.y1; ++y)
+				for(int x = tile.x0; x < tile.x1; ++x)
+					if(selected(y * scene.width + x) && features.samples[y * scene.width + x] < uint32_t(spp))
+						return false;
+			return true;
+		};
+		// With checkpoints the samples are taken in rounds over the whole image, with a chance to save after each
+		int round = checkpointing ? std::max(1, checkpoint.roundSamples) : spp;
+		std::vector<uint8_t> finished(regionTiles.size(), 0);
+		auto lastSave = std::chrono::steady_clock::now();
+		for(bool first = true, done = false; !done; first = false) {
+			forEachTile(regionTiles, [&](int k, const Tile &tile) {
+				sampleTile(tile, scene, accumulation, round, first);
+				if(!finished[k] && complete(tile)) {
+					finished[k] = 1;
+					finishTile(regionIndex[k], tiles[regionIndex[k]]);
+				}
+			});
+			done     = std::all_of(finished.begin(), finished.end(), [](uint8_t f) { return f != 0; });
+			auto now = std::chrono::steady_clock::now();
+			if(checkpointing && (done || std::chrono::duration<float>(now - lastSave).count() >= checkpoint.interval)) {
+				if(!saved.save(accumulation, features)) {
+					std::cerr << "Could not save the checkpoint to " << checkpoint.path << "\n";
+					written = false;
+				}
+				lastSave = now;
+			}
+		}
 	}
 
 	UpdateProgress(1.f);
+	if(!tileFile.close()) {
+		std::cerr << "Could not write " << tilePath << "\n";
+		written = false;
+	}
+
+	// The AOVs hold the image as rendered, before any denoising
+	if(writeAOVs && !features.write(aovPrefix, aovFormat, scene.width, scene.height, framebuffer)) {
+		std::cerr << "Could not write the AOV images\n";
+		written = false;
+	}
+
+	if(denoise.enabled) {
+		// Only the region is replaced; the rest of the image stays as it was
+		std::vector<Vector3f> kept = selection.empty() ? std::vector<Vector3f>() : framebuffer;
+		denoiseImage(scene, framebuffer);
+		for(size_t p = 0; p < kept.size(); ++p)
+			if(!selection[p])
+				framebuffer[p] = kept[p];
+	}
 
-	// 保存帧缓冲区到文件
-	FILE *fp = fopen("binary.ppm", "wb");
-	(void) fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-	for(auto i = 0; i < scene.height * scene.width; ++i) {
-		static unsigned char color[3];
-		color[0] = (unsigned char) (255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
-		color[1] = (unsigned char) (255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
-		color[2] = (unsigned char) (255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
-		fwrite(color, 1, 3, fp);
-	}
-	fclose(fp);
-}
\ No newline at end of file
+	// 保存帧缓冲区到文件：按行块交给写出器，大图像不需要整幅再复制一份
+	std::unique_ptr<ImageWriter> writer = makeImageWriter(outputPath);
+	if(!writer || !writer->open(outputPath, scene.width, scene.height, 3)) {
+		std::cerr << "Could not write " << outputPath << "\n";
+		return false;
+	}
+	constexpr int kRowBlock = 64;
+	const float *image      = reinterpret_cast<const float *>(framebuffer.data());
+	for(int y = 0; y < scene.height; y += kRowBlock)
+		writer->writeRows(image + size_t(y) * scene.width * 3, std::min(kRowBlock, scene.height - y));
+	if(!writer->close()) {
+		std::cerr << "Could not write " << outputPath << "\n";
+		return false;
+	}
+	return written;
+}
+
+int Renderer::RenderViews(const Scene &scene, const std::vector<View> &views) const {
+	int written = 0;
+	for(size_t v = 0; v < views.size(); ++v) {
+		// Every view is rendered by a copy of these settings with its own camera and outputs
+		std::string index        = std::to_string(v);
+		Renderer renderer        = *this;
+		renderer.camera          = views[v].camera;
+		renderer.outputPath      = views[v].outputPath;
+		renderer.aovPrefix       = aovPrefix + index + "_";
+		renderer.tilePath        = tilePath.empty() ? "" : tilePath + "." + index;
+		renderer.checkpoint.path = checkpoint.path.empty() ? "" : checkpoint.path + "." + index;
+		auto start               = std::chrono::steady_clock::now();
+		bool ok                  = renderer.Render(scene);
+		double ms                = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("\nView %zu/%zu: %s, %.1f ms\n", v + 1, views.size(), renderer.outputPath.c_str(), ms);
+		written += ok;
+	}
+	return written;
+}
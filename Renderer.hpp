@@ -1,7 +1,12 @@
 //
 // Created by goksu on 2/25/20.
 //
+#include "Camera.hpp"
+#include "Checkpoint.hpp"
+#include "Denoiser.hpp"
 #include "Scene.hpp"
+#include "TileFile.hpp"
+#include <functional>
 
 #pragma once
 struct hit_payload {
@@ -11,9 +16,116 @@ struct hit_payload {
 	Object *hit_obj;
 };
 
+/**
+ * @brief 主光线交点处基于蓄水池重采样（ReSTIR）的直接光照设置。
+ *
+ * 每个像素每一遍从 candidates 个光源样本中重采样出一个，再与上一遍同一像素（时间复用）
+ * 和附近若干像素（空间复用）的蓄水池合并，最后只对选中的样本追踪一条阴影光线。
+ * 合并前先检查各像素自身样本的可见性，被遮挡的样本不再传给其他像素。
+ * 相机固定时各遍结果会被平均，较长的时间历史使各遍高度相关、反而增大误差，因此时间复用默认关闭。
+ */
+struct ReSTIROptions {
+	bool enabled         = false;
+	int candidates       = 32;   // light samples resampled per pixel and pass
+	bool temporal        = false;// merge the pixel's reservoir from the previous pass
+	int maxHistory       = 20;   // cap on the previous pass's candidate count, in multiples of candidates
+	int spatialNeighbors = 5;    // neighbouring reservoirs merged per pass (0 = no spatial reuse)
+	int spatialRadius    = 8;    // in pixels
+};
+
+/**
+ * @brief 检查点设置。
+ *
+ * 开启后每轮只给每个像素增加 roundSamples 个样本，轮与轮之间距上次保存超过 interval 秒就保存一次，
+ * 渲染结束时再保存一次；被中断的渲染可以从最后一次保存处继续。
+ */
+struct CheckpointOptions {
+	std::string path;       // checkpoint file; empty: no checkpoints
+	bool resume      = false;// continue the render saved in path instead of starting over
+	int roundSamples = 4;    // samples added to each pixel between two chances to save
+	float interval   = 60;   // seconds between saves
+};
+
+/**
+ * @brief 局部重渲染：只追踪裁剪窗口内、且被掩码选中的像素。
+ *
+ * 其余像素不再渲染：续渲染检查点时保留检查点中的结果，否则取 basePath 指定的已有图像（没有则为黑色），
+ * 选中像素的新结果合并进去后一起写出，检查点也照常保存整幅图像的状态。渲染代价与选中的像素数成正比。
+ */
+struct RegionOptions {
+	Tile crop = {0, 0, 0, 0};// pixels [x0, x1) x [y0, y1) to render; all zero: the whole image
+	std::string maskPath;    // image (.pfm or .ppm) whose pixels with a channel >= 0.5 are rendered; empty: every pixel
+	std::string basePath;    // image (.pfm or .ppm) the pixels outside the region are taken from
+	bool restart = false;    // drop the samples a resumed checkpoint holds for the region and render it afresh
+
+	bool cropped() const { return crop.x0 || crop.y0 || crop.x1 || crop.y1; }
+	// Whether the crop window, if there is one, holds pixels and lies inside a width x height image
+	bool cropFits(int width, int height) const {
+		return !cropped() || (crop.x0 >= 0 && crop.y0 >= 0 && crop.x0 < crop.x1 && crop.y0 < crop.y1 && crop.x1 <= width && crop.y1 <= height);
+	}
+	// Whether some pixels may be left out
+	bool enabled() const { return cropped() || !maskPath.empty(); }
+};
+
 class Renderer {
 public:
-	void Render(const Scene &scene);
+	// One view of a batch: the camera and the image it writes
+	struct View {
+		Camera camera;
+		std::string outputPath;
+	};
+
+	// Render the scene and write the output; false if anything could not be written
+	bool Render(const Scene &scene);
+	// Render the scene from every view in turn, each with Render's settings but its own camera and output. The scene,
+	// with its BVHs and light structures, and the render threads are set up once and serve every view. AOVs get the
+	// view's index after their prefix, tile and checkpoint files after their name. The number of views written.
+	int RenderViews(const Scene &scene, const std::vector<View> &views) const;
+	// Render one tile by itself, on the calling thread: pixels receives its rows, every pixel the mean of spp samples,
+	// exactly as Render would compute them. Tile farm workers render their tiles with it.
+	void renderTile(const Scene &scene, const Tile &tile, std::vector<Vector3f> &pixels);
+
+	Camera camera;
+	int spp = 16;
+	// Seed of the path tracer's random numbers, which are drawn per pixel and sample (per pixel and pass with ReSTIR):
+	// renders with the same seed are identical whatever the number of threads, the tile size or the interruptions
+	uint64_t seed = 0;
+	CheckpointOptions checkpoint;
+	RegionOptions region;
+	ReSTIROptions restir;
+	DenoiseOptions denoise;
+	// Output image; the extension picks the format: .ppm (tonemapped), .pfm or .exr (linear float)
+	std::string outputPath = "binary.ppm";
+	// Also write the linear image and the AOVs recorded at the primary hits as float images, <aovPrefix><name><aovFormat>
+	bool writeAOVs        = false;
+	std::string aovPrefix = "aov_";
+	std::string aovFormat = ".pfm";
+	// Edge of the square tiles the image is rendered in; render threads take the next unstarted tile from a shared queue
+	int tileSize = 32;
+	// Called once per tile, as soon as its pixels in the framebuffer are final. Calls are serialized but made on the
+	// render threads, so the other threads keep rendering while one of them hands off a tile.
+	std::function<void(int index, const Tile &tile, const std::vector<Vector3f> &framebuffer)> onTileDone;
+	// Append every finished tile to this tile file (see TileFileWriter), so that the finished part of a long render
+	// is on disk before the render ends
+	std::string tilePath;
 
 private:
+	// Take up to count more samples (but no more than spp in all) in each pixel of tile, adding them to
+	// accumulation; trace the primary rays of pixels that need no samples too if record, to record their features
+	void sampleTile(const Tile &tile, const Scene &scene, std::vector<Vector3f> &accumulation, int count, bool record);
+	// Render spp passes with reservoir reuse at the primary hits, adding the samples to accumulation
+	void renderReSTIR(const Scene &scene, std::vector<Vector3f> &accumulation);
+	// Set selection to the pixels region selects in a scene.width x scene.height image, and framebuffer to the base
+	// image; false if the crop window is empty or not inside the image, or the mask or the base image cannot be read or
+	// has another size
+	bool selectRegion(const Scene &scene, std::vector<Vector3f> &framebuffer);
+	bool selected(int pixel) const { return selection.empty() || selection[pixel]; }
+	// Filter the rendered image in place, guided by the features recorded at the primary hits
+	void denoiseImage(const Scene &scene, std::vector<Vector3f> &framebuffer);
+
+	Camera view;// camera, set up for the image being rendered
+	FeatureBuffers features;
+	std::vector<uint8_t> selection;// pixels that get samples; empty: all of them
+	size_t selectedPixels = 0;
+	std::vector<Vector3f> tileAccumulation;// sums of the samples renderTile took, image-sized
 };
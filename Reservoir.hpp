@@ -0,0 +1,46 @@
+//
+// Weighted reservoir for resampled importance sampling (RIS) of direct lighting.
+//
+
+#ifndef RAYTRACING_RESERVOIR_H
+#define RAYTRACING_RESERVOIR_H
+
+#include "Intersection.hpp"
+
+/**
+ * @brief 单样本加权蓄水池。
+ *
+ * 候选光源样本以权重 w = pHat / pdf 流式加入，每个候选以 w / wSum 的概率替换当前样本，
+ * 因此最终留下的样本 y 近似按目标分布 pHat（未遮挡的直接光照贡献）分布。
+ * finalize 之后 W = wSum / (M * pHat(y)) 是 y 的无偏贡献权重，直接光照估计为 f(y) * W，只需一条阴影光线。
+ * 两个蓄水池可以合并（时间 / 空间复用），合并后 M 为两者候选数之和。
+ */
+struct Reservoir {
+	Intersection y;// the chosen light sample
+	float pHat = 0;// target density of y at the shading point that owns the reservoir
+	float wSum = 0;// sum of the resampling weights seen
+	float M    = 0;// candidates seen, including those with zero weight
+	float W    = 0;// contribution weight of y, set by finalize
+
+	// Stream in candidate x with weight w; u is uniform in [0, 1). Returns whether x replaced the current sample.
+	bool update(const Intersection &x, float w, float pHatX, float u) {
+		wSum += w;
+		M += 1;
+		if(w > 0 && u * wSum < w) {
+			y    = x;
+			pHat = pHatX;
+			return true;
+		}
+		return false;
+	}
+	// Merge another reservoir whose sample has target density pHatHere at this shading point
+	bool merge(const Reservoir &r, float pHatHere, float u) {
+		float m     = M;
+		bool chosen = update(r.y, pHatHere * r.W * r.M, pHatHere, u);
+		M           = m + r.M;
+		return chosen;
+	}
+	void finalize() { W = pHat > 0 ? wSum / (M * pHat) : 0; }
+};
+
+#endif//RAYTRACING_RESERVOIR_H
@@ -0,0 +1,129 @@
+#include "SIMD.hpp"
+#include <cmath>
+
+namespace {
+	// Reference kernels, one ray at a time, for CPUs (or runs) without a vector ISA
+	uint32_t intersectBoxScalar(const float bounds[2][3], const RayPacket &packet, uint32_t active) {
+		constexpr float kExitScale = 1 + 2 * (3 * 0.5f * std::numeric_limits<float>::epsilon());
+		uint32_t result            = 0;
+		for(int i = 0; i < RayPacket::kPacketSize; ++i) {
+			if(!(active >> i & 1))
+				continue;
+			const float o[3] = {packet.origin.x[i], packet.origin.y[i], packet.origin.z[i]};
+			const float d[3] = {packet.invDir.x[i], packet.invDir.y[i], packet.invDir.z[i]};
+			float tEnter = packet.tMin[i], tExit = packet.tMax[i];
+			for(int axis = 0; axis < 3; ++axis) {
+				float tNear = (bounds[0][axis] - o[axis]) * d[axis];
+				float tFar  = (bounds[1][axis] - o[axis]) * d[axis];
+				tEnter      = std::max(tEnter, std::min(tNear, tFar));
+				tExit       = std::min(tExit, std::max(tNear, tFar) * kExitScale);
+			}
+			result |= uint32_t(tEnter <= tExit) << i;
+		}
+		return result;
+	}
+
+	uint32_t intersectTriangleScalar(const PacketTriangle &tri, RayPacket &packet, uint32_t active) {
+		Vector3f v0(tri.v0[0], tri.v0[1], tri.v0[2]), e1(tri.e1[0], tri.e1[1], tri.e1[2]), e2(tri.e2[0], tri.e2[1], tri.e2[2]);
+		Vector3f normal(tri.normal[0], tri.normal[1], tri.normal[2]);
+		uint32_t result = 0;
+		for(int i = 0; i < RayPacket::kPacketSize; ++i) {
+			if(!(active >> i & 1))
+				continue;
+			Vector3f d = packet.direction.get(i);
+			if(dotProduct(d, normal) > 0)
+				continue;
+			Vector3f pvec = crossProduct(d, e2);
+			float det     = dotProduct(e1, pvec);
+			if(std::fabs(det) < tri.epsilon)
+				continue;
+			float detInv  = 1 / det;
+			Vector3f tvec = packet.origin.get(i) - v0;
+			float u       = dotProduct(tvec, pvec) * detInv;
+			if(u < 0 || u > 1)
+				continue;
+			Vector3f qvec = crossProduct(tvec, e1);
+			float v       = dotProduct(d, qvec) * detInv;
+			if(v < 0 || u + v > 1)
+				continue;
+			float t = dotProduct(e2, qvec) * detInv;
+			if(t > packet.tMin[i] && t < packet.tMax[i]) {
+				packet.tMax[i] = t;
+				packet.u[i]    = u;
+				packet.v[i]    = v;
+				result |= 1u << i;
+			}
+		}
+		return result;
+	}
+
+	void normalizeScalar(float *x, float *y, float *z, int n) {
+		for(int i = 0; i < n; ++i) {
+			Vector3f v = normalize(Vector3f(x[i], y[i], z[i]));
+			x[i]       = v.x;
+			y[i]       = v.y;
+			z[i]       = v.z;
+		}
+	}
+
+	void quantizeScalar(const float *in, uint16_t *out, int n) {
+		for(int i = 0; i < n; ++i) {
+			float x = in[i] > 0 ? std::min(in[i], 1.0f) : 0;
+			out[i]  = uint16_t(x * 65535 + 0.5f);
+		}
+	}
+
+	bool supported(SimdISA isa) {
+		switch(isa) {
+			case SimdISA::AVX512:
+				return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+			case SimdISA::AVX2:
+				return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+			case SimdISA::SSE42:
+				return __builtin_cpu_supports("sse4.2");
+			default:
+				return true;
+		}
+	}
+
+	const SimdKernels &kernelsFor(SimdISA isa) {
+		switch(isa) {
+			case SimdISA::AVX512:
+				return kAVX512Kernels;
+			case SimdISA::AVX2:
+				return kAVX2Kernels;
+			case SimdISA::SSE42:
+				return kSSE42Kernels;
+			default:
+				return kScalarKernels;
+		}
+	}
+
+	const SimdKernels *selected = nullptr;
+}// namespace
+
+const SimdKernels kScalarKernels = {SimdISA::Scalar, "scalar", 1, intersectBoxScalar, intersectTriangleScalar, normalizeScalar,
+                                    quantizeScalar};
+
+SimdISA detectSimdISA() {
+	for(SimdISA isa: {SimdISA::AVX512, SimdISA::AVX2, SimdISA::SSE42})
+		if(supported(isa))
+			return isa;
+	return SimdISA::Scalar;
+}
+
+const SimdKernels &simdKernels() {
+	// Detected once, before any render threads start
+	static const SimdKernels &detected = kernelsFor(detectSimdISA());
+	return selected ? *selected : detected;
+}
+
+bool selectSimdISA(const std::string &name) {
+	for(SimdISA isa: {SimdISA::Scalar, SimdISA::SSE42, SimdISA::AVX2, SimdISA::AVX512}) {
+		if(kernelsFor(isa).name == name && supported(isa)) {
+			selected = &kernelsFor(isa);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,99 @@
+//
+// SIMD math layer: SoA ray packets and batched kernels picked for the CPU at run time.
+//
+
+#ifndef RAYTRACING_SIMD_H
+#define RAYTRACING_SIMD_H
+
+#include "Ray.hpp"
+#include "Vector.hpp"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief N 个三维向量的 SoA（结构数组转数组结构）存储，供批量内核逐通道处理。
+ */
+template<int N>
+struct alignas(4 * N) Vec3xN {
+	float x[N], y[N], z[N];
+
+	Vector3f get(int i) const { return Vector3f(x[i], y[i], z[i]); }
+	void set(int i, const Vector3f &v) {
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+};
+using Vec3x8 = Vec3xN<8>;
+
+/**
+ * @brief 一组（最多 kPacketSize 条）一起遍历的光线，按 SoA 存放。
+ *
+ * 与 Ray 一样，tMax 在遍历中被裁剪到每条光线目前最近的交点。哪些通道有效由调用方以位掩码给出。
+ */
+struct RayPacket {
+	static constexpr int kPacketSize = 8;
+	Vec3x8 origin, direction, invDir;
+	alignas(32) float tMin[kPacketSize];
+	alignas(32) float tMax[kPacketSize];
+	alignas(32) float u[kPacketSize];// barycentrics of the latest triangle hit, written with tMax
+	alignas(32) float v[kPacketSize];
+
+	void set(int i, const Ray &ray) {
+		origin.set(i, ray.origin);
+		direction.set(i, ray.direction);
+		invDir.set(i, ray.direction_inv);
+		tMin[i] = ray.tMin;
+		tMax[i] = ray.tMax;
+	}
+	Ray ray(int i) const {
+		Ray r(origin.get(i), direction.get(i));
+		r.tMin = tMin[i];
+		r.tMax = tMax[i];
+		return r;
+	}
+};
+
+// Triangle as the packet kernel reads it; hits need det beyond epsilon and a front-facing normal
+struct PacketTriangle {
+	float v0[3], e1[3], e2[3], normal[3];
+	float epsilon;
+};
+
+enum class SimdISA { Scalar,
+	                 SSE42,
+	                 AVX2,
+	                 AVX512 };
+
+/**
+ * @brief 一套针对某一指令集编译的批量内核。
+ *
+ * 每个指令集的实现位于单独的翻译单元（SIMD_sse42.cpp 等），以对应的 -m 选项编译，
+ * 运行时根据 CPU 支持情况选用其中最宽的一套。
+ */
+struct SimdKernels {
+	SimdISA isa;
+	const char *name;
+	int lanes;// floats per register
+	// Slab test of one box against the active rays; returns those that overlap it within [tMin, tMax]
+	uint32_t (*intersectBox)(const float bounds[2][3], const RayPacket &packet, uint32_t active);
+	// Moller-Trumbore test of one triangle against the active rays; rays that hit it before tMax get tMax = t
+	// and the hit's barycentrics in u, v, and are returned
+	uint32_t (*intersectTriangle)(const PacketTriangle &tri, RayPacket &packet, uint32_t active);
+	// Normalize n vectors stored as SoA arrays, in place (zero vectors are left alone)
+	void (*normalize)(float *x, float *y, float *z, int n);
+	// Clamp n floats to [0, 1] (NaN to 0) and convert them to 16-bit fixed point, rounding to nearest
+	void (*quantize)(const float *in, uint16_t *out, int n);
+};
+
+// Widest instruction set this CPU supports
+SimdISA detectSimdISA();
+// Kernels in use: the detected ISA unless selectSimdISA chose another one
+const SimdKernels &simdKernels();
+// Use the kernels for "scalar", "sse4.2", "avx2" or "avx512"; false if unknown or unsupported by this CPU
+bool selectSimdISA(const std::string &name);
+
+// Per-ISA tables, defined in their own translation units
+extern const SimdKernels kScalarKernels, kSSE42Kernels, kAVX2Kernels, kAVX512Kernels;
+
+#endif//RAYTRACING_SIMD_H
@@ -0,0 +1,141 @@
+//
+// Batched kernels written once against a register abstraction and instantiated per instruction set.
+//
+// Only the SIMD_*.cpp translation units include this file, each compiled with its own -m flags and instantiating
+// the kernels with an Ops type from its anonymous namespace, which gives every instantiation internal linkage.
+// Kernels must not call inline functions from other headers: the linker could otherwise keep an AVX-512 copy of
+// one for code that has to run on any CPU.
+//
+
+#ifndef RAYTRACING_SIMDKERNELS_H
+#define RAYTRACING_SIMDKERNELS_H
+
+#include "SIMD.hpp"
+#include <limits>
+
+/*
+ * Ops provides, for one register type V with Ops::kLanes floats and its lane mask type M:
+ *   load, store (aligned), loadu, storeu, set1, add, sub, mul, div, min, max, sqrt, abs
+ *   storeU16 (rounds each lane to the nearest integer and stores it as a saturated uint16)
+ *   lt, le, gt (-> M), andMask, orMask, select(M, ifTrue, ifFalse), bits(M) -> uint32_t, mask(uint32_t) -> M
+ */
+
+// Exit distances are widened by 2 * gamma(3), as in the scalar slab test
+constexpr float kPacketExitScale = 1 + 2 * (3 * 0.5f * std::numeric_limits<float>::epsilon());
+
+template<typename Ops>
+uint32_t intersectBoxKernel(const float bounds[2][3], const RayPacket &packet, uint32_t active) {
+	using V           = typename Ops::V;
+	const V exitScale = Ops::set1(kPacketExitScale);
+	uint32_t result   = 0;
+	for(int base = 0; base < RayPacket::kPacketSize; base += Ops::kLanes) {
+		uint32_t lanes = (active >> base) & ((1u << Ops::kLanes) - 1);
+		if(!lanes)
+			continue;
+		V tEnter             = Ops::load(packet.tMin + base);
+		V tExit              = Ops::load(packet.tMax + base);
+		const float *o[3]    = {packet.origin.x + base, packet.origin.y + base, packet.origin.z + base};
+		const float *inv[3]  = {packet.invDir.x + base, packet.invDir.y + base, packet.invDir.z + base};
+		for(int axis = 0; axis < 3; ++axis) {
+			V org    = Ops::load(o[axis]);
+			V invDir = Ops::load(inv[axis]);
+			V tNear  = Ops::mul(Ops::sub(Ops::set1(bounds[0][axis]), org), invDir);
+			V tFar   = Ops::mul(Ops::sub(Ops::set1(bounds[1][axis]), org), invDir);
+			tEnter   = Ops::max(tEnter, Ops::min(tNear, tFar));
+			tExit    = Ops::min(tExit, Ops::mul(Ops::max(tNear, tFar), exitScale));
+		}
+		result |= (Ops::bits(Ops::le(tEnter, tExit)) & lanes) << base;
+	}
+	return result;
+}
+
+template<typename Ops>
+uint32_t intersectTriangleKernel(const PacketTriangle &tri, RayPacket &packet, uint32_t active) {
+	using V           = typename Ops::V;
+	using M           = typename Ops::M;
+	const V zero      = Ops::set1(0), one = Ops::set1(1), eps = Ops::set1(tri.epsilon);
+	const V v0[3]     = {Ops::set1(tri.v0[0]), Ops::set1(tri.v0[1]), Ops::set1(tri.v0[2])};
+	const V e1[3]     = {Ops::set1(tri.e1[0]), Ops::set1(tri.e1[1]), Ops::set1(tri.e1[2])};
+	const V e2[3]     = {Ops::set1(tri.e2[0]), Ops::set1(tri.e2[1]), Ops::set1(tri.e2[2])};
+	const V normal[3] = {Ops::set1(tri.normal[0]), Ops::set1(tri.normal[1]), Ops::set1(tri.normal[2])};
+	uint32_t result   = 0;
+	for(int base = 0; base < RayPacket::kPacketSize; base += Ops::kLanes) {
+		uint32_t lanes = (active >> base) & ((1u << Ops::kLanes) - 1);
+		if(!lanes)
+			continue;
+		V d[3] = {Ops::load(packet.direction.x + base), Ops::load(packet.direction.y + base), Ops::load(packet.direction.z + base)};
+		V o[3] = {Ops::load(packet.origin.x + base), Ops::load(packet.origin.y + base), Ops::load(packet.origin.z + base)};
+
+		// Back faces are culled, like the scalar test
+		V facing = Ops::add(Ops::add(Ops::mul(d[0], normal[0]), Ops::mul(d[1], normal[1])), Ops::mul(d[2], normal[2]));
+		M hit    = Ops::andMask(Ops::mask(lanes), Ops::le(facing, zero));
+
+		V pvec[3] = {Ops::sub(Ops::mul(d[1], e2[2]), Ops::mul(d[2], e2[1])),
+		             Ops::sub(Ops::mul(d[2], e2[0]), Ops::mul(d[0], e2[2])),
+		             Ops::sub(Ops::mul(d[0], e2[1]), Ops::mul(d[1], e2[0]))};
+		V det     = Ops::add(Ops::add(Ops::mul(e1[0], pvec[0]), Ops::mul(e1[1], pvec[1])), Ops::mul(e1[2], pvec[2]));
+		hit       = Ops::andMask(hit, Ops::le(eps, Ops::abs(det)));
+		V detInv  = Ops::div(one, det);
+
+		V tvec[3] = {Ops::sub(o[0], v0[0]), Ops::sub(o[1], v0[1]), Ops::sub(o[2], v0[2])};
+		V u       = Ops::mul(Ops::add(Ops::add(Ops::mul(tvec[0], pvec[0]), Ops::mul(tvec[1], pvec[1])), Ops::mul(tvec[2], pvec[2])), detInv);
+		hit       = Ops::andMask(hit, Ops::andMask(Ops::le(zero, u), Ops::le(u, one)));
+
+		V qvec[3] = {Ops::sub(Ops::mul(tvec[1], e1[2]), Ops::mul(tvec[2], e1[1])),
+		             Ops::sub(Ops::mul(tvec[2], e1[0]), Ops::mul(tvec[0], e1[2])),
+		             Ops::sub(Ops::mul(tvec[0], e1[1]), Ops::mul(tvec[1], e1[0]))};
+		V v       = Ops::mul(Ops::add(Ops::add(Ops::mul(d[0], qvec[0]), Ops::mul(d[1], qvec[1])), Ops::mul(d[2], qvec[2])), detInv);
+		hit       = Ops::andMask(hit, Ops::andMask(Ops::le(zero, v), Ops::le(Ops::add(u, v), one)));
+
+		V t    = Ops::mul(Ops::add(Ops::add(Ops::mul(e2[0], qvec[0]), Ops::mul(e2[1], qvec[1])), Ops::mul(e2[2], qvec[2])), detInv);
+		V tMin = Ops::load(packet.tMin + base), tMax = Ops::load(packet.tMax + base);
+		hit    = Ops::andMask(hit, Ops::andMask(Ops::gt(t, tMin), Ops::lt(t, tMax)));
+
+		Ops::store(packet.tMax + base, Ops::select(hit, t, tMax));
+		Ops::store(packet.u + base, Ops::select(hit, u, Ops::load(packet.u + base)));
+		Ops::store(packet.v + base, Ops::select(hit, v, Ops::load(packet.v + base)));
+		result |= Ops::bits(hit) << base;
+	}
+	return result;
+}
+
+template<typename Ops>
+void normalizeKernel(float *x, float *y, float *z, int n) {
+	using V = typename Ops::V;
+	int i   = 0;
+	for(; i + Ops::kLanes <= n; i += Ops::kLanes) {
+		V vx = Ops::loadu(x + i), vy = Ops::loadu(y + i), vz = Ops::loadu(z + i);
+		V mag2 = Ops::add(Ops::add(Ops::mul(vx, vx), Ops::mul(vy, vy)), Ops::mul(vz, vz));
+		// 1 / sqrt, then multiply, as the scalar normalize does
+		typename Ops::M valid = Ops::gt(mag2, Ops::set1(0));
+		V invMag              = Ops::select(valid, Ops::div(Ops::set1(1), Ops::sqrt(mag2)), Ops::set1(1));
+		Ops::storeu(x + i, Ops::mul(vx, invMag));
+		Ops::storeu(y + i, Ops::mul(vy, invMag));
+		Ops::storeu(z + i, Ops::mul(vz, invMag));
+	}
+	for(; i < n; ++i) {
+		float mag2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+		if(mag2 > 0) {
+			float invMag = 1 / __builtin_sqrtf(mag2);
+			x[i] *= invMag;
+			y[i] *= invMag;
+			z[i] *= invMag;
+		}
+	}
+}
+
+template<typename Ops>
+void quantizeKernel(const float *in, uint16_t *out, int n) {
+	using V      = typename Ops::V;
+	const V zero = Ops::set1(0), one = Ops::set1(1), scale = Ops::set1(65535);
+	int i        = 0;
+	// max returns its second operand for NaN lanes
+	for(; i + Ops::kLanes <= n; i += Ops::kLanes)
+		Ops::storeU16(out + i, Ops::mul(Ops::min(Ops::max(Ops::loadu(in + i), zero), one), scale));
+	for(; i < n; ++i) {
+		float x = in[i] > 0 ? (in[i] < 1 ? in[i] : 1) : 0;
+		out[i]  = uint16_t(x * 65535 + 0.5f);
+	}
+}
+
+#endif//RAYTRACING_SIMDKERNELS_H
@@ -0,0 +1,46 @@
+//
+// AVX2 kernels: 8 lanes, one register per packet. Compiled with -mavx2 -mfma.
+//
+
+#include "SIMDKernels.hpp"
+#include <immintrin.h>
+
+namespace {
+	struct OpsAVX2 {
+		using V                   = __m256;
+		using M                   = __m256;
+		static constexpr int kLanes = 8;
+
+		static V load(const float *p) { return _mm256_load_ps(p); }
+		static void store(float *p, V a) { _mm256_store_ps(p, a); }
+		static V loadu(const float *p) { return _mm256_loadu_ps(p); }
+		static void storeu(float *p, V a) { _mm256_storeu_ps(p, a); }
+		static V set1(float f) { return _mm256_set1_ps(f); }
+		static V add(V a, V b) { return _mm256_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+		static V div(V a, V b) { return _mm256_div_ps(a, b); }
+		static V min(V a, V b) { return _mm256_min_ps(a, b); }
+		static V max(V a, V b) { return _mm256_max_ps(a, b); }
+		static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+		static void storeU16(uint16_t *p, V a) {
+			__m256i i = _mm256_cvtps_epi32(a);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+		}
+		static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+		static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static M le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		static M gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static M andMask(M a, M b) { return _mm256_and_ps(a, b); }
+		static M orMask(M a, M b) { return _mm256_or_ps(a, b); }
+		static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+		static uint32_t bits(M m) { return _mm256_movemask_ps(m); }
+		static M mask(uint32_t bits) {
+			__m256i lane = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+			return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane), lane));
+		}
+	};
+}// namespace
+
+const SimdKernels kAVX2Kernels = {SimdISA::AVX2, "avx2", OpsAVX2::kLanes, intersectBoxKernel<OpsAVX2>,
+                                  intersectTriangleKernel<OpsAVX2>, normalizeKernel<OpsAVX2>, quantizeKernel<OpsAVX2>};
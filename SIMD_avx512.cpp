@@ -0,0 +1,63 @@
+//
+// AVX-512 kernels. Packets use 8-lane registers with AVX-512VL mask registers instead of blend vectors; batch
+// normalization and quantization run 16 lanes wide. Compiled with -mavx512f -mavx512vl.
+//
+
+#include "SIMDKernels.hpp"
+#include <immintrin.h>
+
+namespace {
+	struct Ops256 {
+		using V                   = __m256;
+		using M                   = __mmask8;
+		static constexpr int kLanes = 8;
+
+		static V load(const float *p) { return _mm256_load_ps(p); }
+		static void store(float *p, V a) { _mm256_store_ps(p, a); }
+		static V loadu(const float *p) { return _mm256_loadu_ps(p); }
+		static void storeu(float *p, V a) { _mm256_storeu_ps(p, a); }
+		static V set1(float f) { return _mm256_set1_ps(f); }
+		static V add(V a, V b) { return _mm256_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+		static V div(V a, V b) { return _mm256_div_ps(a, b); }
+		static V min(V a, V b) { return _mm256_min_ps(a, b); }
+		static V max(V a, V b) { return _mm256_max_ps(a, b); }
+		static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+		static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+		static M lt(V a, V b) { return _mm256_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		static M le(V a, V b) { return _mm256_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+		static M gt(V a, V b) { return _mm256_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+		static M andMask(M a, M b) { return a & b; }
+		static M orMask(M a, M b) { return a | b; }
+		static V select(M m, V a, V b) { return _mm256_mask_blend_ps(m, b, a); }
+		static uint32_t bits(M m) { return m; }
+		static M mask(uint32_t bits) { return M(bits); }
+	};
+
+	struct Ops512 {
+		using V                   = __m512;
+		using M                   = __mmask16;
+		static constexpr int kLanes = 16;
+
+		static V loadu(const float *p) { return _mm512_loadu_ps(p); }
+		static void storeu(float *p, V a) { _mm512_storeu_ps(p, a); }
+		static V set1(float f) { return _mm512_set1_ps(f); }
+		static V add(V a, V b) { return _mm512_add_ps(a, b); }
+		static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+		static V div(V a, V b) { return _mm512_div_ps(a, b); }
+		// Zero-masked forms: GCC's unmasked intrinsics trip -Wmaybe-uninitialized on their undefined pass-through
+		static V min(V a, V b) { return _mm512_maskz_min_ps(0xFFFF, a, b); }
+		static V max(V a, V b) { return _mm512_maskz_max_ps(0xFFFF, a, b); }
+		static V sqrt(V a) { return _mm512_maskz_sqrt_ps(0xFFFF, a); }
+		static void storeU16(uint16_t *p, V a) {
+			__m512i i = _mm512_maskz_cvtps_epi32(0xFFFF, a);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm512_maskz_cvtusepi32_epi16(0xFFFF, i));
+		}
+		static M gt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+		static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+	};
+}// namespace
+
+const SimdKernels kAVX512Kernels = {SimdISA::AVX512, "avx512", Ops512::kLanes, intersectBoxKernel<Ops256>,
+                                    intersectTriangleKernel<Ops256>, normalizeKernel<Ops512>, quantizeKernel<Ops512>};
@@ -0,0 +1,46 @@
+//
+// SSE4.2 kernels: 4 lanes, a packet is traced in two halves. Compiled with -msse4.2.
+//
+
+#include "SIMDKernels.hpp"
+#include <nmmintrin.h>
+
+namespace {
+	struct OpsSSE {
+		using V                   = __m128;
+		using M                   = __m128;
+		static constexpr int kLanes = 4;
+
+		static V load(const float *p) { return _mm_load_ps(p); }
+		static void store(float *p, V a) { _mm_store_ps(p, a); }
+		static V loadu(const float *p) { return _mm_loadu_ps(p); }
+		static void storeu(float *p, V a) { _mm_storeu_ps(p, a); }
+		static V set1(float f) { return _mm_set1_ps(f); }
+		static V add(V a, V b) { return _mm_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+		static V div(V a, V b) { return _mm_div_ps(a, b); }
+		static V min(V a, V b) { return _mm_min_ps(a, b); }
+		static V max(V a, V b) { return _mm_max_ps(a, b); }
+		static V sqrt(V a) { return _mm_sqrt_ps(a); }
+		static void storeU16(uint16_t *p, V a) {
+			__m128i i = _mm_cvtps_epi32(a);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi32(i, i));
+		}
+		static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+		static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+		static M le(V a, V b) { return _mm_cmple_ps(a, b); }
+		static M gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+		static M andMask(M a, M b) { return _mm_and_ps(a, b); }
+		static M orMask(M a, M b) { return _mm_or_ps(a, b); }
+		static V select(M m, V a, V b) { return _mm_blendv_ps(b, a, m); }
+		static uint32_t bits(M m) { return _mm_movemask_ps(m); }
+		static M mask(uint32_t bits) {
+			__m128i lane = _mm_set_epi32(8, 4, 2, 1);
+			return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lane), lane));
+		}
+	};
+}// namespace
+
+const SimdKernels kSSE42Kernels = {SimdISA::SSE42, "sse4.2", OpsSSE::kLanes, intersectBoxKernel<OpsSSE>,
+                                   intersectTriangleKernel<OpsSSE>, normalizeKernel<OpsSSE>, quantizeKernel<OpsSSE>};
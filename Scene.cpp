@@ -4,35 +4,75 @@
 
 #include "Scene.hpp"
 #include "Material.hpp"
+#include <algorithm>
 
 
 void Scene::buildBVH() {
 	printf(" - Generating BVH...\n\n");
-	this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+	this->bvh = std::make_unique<BVHAccel>(objects, 1, BVHAccel::SplitMethod::NAIVE);
+	buildLights();
+	buildIds();
+}
+
+void Scene::buildIds() {
+	objectIds.clear();
+	materialIds.clear();
+	std::vector<Material *> materials;
+	for(Object *object: objects) {
+		objectIds.emplace(object, objectIds.size());
+		object->getMaterials(materials);
+	}
+	for(Material *material: materials)
+		materialIds.emplace(material, materialIds.size());
+}
+
+int Scene::objectId(const Object *object) const {
+	auto it = objectIds.find(object);
+	return it == objectIds.end() ? -1 : it->second;
+}
+
+int Scene::materialId(const Material *material) const {
+	auto it = materialIds.find(material);
+	return it == materialIds.end() ? -1 : it->second;
+}
+
+void Scene::buildLights() {
+	emitters.clear();
+	emitterAreaCdf.clear();
+	for(Object *object: objects)
+		object->getEmitters(emitters);
+	for(Object *light: emitters)
+		emitterAreaCdf.push_back((emitterAreaCdf.empty() ? 0 : emitterAreaCdf.back()) + light->getEmitArea());
+	lightBVH = std::make_unique<LightBVH>(emitters);
 }
 
 Intersection Scene::intersect(const Ray &ray) const {
 	return this->bvh->Intersect(ray);
 }
 
-void Scene::sampleLight(Intersection &pos, float &pdf) const {
-	float emit_area_sum = 0;
-	for(uint32_t k = 0; k < objects.size(); ++k) {
-		if(objects[k]->hasEmit()) {
-			emit_area_sum += objects[k]->getArea();
-		}
-	}
-	float p       = get_random_float() * emit_area_sum;
-	emit_area_sum = 0;
-	for(uint32_t k = 0; k < objects.size(); ++k) {
-		if(objects[k]->hasEmit()) {
-			emit_area_sum += objects[k]->getArea();
-			if(p <= emit_area_sum) {
-				objects[k]->Sample(pos, pdf);
-				break;
-			}
-		}
+void Scene::intersect(RayPacket &packet, Intersection *hits, uint32_t active) const {
+	this->bvh->IntersectPacket(packet, hits, active);
+}
+
+bool Scene::sampleLight(const Vector3f &ref, const Vector3f &n, Intersection &pos, float &pdf) const {
+	Object *light = nullptr;
+	float pmf     = 0;
+	if(lightSampling == LightSampling::BVH) {
+		if(!lightBVH || !lightBVH->sample(ref, n, get_random_float(), light, pmf))
+			return false;
+	} else {
+		if(emitters.empty())
+			return false;
+		// Pick an emitter proportional to its area
+		float total = emitterAreaCdf.back();
+		float p     = get_random_float() * total;
+		size_t k    = std::min<size_t>(std::upper_bound(emitterAreaCdf.begin(), emitterAreaCdf.end(), p) - emitterAreaCdf.begin(), emitters.size() - 1);
+		light       = emitters[k];
+		pmf         = light->getEmitArea() / total;
 	}
+	light->Sample(ref, pos, pdf);
+	pdf *= pmf;
+	return pdf > 0;
 }
 
 bool Scene::trace(
@@ -63,7 +103,13 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const {
 	}
 
 	// Find intersection with the scene
-	Intersection intersection = intersect(ray);
+	return castRay(ray, depth, intersect(ray));
+}
+
+Vector3f Scene::castRay(const Ray &ray, int depth, const Intersection &intersection) const {
+	if(depth > maxDepth) {
+		return Vector3f(0.0f);
+	}
 	if(!intersection.happened) {
 		return this->backgroundColor;
 	}
@@ -73,48 +119,70 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const {
 		return intersection.m->getEmission();
 	}
 
-	Vector3f L_dir(0.0f);  // Direct lighting
-	Vector3f L_indir(0.0f);// Indirect lighting
-
-	// ----- Direct Lighting -----
-	// Sample a point on the light source
-	Intersection light_inter;
-	float pdf_light = 0.0f;
-	sampleLight(light_inter, pdf_light);
+	return directLight(ray, intersection) + indirectLight(ray, depth, intersection);
+}
 
+Vector3f Scene::unshadowedLight(const Ray &ray, const Intersection &isect, const Intersection &light) const {
 	// Compute the direction from the intersection point to the light sample
-	Vector3f p  = intersection.coords;
-	Vector3f x  = light_inter.coords;
-	Vector3f ws = normalize(x - p);
-
-	// Check if the light is visible from the intersection point
-	Ray shadowRay(p, ws);
-	Intersection shadow_inter = intersect(shadowRay);
-	// If the shadow ray hits the light source directly
-	if(shadow_inter.happened && (shadow_inter.coords - x).norm() < EPSILON) {
-		Vector3f N    = intersection.normal;
-		Vector3f NN   = light_inter.normal;
-		Vector3f emit = light_inter.emit;
-
-		// Compute BRDF, cosine terms, and the squared distance
-		Vector3f f             = intersection.m->eval(ray.direction, ws, N);
-		float cosTheta         = dotProduct(ws, N);
-		float cosTheta_x       = dotProduct(-ws, NN);
-		float distance_squared = (x - p).norm();
-		distance_squared *= distance_squared;
-
-		// Accumulate direct lighting
-		L_dir = emit * f * cosTheta * cosTheta_x / (distance_squared * pdf_light);
+	Vector3f p       = isect.coords;
+	Vector3f x       = light.coords;
+	Vector3f N       = isect.normal;
+	Vector3f ws      = normalize(x - p);
+	float cosTheta   = dotProduct(ws, N);
+	float cosTheta_x = dotProduct(-ws, light.normal);
+	// Samples on the far side of either surface contribute nothing
+	if(cosTheta <= 0 || cosTheta_x <= 0)
+		return Vector3f(0.0f);
+
+	// Compute BRDF, cosine terms, and the squared distance
+	Vector3f f             = isect.m->eval(ray.direction, ws, N);
+	float distance_squared = dotProduct(x - p, x - p);
+	return light.emit * f * cosTheta * cosTheta_x / distance_squared;
+}
+
+void Scene::sampleLights(const Ray &ray, const Intersection &isect, int candidates, Reservoir &r) const {
+	lightStats.count(lightStats.samples, candidates);
+	for(int i = 0; i < candidates; ++i) {
+		// A failed sample still counts as a candidate (weight 0), or the estimate would be biased up
+		Intersection light;
+		float pdf = 0.0f;
+		if(!sampleLight(isect.coords, isect.normal, light, pdf)) {
+			r.update(light, 0, 0, 0);
+			continue;
+		}
+		float pHat = targetPdf(ray, isect, light);
+		r.update(light, pHat / pdf, pHat, get_random_float());
 	}
+}
+
+Vector3f Scene::shadeReservoir(const Ray &ray, const Intersection &isect, const Reservoir &r) const {
+	if(r.W <= 0)
+		return Vector3f(0.0f);
+	// The light is visible if nothing lies between the two (offset) points
+	lightStats.count(lightStats.shadowRays);
+	if(!visible(isect, r.y))
+		return Vector3f(0.0f);
+	lightStats.count(lightStats.kept);
+	return unshadowedLight(ray, isect, r.y) * r.W;
+}
+
+Vector3f Scene::directLight(const Ray &ray, const Intersection &isect) const {
+	// With one candidate W = 1 / pdf, which is plain next event estimation
+	Reservoir r;
+	sampleLights(ray, isect, lightCandidates, r);
+	r.finalize();
+	return shadeReservoir(ray, isect, r);
+}
 
-	// ----- Indirect Lighting -----
+Vector3f Scene::indirectLight(const Ray &ray, int depth, const Intersection &intersection) const {
+	Vector3f L_indir(0.0f);
 	if(get_random_float() < RussianRoulette) {
 		Vector3f N  = intersection.normal;
 		Vector3f wi = intersection.m->sample(ray.direction, N);
 		float pdf   = intersection.m->pdf(ray.direction, wi, N);
 
 		if(pdf > EPSILON) {
-			Ray newRay(p, wi);
+			Ray newRay                    = intersection.spawnRay(wi);
 			Intersection new_intersection = intersect(newRay);
 
 			// Only consider non-emitting surfaces for indirect lighting
@@ -122,11 +190,11 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const {
 				Vector3f f     = intersection.m->eval(ray.direction, wi, N);
 				float cosTheta = dotProduct(wi, N);
 
-				// Recursively compute indirect lighting
-				L_indir = castRay(newRay, depth + 1) * f * cosTheta / (pdf * RussianRoulette);
+				// Recursively compute indirect lighting, reusing the hit just found
+				L_indir = castRay(newRay, depth + 1, new_intersection) * f * cosTheta / (pdf * RussianRoulette);
 			}
 		}
 	}
 
-	return L_dir + L_indir;
+	return L_indir;
 }
\ No newline at end of file
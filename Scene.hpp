@@ -5,11 +5,17 @@
 #pragma once
 
 #include "AreaLight.hpp"
+#include "Arena.hpp"
 #include "BVH.hpp"
 #include "Light.hpp"
+#include "LightBVH.hpp"
 #include "Object.hpp"
 #include "Ray.hpp"
+#include "Reservoir.hpp"
 #include "Vector.hpp"
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 
@@ -18,23 +24,90 @@ public:
 	// setting up options
 	int width                = 1280;
 	int height               = 960;
-	double fov               = 40;
 	Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
 	int maxDepth             = 1;
 	float RussianRoulette    = 0.8;
 
+	// How sampleLight picks an emitter: in proportion to its area, or by estimated contribution through a light BVH
+	enum class LightSampling { Area,
+		                       BVH };
+	LightSampling lightSampling = LightSampling::BVH;
+	// Light samples resampled (RIS) per shading point; only the winner gets a shadow ray. 1 is plain NEE.
+	int lightCandidates = 1;
+
 	Scene(int w, int h): width(w), height(h) {}
 
+	// Scene data (meshes, materials, instances, ...) is allocated in the scene's arena and released with it
+	template<typename T, typename... Args>
+	T *make(Args &&...args) { return arena.make<T>(std::forward<Args>(args)...); }
+	MemoryArena arena;
+
 	void Add(Object *object) { objects.push_back(object); }
 	void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
 
 	const std::vector<Object *> &get_objects() const { return objects; }
 	const std::vector<std::unique_ptr<Light>> &get_lights() const { return lights; }
 	Intersection intersect(const Ray &ray) const;
-	BVHAccel *bvh;
+	// First hits of a packet of rays (bit i of active = lane i), traced together through the BVH
+	void intersect(RayPacket &packet, Intersection *hits, uint32_t active) const;
+	std::unique_ptr<BVHAccel> bvh;
+	// Build the top-level BVH, the light structures and the object / material numbering
 	void buildBVH();
+	// Number of a top-level object (in the order they were added) or of a material (in the order the objects
+	// list them) for the ID outputs; -1 for unknown ones
+	int objectId(const Object *object) const;
+	int materialId(const Material *material) const;
+	// Refit the top-level BVH after objects moved (call after updating their own BVHs); lights are rebuilt
+	BVHAccel::UpdateStats updateBVH(float rebuildThreshold = 1.5f) {
+		BVHAccel::UpdateStats stats = bvh->update(rebuildThreshold);
+		buildLights();
+		return stats;
+	}
+	// Gather the emitters (emissive triangles of meshes, spheres, instances) and build the light BVH over them
+	void buildLights();
+	const std::vector<Object *> &get_emitters() const { return emitters; }
 	Vector3f castRay(const Ray &ray, int depth) const;
-	void sampleLight(Intersection &pos, float &pdf) const;
+	// Shade a ray whose first hit is already known, e.g. from a packet
+	Vector3f castRay(const Ray &ray, int depth, const Intersection &intersection) const;
+	// Sample a point on an emitter for lighting ref, a point with surface normal n. pdf is per unit area and
+	// includes the probability of picking that emitter; false if no emitter can light ref.
+	bool sampleLight(const Vector3f &ref, const Vector3f &n, Intersection &pos, float &pdf) const;
+	// Unshadowed direct lighting that the light sample light sends along ray's path at isect, and its luminance,
+	// the target density that RIS resamples light samples toward
+	Vector3f unshadowedLight(const Ray &ray, const Intersection &isect, const Intersection &light) const;
+	float targetPdf(const Ray &ray, const Intersection &isect, const Intersection &light) const {
+		Vector3f L = unshadowedLight(ray, isect, light);
+		return (L.x + L.y + L.z) / 3;
+	}
+	// Stream candidates light samples for isect through r (not finalized)
+	void sampleLights(const Ray &ray, const Intersection &isect, int candidates, Reservoir &r) const;
+	// Direct lighting from a finalized reservoir's sample, with one shadow ray
+	Vector3f shadeReservoir(const Ray &ray, const Intersection &isect, const Reservoir &r) const;
+	// Direct lighting at isect from lightCandidates resampled light samples
+	Vector3f directLight(const Ray &ray, const Intersection &isect) const;
+	// Light arriving at isect after one more bounce (Russian roulette decides whether to continue the path)
+	Vector3f indirectLight(const Ray &ray, int depth, const Intersection &isect) const;
+	// Whether the segment between two surface points is unoccluded; both ends are offset off their surfaces
+	bool visible(const Intersection &from, const Intersection &to) const { return !bvh->IntersectP(from.spawnRayTo(to)); }
+
+	/**
+	 * @brief 直接光照（NEE）的采样计数，由各渲染线程共同累加。
+	 *
+	 * 只在 LIGHT_STATS 构建（cmake -DLIGHT_STATS=ON）中计数：计数器被所有渲染线程在每个着色点上修改，
+	 * 其余构建里 count 什么也不做，渲染线程不必争用同一条缓存行。
+	 */
+	struct LightSampleStats {
+		std::atomic<uint64_t> samples{0};   // light samples drawn (RIS candidates included)
+		std::atomic<uint64_t> shadowRays{0};// chosen samples facing the shading point, tested for visibility
+		std::atomic<uint64_t> kept{0};      // unoccluded samples, which contribute to the image
+
+		static void count([[maybe_unused]] std::atomic<uint64_t> &counter, [[maybe_unused]] uint64_t n = 1) {
+#ifdef LIGHT_STATS
+			counter.fetch_add(n, std::memory_order_relaxed);
+#endif
+		}
+	};
+	mutable LightSampleStats lightStats;
 	bool trace(const Ray &ray, const std::vector<Object *> &objects, float &tNear, uint32_t &index, Object **hitObject);
 	std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
 	                                               const Vector3f &shadowPointOrig,
@@ -45,6 +118,15 @@ public:
 	std::vector<Object *> objects;
 	std::vector<std::unique_ptr<Light>> lights;
 
+	// Separately sampled emitters, their cumulative areas (LightSampling::Area) and the light BVH over them
+	std::vector<Object *> emitters;
+	std::vector<float> emitterAreaCdf;
+	std::unique_ptr<LightBVH> lightBVH;
+
+	std::unordered_map<const Object *, int> objectIds;
+	std::unordered_map<const Material *, int> materialIds;
+	void buildIds();
+
 	// Compute reflection direction
 	Vector3f reflect(const Vector3f &I, const Vector3f &N) const {
 		return I - 2 * dotProduct(I, N) * N;
@@ -16,7 +16,7 @@ public:
 	float radius, radius2;
 	Material *m;
 	float area;
-	Sphere(const Vector3f &c, const float &r, Material *mt = new Material()): center(c), radius(r), radius2(r * r), m(mt), area(4 * M_PI * r * r) {}
+	Sphere(const Vector3f &c, const float &r, Material *mt = defaultMaterial()): center(c), radius(r), radius2(r * r), m(mt), area(4 * M_PI * r * r) {}
 	bool intersect(const Ray &ray) {
 		// analytic solution
 		Vector3f L = ray.origin - center;
@@ -24,14 +24,11 @@ public:
 		float b    = 2 * dotProduct(ray.direction, L);
 		float c    = dotProduct(L, L) - radius2;
 		float t0, t1;
-		float area = 4 * M_PI * radius2;
 		if(!solveQuadratic(a, b, c, t0, t1))
 			return false;
-		if(t0 < 0)
+		if(t0 <= ray.tMin)
 			t0 = t1;
-		if(t0 < 0)
-			return false;
-		return true;
+		return t0 > ray.tMin && t0 < ray.tMax;
 	}
 	bool intersect(const Ray &ray, float &tnear, uint32_t &index) const {
 		// analytic solution
@@ -60,13 +57,13 @@ public:
 		float t0, t1;
 		if(!solveQuadratic(a, b, c, t0, t1))
 			return result;
-		if(t0 < 0)
+		if(t0 < ray.tMin)
 			t0 = t1;
-		if(t0 < 0)
+		if(t0 < ray.tMin || t0 >= ray.tMax)
 			return result;
 		result.happened = true;
 
-		result.coords   = Vector3f(ray.origin + ray.direction * t0);
+		setHitPoint(result, ray.origin + ray.direction * t0);
 		result.normal   = normalize(Vector3f(result.coords - center));
 		result.m        = this->m;
 		result.obj      = this;
@@ -83,19 +80,76 @@ public:
 		               Vector3f(center.x + radius, center.y + radius, center.z + radius));
 	}
 	void Sample(Intersection &pos, float &pdf) {
-		float theta = 2.0 * M_PI * get_random_float(), phi = M_PI * get_random_float();
-		Vector3f dir(std::cos(phi), std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta));
-		pos.coords = center + radius * dir;
+		// Uniform over the area: z = cos(theta) uniform in [-1, 1], phi uniform in [0, 2pi)
+		float z = 1 - 2 * get_random_float(), phi = 2 * M_PI * get_random_float();
+		float r = std::sqrt(std::max(0.0f, 1 - z * z));
+		Vector3f dir(r * std::cos(phi), r * std::sin(phi), z);
+		setHitPoint(pos, center + radius * dir);
 		pos.normal = dir;
 		pos.emit   = m->getEmission();
 		pdf        = 1.0f / area;
 	}
+	// Seen from outside, sample directions uniformly inside the cone the sphere subtends at ref, so every sample
+	// lands on the visible cap. From inside, the whole sphere is visible and sampled by area.
+	void Sample(const Vector3f &ref, Intersection &pos, float &pdf) {
+		Vector3f toCenter = center - ref;
+		float dc2         = dotProduct(toCenter, toCenter);
+		if(dc2 <= radius2) {
+			Sample(pos, pdf);
+			return;
+		}
+		float dc    = std::sqrt(dc2);
+		Vector3f wc = toCenter / dc, wcX, wcY;
+		coordinateSystem(wc, wcX, wcY);
+
+		// 1 - cos(thetaMax) written as sin^2 / (1 + cos), which stays accurate for distant, tiny spheres
+		float sinThetaMax2        = radius2 / dc2;
+		float cosThetaMax         = std::sqrt(std::max(0.0f, 1 - sinThetaMax2));
+		float oneMinusCosThetaMax = sinThetaMax2 / (1 + cosThetaMax);
+
+		float u         = get_random_float(), phi = 2 * M_PI * get_random_float();
+		float cosTheta  = 1 - u * oneMinusCosThetaMax;
+		float sinTheta2 = 1 - cosTheta * cosTheta;
+		if(sinThetaMax2 < 0.00068523f) {
+			// Below ~1.5 degrees, 1 - cos^2 cancels catastrophically; use the small-angle expansion
+			sinTheta2 = sinThetaMax2 * u;
+			cosTheta  = std::sqrt(1 - sinTheta2);
+		}
+
+		// Angle at the centre between -wc and the point where the sampled direction first meets the sphere
+		float cosAlpha = sinTheta2 / std::sqrt(sinThetaMax2) +
+		                 cosTheta * std::sqrt(std::max(0.0f, 1 - sinTheta2 / sinThetaMax2));
+		float sinAlpha = std::sqrt(std::max(0.0f, 1 - cosAlpha * cosAlpha));
+		Vector3f n     = wcX * (sinAlpha * std::cos(phi)) + wcY * (sinAlpha * std::sin(phi)) - wc * cosAlpha;
+		setHitPoint(pos, center + radius * n);
+		pos.normal = n;
+		pos.emit   = m->getEmission();
+
+		// Uniform solid-angle density, converted to area measure: pdf_A = pdf_w * cos / d^2
+		Vector3f w    = pos.coords - ref;
+		float d2      = dotProduct(w, w);
+		float cosSurf = std::fabs(dotProduct(n, w)) / std::sqrt(d2);
+		pdf           = cosSurf / (2 * M_PI * oneMinusCosThetaMax * d2);
+	}
 	float getArea() {
 		return area;
 	}
 	bool hasEmit() {
 		return m->hasEmission();
 	}
+	void getMaterials(std::vector<Material *> &materials) { materials.push_back(m); }
+
+private:
+	// Project p onto the surface, which leaves coords off by a few ulps relative to the centre and radius
+	// instead of by the (much larger) error of the root t
+	void setHitPoint(Intersection &inter, const Vector3f &p) const {
+		Vector3f local = p - center;
+		float len      = local.norm();
+		if(len > 0)
+			local = local * (radius / len);
+		inter.coords = center + local;
+		inter.pError = (Vector3f::Abs(local) + Vector3f::Abs(center)) * errorGamma(6);
+	}
 };
 
 
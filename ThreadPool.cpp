@@ -0,0 +1,65 @@
+//
+// Render threads that are started once and serve every render of the process.
+//
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads) {
+	for(int t = 1; t < threads; ++t)
+		workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(std::thread &worker: workers)
+		worker.join();
+}
+
+ThreadPool &ThreadPool::shared() {
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
+
+void ThreadPool::take() {
+	for(int task = next.fetch_add(1); task < jobCount; task = next.fetch_add(1))
+		(*job)(task);
+}
+
+void ThreadPool::run(int count, const std::function<void(int task)> &fn) {
+	std::lock_guard<std::mutex> running(runMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job      = &fn;
+		jobCount = count;
+		next     = 0;
+		busy     = int(workers.size());
+		++generation;
+	}
+	wake.notify_all();
+	take();
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [&] { return busy == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::work() {
+	uint64_t seen = 0;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if(quit)
+				return;
+			seen = generation;
+		}
+		take();
+		std::lock_guard<std::mutex> lock(mutex);
+		if(--busy == 0)
+			idle.notify_one();
+	}
+}
@@ -0,0 +1,53 @@
+//
+// Render threads that are started once and serve every render of the process.
+//
+
+#ifndef RAYTRACING_THREADPOOL_H
+#define RAYTRACING_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 常驻线程池：线程只创建一次，之后每一次渲染、每一个视图、每一轮采样都交给同一批线程。
+ *
+ * run(count, fn) 对 0 .. count-1 的每个任务调用 fn，池中线程与调用线程一起从共享计数器领取下一个未开始的任务，
+ * 全部完成后才返回。同一时刻只执行一个 run，其他线程的调用会等它结束。
+ */
+class ThreadPool {
+public:
+	// threads in all, the caller of run included
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &)            = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	int size() const { return int(workers.size()) + 1; }
+	void run(int count, const std::function<void(int task)> &fn);
+
+	// The process's render threads, one per hardware thread, started on first use
+	static ThreadPool &shared();
+
+private:
+	void work();
+	void take();
+
+	std::vector<std::thread> workers;
+	std::mutex runMutex;// one run at a time
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	const std::function<void(int)> *job = nullptr;
+	int jobCount                        = 0;
+	std::atomic<int> next{0};
+	int busy            = 0;// workers still on the current run
+	uint64_t generation = 0;// runs started, so that a worker takes each run once
+	bool quit           = false;
+};
+
+#endif//RAYTRACING_THREADPOOL_H
@@ -0,0 +1,293 @@
+//
+// Multi-process rendering: a coordinator leases image tiles to worker processes running the same binary.
+//
+
+#include "TileFarm.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+	// Coordinator to worker: render tile index, pixels [x0, x1) x [y0, y1); a negative index tells the worker to exit
+	struct TileLease {
+		int32_t index, x0, y0, x1, y1;
+	};
+	// Worker to coordinator, followed by count floats: the tile's RGB rows. A negative index (count 0) says the
+	// worker has built its scene and is ready for tiles.
+	struct TileResult {
+		int32_t index, count;
+	};
+
+	bool sendAll(int fd, const void *data, size_t n) {
+		const char *p = static_cast<const char *>(data);
+		while(n > 0) {
+			// A peer that died must not take this process down with SIGPIPE
+			ssize_t sent = ::send(fd, p, n, MSG_NOSIGNAL);
+			if(sent < 0 && errno == EINTR)
+				continue;
+			if(sent <= 0)
+				return false;
+			p += sent;
+			n -= sent;
+		}
+		return true;
+	}
+
+	bool receiveAll(int fd, void *data, size_t n) {
+		char *p = static_cast<char *>(data);
+		while(n > 0) {
+			ssize_t got = ::read(fd, p, n);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0)
+				return false;
+			p += got;
+			n -= got;
+		}
+		return true;
+	}
+
+	struct Worker {
+		enum class State { Starting,
+			               Idle,
+			               Busy,
+			               Dead };
+		pid_t pid   = -1;
+		int fd      = -1;
+		State state = State::Starting;
+		int lease   = -1;// tile being rendered
+		int tiles   = 0; // tiles delivered
+		std::chrono::steady_clock::time_point deadline;// by when its scene must be built or its tile returned
+		std::vector<char> inbox;                       // received bytes of messages not yet complete
+	};
+
+	// Start a worker process connected to this one through a socket pair
+	bool spawn(const std::vector<std::string> &command, Worker &worker) {
+		int ends[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ends) != 0)
+			return false;
+		std::vector<std::string> args = command;
+		args.push_back("--farm-worker");
+		args.push_back(std::to_string(ends[1]));
+		std::vector<char *> argv;
+		for(std::string &arg: args)
+			argv.push_back(&arg[0]);
+		argv.push_back(nullptr);
+
+		pid_t pid = fork();
+		if(pid == 0) {
+			// Only the worker's own end survives the exec; its progress output is of no use to anyone
+			fcntl(ends[1], F_SETFD, 0);
+			int null = ::open("/dev/null", O_WRONLY);
+			if(null >= 0)
+				dup2(null, STDOUT_FILENO);
+			execv(argv[0], argv.data());
+			_exit(127);
+		}
+		::close(ends[1]);
+		if(pid < 0) {
+			::close(ends[0]);
+			return false;
+		}
+		worker.pid = pid;
+		worker.fd  = ends[0];
+		return true;
+	}
+
+	double milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+}// namespace
+
+bool TileFarm::render(int workers, int width, int height, int tileSize, std::vector<Vector3f> &image, FarmStats &stats,
+                      const std::function<void(int index, const Tile &tile)> &onTile) {
+	using Clock             = std::chrono::steady_clock;
+	Clock::time_point start = Clock::now(), leasing = start;
+	std::vector<Tile> tiles = makeTiles(width, height, tileSize);
+	image.assign(size_t(width) * height, Vector3f(0.0f));
+	stats = FarmStats{};
+
+	// A worker that takes longer than leaseTimeout to build its scene or to render its tile is hung rather than slow
+	auto deadline = [&] { return Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(leaseTimeout)); };
+	std::vector<Worker> pool(workers);
+	for(Worker &worker: pool) {
+		if(!spawn(workerCommand, worker))
+			worker.state = Worker::State::Dead;
+		worker.deadline = deadline();
+	}
+
+	std::deque<int> pending;
+	for(size_t i = 0; i < tiles.size(); ++i)
+		pending.push_back(int(i));
+	std::vector<uint8_t> done(tiles.size(), 0);
+	size_t finished = 0;
+	bool leased     = false;
+	// A worker that exited, crashed or sent garbage: whatever it was rendering goes back to the front of the queue
+	auto lost = [&](Worker &worker) {
+		if(worker.lease >= 0 && !done[worker.lease]) {
+			pending.push_front(worker.lease);
+			++stats.reassigned;
+		}
+		::close(worker.fd);
+		worker.fd    = -1;
+		worker.lease = -1;
+		worker.state = Worker::State::Dead;
+		worker.inbox.clear();
+	};
+
+	// Handle the complete messages in the worker's inbox, leaving a partial one for later; false if a message is not
+	// one the worker may send
+	auto deliver = [&](Worker &worker) {
+		size_t used = 0;
+		while(worker.inbox.size() - used >= sizeof(TileResult)) {
+			TileResult result;
+			memcpy(&result, worker.inbox.data() + used, sizeof(result));
+			if(result.index < 0) {
+				// Only a worker that is still building its scene may say it is ready
+				if(worker.state != Worker::State::Starting)
+					return false;
+				worker.state = Worker::State::Idle;
+				used += sizeof(result);
+				continue;
+			}
+			if(result.index != worker.lease)
+				return false;
+			const Tile &tile = tiles[result.index];
+			size_t rowBytes  = size_t(tile.width()) * sizeof(Vector3f);
+			if(size_t(result.count) != size_t(tile.width()) * tile.height() * 3)
+				return false;
+			if(worker.inbox.size() - used < sizeof(result) + rowBytes * tile.height())
+				break;
+			const char *rows = worker.inbox.data() + used + sizeof(result);
+			for(int y = tile.y0; y < tile.y1; ++y)
+				memcpy(&image[size_t(y) * width + tile.x0], rows + (y - tile.y0) * rowBytes, rowBytes);
+			used += sizeof(result) + rowBytes * tile.height();
+			done[result.index] = 1;
+			++finished;
+			++worker.tiles;
+			worker.lease = -1;
+			worker.state = Worker::State::Idle;
+			if(onTile)
+				onTile(result.index, tile);
+		}
+		worker.inbox.erase(worker.inbox.begin(), worker.inbox.begin() + used);
+		return true;
+	};
+
+	std::vector<pollfd> fds;
+	std::vector<Worker *> polled;
+	while(finished < tiles.size()) {
+		// Tiles are leased once no worker is still building its scene, so that the render time leaves setup out
+		bool starting = std::any_of(pool.begin(), pool.end(), [](const Worker &w) { return w.state == Worker::State::Starting; });
+		if(!starting) {
+			if(!leased) {
+				leasing       = Clock::now();
+				stats.setupMs = milliseconds(start, leasing);
+				leased        = true;
+			}
+			for(Worker &worker: pool) {
+				if(worker.state != Worker::State::Idle || pending.empty())
+					continue;
+				const Tile &tile = tiles[pending.front()];
+				TileLease lease{pending.front(), tile.x0, tile.y0, tile.x1, tile.y1};
+				if(!sendAll(worker.fd, &lease, sizeof(lease))) {
+					lost(worker);
+					continue;
+				}
+				worker.lease    = lease.index;
+				worker.state    = Worker::State::Busy;
+				worker.deadline = deadline();
+				pending.pop_front();
+			}
+		}
+
+		fds.clear();
+		polled.clear();
+		// Wait no longer than until the first deadline
+		int timeout = -1;
+		for(Worker &worker: pool) {
+			if(worker.state == Worker::State::Dead)
+				continue;
+			fds.push_back({worker.fd, POLLIN, 0});
+			polled.push_back(&worker);
+			if(worker.state != Worker::State::Idle && leaseTimeout > 0) {
+				auto left = std::chrono::ceil<std::chrono::milliseconds>(worker.deadline - Clock::now()).count();
+				left      = std::max<decltype(left)>(left, 0);
+				timeout   = timeout < 0 ? int(left) : std::min(timeout, int(left));
+			}
+		}
+		if(fds.empty())
+			break;// every worker is gone
+		if(poll(fds.data(), fds.size(), timeout) < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		for(size_t k = 0; k < fds.size(); ++k) {
+			if(!fds[k].revents)
+				continue;
+			Worker &worker = *polled[k];
+			// Take only what has arrived: a worker stopped halfway through sending a tile must not block the
+			// coordinator past its deadline
+			size_t kept = worker.inbox.size();
+			worker.inbox.resize(kept + 65536);
+			ssize_t got = recv(worker.fd, worker.inbox.data() + kept, 65536, MSG_DONTWAIT);
+			worker.inbox.resize(kept + std::max<ssize_t>(got, 0));
+			if(got < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+				continue;
+			if(got <= 0 || !deliver(worker))
+				lost(worker);
+		}
+
+		// A hung worker is killed, so that it can neither deliver its tile late nor keep the farm from exiting, and its
+		// tile goes to another worker
+		Clock::time_point now = Clock::now();
+		for(Worker &worker: pool)
+			if((worker.state == Worker::State::Starting || worker.state == Worker::State::Busy) && leaseTimeout > 0 && now >= worker.deadline) {
+				kill(worker.pid, SIGKILL);
+				lost(worker);
+				++stats.expired;
+			}
+	}
+	stats.renderMs = leased ? milliseconds(leasing, Clock::now()) : 0;
+
+	// Let the workers still alive exit, and reap every one of them
+	for(Worker &worker: pool) {
+		if(worker.state != Worker::State::Dead) {
+			TileLease stop{-1, 0, 0, 0, 0};
+			sendAll(worker.fd, &stop, sizeof(stop));
+			::close(worker.fd);
+		}
+		if(worker.pid > 0)
+			waitpid(worker.pid, nullptr, 0);
+		stats.tilesPerWorker.push_back(worker.tiles);
+	}
+	return finished == tiles.size();
+}
+
+bool serveFarmTiles(int fd, Renderer &renderer, const Scene &scene) {
+	TileResult ready{-1, 0};
+	if(!sendAll(fd, &ready, sizeof(ready)))
+		return false;
+	std::vector<Vector3f> pixels;
+	for(TileLease lease; receiveAll(fd, &lease, sizeof(lease));) {
+		if(lease.index < 0)
+			return true;
+		if(lease.x0 < 0 || lease.y0 < 0 || lease.x1 > scene.width || lease.y1 > scene.height || lease.x0 >= lease.x1 || lease.y0 >= lease.y1)
+			return false;
+		renderer.renderTile(scene, Tile{lease.x0, lease.y0, lease.x1, lease.y1}, pixels);
+		TileResult result{lease.index, int32_t(pixels.size() * 3)};
+		if(!sendAll(fd, &result, sizeof(result)) || !sendAll(fd, pixels.data(), pixels.size() * sizeof(Vector3f)))
+			return false;
+	}
+	return false;
+}
@@ -0,0 +1,57 @@
+//
+// Multi-process rendering: a coordinator leases image tiles to worker processes running the same binary.
+//
+
+#ifndef RAYTRACING_TILEFARM_H
+#define RAYTRACING_TILEFARM_H
+
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include "TileFile.hpp"
+#include "Vector.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 一次分块农场渲染的统计。
+ */
+struct FarmStats {
+	double setupMs  = 0;// until every worker had its scene built
+	double renderMs = 0;// from the first lease to the last tile back
+	int reassigned  = 0;// tiles leased again after their worker died or hung
+	int expired     = 0;// hung workers killed: past the deadline with their scene or their tile
+	std::vector<int> tilesPerWorker;
+};
+
+/**
+ * @brief 分块农场的协调进程：启动 workers 个工作进程，把图像分块逐个租给空闲的进程，收回浮点结果拼成整幅图像。
+ *
+ * 工作进程执行 command（同一个可执行文件，加上 --farm-worker <fd>），各自构建场景，通过 socketpair 与协调进程通信：
+ * 协调进程发送 TileLease，工作进程渲染完回送块头和该块的 RGB 浮点。某个工作进程退出或崩溃时，
+ * 租给它的块重新排队交给其他进程；超过 leaseTimeout 秒仍未建好场景或交回所租块的进程视为挂起，
+ * 同样处理并被终止。每个像素的随机数只取决于像素和样本序号，所以结果与单进程渲染逐位相同。
+ */
+class TileFarm {
+public:
+	// command: the worker's program and arguments, to which --farm-worker <fd> is appended
+	explicit TileFarm(std::vector<std::string> command): workerCommand(std::move(command)) {}
+
+	// Render a width x height image cut into tileSize tiles with workers processes; onTile is called with every tile
+	// as it arrives. False if every worker died before the image was complete.
+	bool render(int workers, int width, int height, int tileSize, std::vector<Vector3f> &image, FarmStats &stats,
+	            const std::function<void(int index, const Tile &tile)> &onTile = nullptr);
+
+	// Seconds a worker may take to build its scene, and then over each tile, before it is killed as hung and its tile
+	// leased again; 0: no limit
+	double leaseTimeout = 300;
+
+private:
+	std::vector<std::string> workerCommand;
+};
+
+// Worker side: render the tiles leased over fd with the renderer and scene until the coordinator says stop; false if
+// the connection broke
+bool serveFarmTiles(int fd, Renderer &renderer, const Scene &scene);
+
+#endif//RAYTRACING_TILEFARM_H
@@ -0,0 +1,133 @@
+//
+// Image tiles, and a tiled on-disk image that finished tiles are appended to while the render is still running.
+//
+
+#include "TileFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+	constexpr char kMagic[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '1'};
+
+	struct TileFileHeader {
+		char magic[8];
+		int32_t width, height, tileSize, reserved;
+	};
+	static_assert(sizeof(TileFileHeader) == 24, "the header is written as is");
+
+	bool pwriteAll(int fd, const void *data, size_t n, uint64_t offset) {
+		const char *p = static_cast<const char *>(data);
+		while(n > 0) {
+			ssize_t written = ::pwrite(fd, p, n, off_t(offset));
+			if(written <= 0)
+				return false;
+			p += written;
+			n -= written;
+			offset += written;
+		}
+		return true;
+	}
+
+	bool preadAll(int fd, void *data, size_t n, uint64_t offset) {
+		char *p = static_cast<char *>(data);
+		while(n > 0) {
+			ssize_t got = ::pread(fd, p, n, off_t(offset));
+			if(got <= 0)
+				return false;
+			p += got;
+			n -= got;
+			offset += got;
+		}
+		return true;
+	}
+
+	uint64_t indexEntry(int index) { return sizeof(TileFileHeader) + uint64_t(index) * sizeof(uint64_t); }
+}// namespace
+
+std::vector<Tile> makeTiles(int width, int height, int tileSize) {
+	std::vector<Tile> tiles;
+	for(int y = 0; y < height; y += tileSize)
+		for(int x = 0; x < width; x += tileSize)
+			tiles.push_back({x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)});
+	return tiles;
+}
+
+TileFileWriter::~TileFileWriter() { close(); }
+
+bool TileFileWriter::create(const std::string &path, int width, int height, int tileSize) {
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return false;
+	imageWidth = width;
+
+	TileFileHeader header{};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.width    = width;
+	header.height   = height;
+	header.tileSize = tileSize;
+	// An all-zero index: no tile written yet
+	size_t tileCount = makeTiles(width, height, tileSize).size();
+	std::vector<uint64_t> index(tileCount, 0);
+	end    = indexEntry(int(tileCount));
+	failed = !pwriteAll(fd, &header, sizeof(header), 0) || !pwriteAll(fd, index.data(), index.size() * sizeof(uint64_t), sizeof(header));
+	return !failed;
+}
+
+bool TileFileWriter::append(int index, const Tile &tile, const std::vector<Vector3f> &image) {
+	if(fd < 0 || failed)
+		return false;
+	rows.clear();
+	for(int y = tile.y0; y < tile.y1; ++y)
+		rows.insert(rows.end(), image.begin() + size_t(y) * imageWidth + tile.x0, image.begin() + size_t(y) * imageWidth + tile.x1);
+	uint64_t offset = end;
+	end += rows.size() * sizeof(Vector3f);
+	// The data goes in before the index entry that points at it, so a reader never sees a partly written tile
+	if(!pwriteAll(fd, rows.data(), rows.size() * sizeof(Vector3f), offset) || !pwriteAll(fd, &offset, sizeof(offset), indexEntry(index)))
+		failed = true;
+	return !failed;
+}
+
+bool TileFileWriter::close() {
+	if(fd >= 0 && ::close(fd) != 0)
+		failed = true;
+	fd = -1;
+	return !failed;
+}
+
+int readTileFile(const std::string &path, int &width, int &height, std::vector<Vector3f> &image) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return -1;
+	TileFileHeader header;
+	if(!preadAll(fd, &header, sizeof(header), 0) || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+	   header.width <= 0 || header.height <= 0 || header.tileSize <= 0) {
+		::close(fd);
+		return -1;
+	}
+	width  = header.width;
+	height = header.height;
+	std::vector<Tile> tiles = makeTiles(width, height, header.tileSize);
+	std::vector<uint64_t> index(tiles.size());
+	if(!preadAll(fd, index.data(), index.size() * sizeof(uint64_t), sizeof(header))) {
+		::close(fd);
+		return -1;
+	}
+
+	image.assign(size_t(width) * height, Vector3f(0.0f));
+	int tilesRead = 0;
+	std::vector<Vector3f> rows;
+	for(size_t i = 0; i < tiles.size(); ++i) {
+		const Tile &tile = tiles[i];
+		rows.resize(size_t(tile.width()) * tile.height());
+		// A tile whose data was cut short (the file system lost the end of the file) is skipped like a missing one
+		if(index[i] == 0 || !preadAll(fd, rows.data(), rows.size() * sizeof(Vector3f), index[i]))
+			continue;
+		for(int y = tile.y0; y < tile.y1; ++y)
+			std::copy_n(rows.begin() + size_t(y - tile.y0) * tile.width(), tile.width(), image.begin() + size_t(y) * width + tile.x0);
+		++tilesRead;
+	}
+	::close(fd);
+	return tilesRead;
+}
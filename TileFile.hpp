@@ -0,0 +1,56 @@
+//
+// Image tiles, and a tiled on-disk image that finished tiles are appended to while the render is still running.
+//
+
+#ifndef RAYTRACING_TILEFILE_H
+#define RAYTRACING_TILEFILE_H
+
+#include "Vector.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pixels [x0, x1) x [y0, y1) of the image
+struct Tile {
+	int x0, y0, x1, y1;
+
+	int width() const { return x1 - x0; }
+	int height() const { return y1 - y0; }
+};
+
+// Cover a width x height image with tiles of tileSize x tileSize pixels (smaller at the right and bottom edges), in
+// row-major order: tile i is column i % tilesX, row i / tilesX
+std::vector<Tile> makeTiles(int width, int height, int tileSize);
+
+/**
+ * @brief 分块存储的浮点图像文件，渲染中每完成一块就追加写入一块。
+ *
+ * 文件布局：文件头（魔数、宽、高、块大小），每块一个 64 位偏移组成的索引（0 表示尚未写入），
+ * 之后是按完成顺序追加的块数据，每块为逐行排列的 RGB 浮点。每块先写数据、再写索引项，
+ * 所以渲染进程在任何时刻崩溃或被杀掉，索引中出现的块都是完整的，已完成的区域可以用 readTileFile 读回。
+ * 写入直接用 pwrite，不经过用户态缓冲，块一完成就进入文件。
+ */
+class TileFileWriter {
+public:
+	~TileFileWriter();
+
+	// Create the file for a width x height image cut into makeTiles(width, height, tileSize); false on failure
+	bool create(const std::string &path, int width, int height, int tileSize);
+	// Append tile index (in makeTiles order), copied out of the full-size image; false if the write failed
+	bool append(int index, const Tile &tile, const std::vector<Vector3f> &image);
+	// Close the file; false if any write since create failed
+	bool close();
+
+private:
+	int fd         = -1;
+	int imageWidth = 0;
+	uint64_t end   = 0;// file offset the next tile goes to
+	bool failed    = false;
+	std::vector<Vector3f> rows;
+};
+
+// Read a tile file into a full-size image; tiles not yet written stay black. Returns the number of tiles read, or -1
+// if the file could not be read.
+int readTileFile(const std::string &path, int &width, int &height, std::vector<Vector3f> &image);
+
+#endif//RAYTRACING_TILEFILE_H
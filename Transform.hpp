@@ -0,0 +1,141 @@
+//
+// Affine transforms for instanced geometry.
+//
+
+#ifndef RAYTRACING_TRANSFORM_H
+#define RAYTRACING_TRANSFORM_H
+
+#include "Bounds3.hpp"
+#include "Vector.hpp"
+#include "global.hpp"
+#include <cmath>
+
+/**
+ * @brief 仿射变换（3x4 矩阵），同时保存其逆矩阵。
+ *
+ * 用于实例化：实例的 objectToWorld 把共享网格（BLAS）从物体空间放到世界空间，
+ * 求交时用逆矩阵把光线变换到物体空间。
+ */
+class Transform {
+public:
+	Transform() {
+		for(int i = 0; i < 3; ++i)
+			for(int j = 0; j < 4; ++j)
+				m[i][j] = mInv[i][j] = (i == j) ? 1.0f : 0.0f;
+	}
+	// Row-major 3x4 matrix; the inverse is computed here
+	explicit Transform(const float mat[3][4]) {
+		for(int i = 0; i < 3; ++i)
+			for(int j = 0; j < 4; ++j)
+				m[i][j] = mat[i][j];
+		invert();
+	}
+
+	static Transform Translate(const Vector3f &d) {
+		float mat[3][4] = {{1, 0, 0, d.x}, {0, 1, 0, d.y}, {0, 0, 1, d.z}};
+		return Transform(mat);
+	}
+	static Transform Scale(const Vector3f &s) {
+		float mat[3][4] = {{s.x, 0, 0, 0}, {0, s.y, 0, 0}, {0, 0, s.z, 0}};
+		return Transform(mat);
+	}
+	static Transform RotateY(float degrees) {
+		float rad = degrees * M_PI / 180.0f, c = std::cos(rad), s = std::sin(rad);
+		float mat[3][4] = {{c, 0, s, 0}, {0, 1, 0, 0}, {-s, 0, c, 0}};
+		return Transform(mat);
+	}
+
+	// Apply rhs first, then *this
+	Transform operator*(const Transform &rhs) const {
+		float mat[3][4];
+		for(int i = 0; i < 3; ++i) {
+			for(int j = 0; j < 4; ++j) {
+				mat[i][j] = m[i][0] * rhs.m[0][j] + m[i][1] * rhs.m[1][j] + m[i][2] * rhs.m[2][j];
+				if(j == 3)
+					mat[i][j] += m[i][3];
+			}
+		}
+		return Transform(mat);
+	}
+
+	Transform inverse() const {
+		Transform t;
+		for(int i = 0; i < 3; ++i)
+			for(int j = 0; j < 4; ++j) {
+				t.m[i][j]    = mInv[i][j];
+				t.mInv[i][j] = m[i][j];
+			}
+		return t;
+	}
+
+	Vector3f point(const Vector3f &p) const {
+		return Vector3f(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+		                m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+		                m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+	}
+	// Error bound of point(p), given the bound pError on p: rounding in the transform plus pError carried through it
+	Vector3f pointError(const Vector3f &p, const Vector3f &pError) const {
+		Vector3f err;
+		for(int i = 0; i < 3; ++i) {
+			float rounding = std::fabs(m[i][3]), carried = 0;
+			for(int j = 0; j < 3; ++j) {
+				rounding += std::fabs(m[i][j] * p[j]);
+				carried += std::fabs(m[i][j]) * pError[j];
+			}
+			err[i] = errorGamma(3) * rounding + (1 + errorGamma(3)) * carried;
+		}
+		return err;
+	}
+	Vector3f vector(const Vector3f &v) const {
+		return Vector3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+		                m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+		                m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+	// Normals transform with the inverse transpose (result is not normalized)
+	Vector3f normal(const Vector3f &n) const {
+		return Vector3f(mInv[0][0] * n.x + mInv[1][0] * n.y + mInv[2][0] * n.z,
+		                mInv[0][1] * n.x + mInv[1][1] * n.y + mInv[2][1] * n.z,
+		                mInv[0][2] * n.x + mInv[1][2] * n.y + mInv[2][2] * n.z);
+	}
+	Bounds3 bounds(const Bounds3 &b) const {
+		Bounds3 ret;
+		for(int corner = 0; corner < 8; ++corner) {
+			Vector3f p((corner & 1) ? b.pMax.x : b.pMin.x,
+			           (corner & 2) ? b.pMax.y : b.pMin.y,
+			           (corner & 4) ? b.pMax.z : b.pMin.z);
+			ret = Union(ret, point(p));
+		}
+		return ret;
+	}
+
+	// Determinant of the linear part
+	float det() const {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+		       m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+		       m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	float m[3][4];
+	float mInv[3][4];
+
+private:
+	void invert() {
+		float d = det();
+		float inv = d != 0 ? 1.0f / d : 0.0f;
+		// Inverse of the linear part via the adjugate
+		mInv[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv;
+		mInv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+		mInv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+		mInv[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv;
+		mInv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+		mInv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+		mInv[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv;
+		mInv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+		mInv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+		// Inverse translation: -L^-1 t
+		for(int i = 0; i < 3; ++i)
+			mInv[i][3] = -(mInv[i][0] * m[0][3] + mInv[i][1] * m[1][3] + mInv[i][2] * m[2][3]);
+	}
+};
+
+#endif//RAYTRACING_TRANSFORM_H
@@ -3,11 +3,16 @@
 #include "BVH.hpp"
 #include "Intersection.hpp"
 #include "Material.hpp"
+#include "MeshCache.hpp"
 #include "OBJ_Loader.hpp"
 #include "Object.hpp"
+#include "PLYLoader.hpp"
 #include "Triangle.hpp"
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <map>
+#include <mutex>
 
 bool rayTriangleIntersect(const Vector3f &v0, const Vector3f &v1,
                           const Vector3f &v2, const Vector3f &orig,
@@ -48,7 +53,14 @@ public:
 	Material *m;
 
 	Triangle(Vector3f _v0, Vector3f _v1, Vector3f _v2, Material *_m = nullptr)
-	    : v0(_v0), v1(_v1), v2(_v2), m(_m) {
+	    : m(_m) {
+		setVertices(_v0, _v1, _v2);
+	}
+
+	void setVertices(const Vector3f &_v0, const Vector3f &_v1, const Vector3f &_v2) {
+		v0     = _v0;
+		v1     = _v1;
+		v2     = _v2;
 		e1     = v1 - v0;
 		e2     = v2 - v0;
 		normal = normalize(crossProduct(e1, e2));
@@ -59,6 +71,7 @@ public:
 	bool intersect(const Ray &ray, float &tnear,
 	               uint32_t &index) const override;
 	Intersection getIntersection(Ray ray) override;
+	void intersectPacket(RayPacket &packet, Intersection *hits, uint32_t active) override;
 	void getSurfaceProperties(const Vector3f &P, const Vector3f &I,
 	                          const uint32_t &index, const Vector2f &uv,
 	                          Vector3f &N, Vector2f &st) const override {
@@ -68,10 +81,20 @@ public:
 	}
 	Vector3f evalDiffuseColor(const Vector2f &) const override;
 	Bounds3 getBounds() override;
+
+private:
+	// Moller-Trumbore test against the part of the ray in (tMin, tMax); t and barycentrics (u, v) of the hit
+	bool hit(const Ray &ray, bool cullBackFaces, double &t, double &u, double &v) const;
+	// Hit point from barycentrics, with its error bound
+	void setHitPoint(Intersection &inter, float u, float v) const;
+
+public:
+	Bounds3 getClippedBounds(const Bounds3 &box) override;
 	void Sample(Intersection &pos, float &pdf) {
 		float x = std::sqrt(get_random_float()), y = get_random_float();
-		pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
+		setHitPoint(pos, x * (1.0f - y), x * y);
 		pos.normal = this->normal;
+		pos.emit   = m ? m->getEmission() : Vector3f(0.0f);
 		pdf        = 1.0f / area;
 	}
 	float getArea() {
@@ -80,56 +103,222 @@ public:
 	bool hasEmit() {
 		return m->hasEmission();
 	}
+	DirectionCone getNormalBounds() { return DirectionCone(normal, 1); }
+	void getMaterials(std::vector<Material *> &materials) { materials.push_back(m); }
 };
 
 class MeshTriangle: public Object {
 public:
-	MeshTriangle(const std::string &filename, Material *mt = new Material()) {
-		objl::Loader loader;
-		loader.LoadFile(filename);
+	// Triangles in one BVH leaf at most: SAH and SBVH builds stop splitting where a leaf of up to this many is cheaper,
+	// LBVH builds stop at this many
+	static constexpr int kLeafSize = 4;
+
+	// Load a mesh file. With mt == nullptr every mesh/usemtl group of an OBJ keeps the material from its MTL
+	// library (per-triangle material indices), so a whole multi-material asset ends up in one BVH. The path tracer
+	// has a single, diffuse material model: an MTL material contributes its Kd and Ke, while Ks, Ns and Ni are kept
+	// but do not affect the image.
+	MeshTriangle(const std::string &filename, Material *mt = defaultMaterial(),
+	             BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::NAIVE) {
 		area = 0;
 		m    = mt;
-		assert(loader.LoadedMeshes.size() == 1);
-		auto mesh = loader.LoadedMeshes[0];
 
+		// Reuse the indexed mesh and its flattened BVH from the binary cache when it is up to date
+		uint64_t hash = MeshCache::sourceHash(filename, kLeafSize, splitMethod, !mt);
+		MeshCacheView cache;
+		if(MeshCache::load(filename, hash, cache)) {
+			vertices.reserve(cache.numVertices);
+			for(uint32_t i = 0; i < cache.numVertices; ++i)
+				vertices.emplace_back(cache.vertices[3 * i], cache.vertices[3 * i + 1], cache.vertices[3 * i + 2]);
+			vertexIndex.assign(cache.indices, cache.indices + 3 * cache.numTriangles);
+			numTriangles = cache.numTriangles;
+			if(!m && cache.numMaterials > 0) {
+				materialIndex.assign(cache.materialIds, cache.materialIds + cache.numTriangles);
+				materialTable.assign(cache.materials, cache.materials + cache.numMaterials);
+			}
+
+			buildTriangles();
+			bvh = std::make_unique<BVHAccel>(trianglePointers(), cache.nodes, cache.numNodes, cache.primOrder,
+			                                 cache.numPrimRefs, cache.file, kLeafSize, splitMethod);
+			return;
+		}
+
+		bool ply    = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ply") == 0;
+		bool loaded = ply ? loadPLY(filename) : loadOBJ(filename);
+		if(!loaded) {
+			// Nothing of a file that failed to load is kept, let alone cached: the mesh is empty
+			std::cerr << "Could not load " << filename << "; the mesh is left empty\n";
+			vertices.clear();
+			vertexIndex.clear();
+			materialIndex.clear();
+			materialTable.clear();
+			numTriangles = 0;
+		}
+		buildTriangles();
+		bvh = std::make_unique<BVHAccel>(trianglePointers(), kLeafSize, splitMethod);
+		if(!loaded)
+			return;
+
+		std::vector<float> positions;
+		positions.reserve(3 * vertices.size());
+		for(const auto &vert: vertices)
+			positions.insert(positions.end(), {vert.x, vert.y, vert.z});
+		std::vector<uint32_t> primOrder(bvh->primitives.size());
+		for(size_t i = 0; i < primOrder.size(); ++i)
+			primOrder[i] = static_cast<Triangle *>(bvh->primitives[i]) - triangles.data();
+
+		MeshCacheView data;
+		data.vertices     = positions.data();
+		data.numVertices  = vertices.size();
+		data.indices      = vertexIndex.data();
+		data.numTriangles = numTriangles;
+		data.primOrder    = primOrder.data();
+		data.numPrimRefs  = primOrder.size();
+		data.nodes        = bvh->nodes;
+		data.numNodes     = bvh->totalNodes;
+		if(!materialIndex.empty()) {
+			data.materialIds  = materialIndex.data();
+			data.materials    = materialTable.data();
+			data.numMaterials = materialTable.size();
+		}
+		MeshCache::store(filename, hash, data);
+	}
+
+	// Fill the indexed arrays (vertices/vertexIndex) from every mesh of an OBJ file; false if it cannot be read or
+	// holds no mesh
+	bool loadOBJ(const std::string &filename) {
+		objl::Loader loader;
+		if(!loader.LoadFile(filename) || loader.LoadedMeshes.empty())
+			return false;
+
+		std::map<std::string, uint32_t> slots;
+		for(const auto &mesh: loader.LoadedMeshes) {
+			uint32_t base = vertices.size();
+			for(const auto &vert: mesh.Vertices)
+				vertices.emplace_back(vert.Position.X, vert.Position.Y, vert.Position.Z);
+			for(auto index: mesh.Indices)
+				vertexIndex.push_back(base + index);
+			if(m)
+				continue;
+
+			// One material slot per distinct MTL material, groups without one share a default slot
+			std::string name = mesh.MeshMaterial ? mesh.MeshMaterial->name : std::string();
+			auto slot        = slots.find(name);
+			if(slot == slots.end()) {
+				MeshCacheMaterial mat;
+				objl::Material src = mesh.MeshMaterial.value_or(objl::Material());
+				if(!mesh.MeshMaterial)
+					src.Kd = objl::Vector3(0.8f, 0.8f, 0.8f);
+				mat.Kd[0] = src.Kd.X, mat.Kd[1] = src.Kd.Y, mat.Kd[2] = src.Kd.Z;
+				mat.Ks[0] = src.Ks.X, mat.Ks[1] = src.Ks.Y, mat.Ks[2] = src.Ks.Z;
+				mat.Ke[0] = src.Ke.X, mat.Ke[1] = src.Ke.Y, mat.Ke[2] = src.Ke.Z;
+				mat.Ns    = src.Ns;
+				mat.Ni    = src.Ni;
+				slot      = slots.emplace(name, materialTable.size()).first;
+				materialTable.push_back(mat);
+			}
+			materialIndex.insert(materialIndex.end(), mesh.Indices.size() / 3, slot->second);
+		}
+		numTriangles = vertexIndex.size() / 3;
+		return true;
+	}
+
+	// Move the mesh's vertices (same topology) and refit its BVH instead of rebuilding it
+	BVHAccel::UpdateStats updateVertices(const std::vector<Vector3f> &positions, float rebuildThreshold = 1.5f) {
+		vertices = positions;
+		Vector3f min_vert(std::numeric_limits<float>::infinity()), max_vert(-std::numeric_limits<float>::infinity());
+		for(const auto &vert: vertices) {
+			min_vert = Vector3f::Min(min_vert, vert);
+			max_vert = Vector3f::Max(max_vert, vert);
+		}
+		bounding_box = Bounds3(min_vert, max_vert);
+
+		area = 0;
+		for(uint32_t k = 0; k < numTriangles; ++k) {
+			triangles[k].setVertices(vertices[vertexIndex[k * 3]], vertices[vertexIndex[k * 3 + 1]], vertices[vertexIndex[k * 3 + 2]]);
+			area += triangles[k].area;
+		}
+		float cdf = 0;
+		for(size_t i = 0; i < emitTriangles.size(); ++i) {
+			cdf += triangles[emitTriangles[i]].area;
+			emitCdf[i] = cdf;
+		}
+		if(emitArea > 0)
+			emitArea = cdf;
+		return bvh->update(rebuildThreshold);
+	}
+
+	// Wall time of building the mesh's BVH from scratch over its current vertices, as the constructor does without a
+	// cache; the BVH in use is left alone. A BVH loaded from the cache took no build time of its own to compare with.
+	double timeFullBuild() { return BVHAccel(trianglePointers(), kLeafSize, bvh->splitMethod).buildTimeMs; }
+
+	// Stream a binary PLY file straight into the indexed arrays; false, with the reason reported, if the file is
+	// unreadable, malformed or truncated
+	bool loadPLY(const std::string &filename) {
+		PLYLoader loader;
+		if(!loader.LoadFile(filename, vertices, vertexIndex)) {
+			std::cerr << "PLYLoader: " << loader.error << "\n";
+			return false;
+		}
+		numTriangles = vertexIndex.size() / 3;
+		return true;
+	}
+
+	// Create one Triangle per indexed face and accumulate bounds and area
+	void buildTriangles() {
 		Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
 		                             std::numeric_limits<float>::infinity(),
 		                             std::numeric_limits<float>::infinity()};
 		Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
 		                             -std::numeric_limits<float>::infinity(),
 		                             -std::numeric_limits<float>::infinity()};
-		for(int i = 0; i < mesh.Vertices.size(); i += 3) {
-			std::array<Vector3f, 3> face_vertices;
-
-			for(int j = 0; j < 3; j++) {
-				auto vert        = Vector3f(mesh.Vertices[i + j].Position.X,
-				                            mesh.Vertices[i + j].Position.Y,
-				                            mesh.Vertices[i + j].Position.Z);
-				face_vertices[j] = vert;
-
-				min_vert = Vector3f(std::min(min_vert.x, vert.x),
-				                    std::min(min_vert.y, vert.y),
-				                    std::min(min_vert.z, vert.z));
-				max_vert = Vector3f(std::max(max_vert.x, vert.x),
-				                    std::max(max_vert.y, vert.y),
-				                    std::max(max_vert.z, vert.z));
-			}
+		for(const auto &vert: vertices) {
+			min_vert = Vector3f::Min(min_vert, vert);
+			max_vert = Vector3f::Max(max_vert, vert);
+		}
+		bounding_box = Bounds3(min_vert, max_vert);
 
-			triangles.emplace_back(face_vertices[0], face_vertices[1],
-			                       face_vertices[2], mt);
+		// Reserved up front: triangles keep pointers into ownedMaterials. DIFFUSE is the only material type there is,
+		// so every MTL material becomes one
+		ownedMaterials.reserve(materialTable.size());
+		for(const auto &mat: materialTable) {
+			ownedMaterials.emplace_back(DIFFUSE, Vector3f(mat.Ke[0], mat.Ke[1], mat.Ke[2]));
+			Material *material         = &ownedMaterials.back();
+			material->Kd               = Vector3f(mat.Kd[0], mat.Kd[1], mat.Kd[2]);
+			material->Ks               = Vector3f(mat.Ks[0], mat.Ks[1], mat.Ks[2]);
+			material->specularExponent = mat.Ns;
+			material->ior              = mat.Ni;
 		}
+		if(!m && ownedMaterials.empty())
+			m = defaultMaterial();
 
-		bounding_box = Bounds3(min_vert, max_vert);
+		triangles.reserve(numTriangles);
+		for(uint32_t k = 0; k < numTriangles; ++k) {
+			Material *material = materialIndex.empty() ? m : &ownedMaterials[materialIndex[k]];
+			triangles.emplace_back(vertices[vertexIndex[k * 3]], vertices[vertexIndex[k * 3 + 1]],
+			                       vertices[vertexIndex[k * 3 + 2]], material);
+			area += triangles.back().area;
+		}
 
+		// Area CDF over the emissive triangles, used to sample this mesh as a light
+		emitArea = 0;
+		for(uint32_t k = 0; k < numTriangles; ++k) {
+			if(triangles[k].hasEmit()) {
+				emitArea += triangles[k].area;
+				emitTriangles.push_back(k);
+				emitCdf.push_back(emitArea);
+			}
+		}
+	}
+
+	std::vector<Object *> trianglePointers() {
 		std::vector<Object *> ptrs;
-		for(auto &tri: triangles) {
+		ptrs.reserve(triangles.size());
+		for(auto &tri: triangles)
 			ptrs.push_back(&tri);
-			area += tri.area;
-		}
-		bvh = new BVHAccel(ptrs);
+		return ptrs;
 	}
 
-	bool intersect(const Ray &ray) { return true; }
+	bool intersect(const Ray &ray) { return bvh && bvh->IntersectP(ray); }
 
 	bool intersect(const Ray &ray, float &tnear, uint32_t &index) const {
 		bool intersect = false;
@@ -181,36 +370,89 @@ public:
 		if(bvh) {
 			intersec = bvh->Intersect(ray);
 		}
+		// Hits report the mesh, not the triangle, as the object hit
+		if(intersec.happened)
+			intersec.obj = this;
 
 		return intersec;
 	}
+	void intersectPacket(RayPacket &packet, Intersection *hits, uint32_t active) {
+		if(!bvh)
+			return;
+		// Hits report the mesh, not the triangle, as the object hit
+		bvh->IntersectPacket(packet, hits, active, this);
+	}
 
 	void Sample(Intersection &pos, float &pdf) {
-		bvh->Sample(pos, pdf);
-		pos.emit = m->getEmission();
+		// A mesh without emitters is sampled over all of its triangles (an instance may override its
+		// material with an emissive one); that CDF is only built on first use
+		std::call_once(surfaceCdfOnce, [this]() {
+			for(uint32_t k = 0; emitArea == 0 && k < numTriangles; ++k) {
+				emitTriangles.push_back(k);
+				emitCdf.push_back((k ? emitCdf.back() : 0) + triangles[k].area);
+			}
+		});
+
+		// Pick an emissive triangle proportional to its area, then a point on it
+		float total   = emitCdf.back();
+		float p       = get_random_float() * total;
+		size_t i      = std::min<size_t>(std::upper_bound(emitCdf.begin(), emitCdf.end(), p) - emitCdf.begin(), emitCdf.size() - 1);
+		Triangle &tri = triangles[emitTriangles[i]];
+		tri.Sample(pos, pdf);
+		pos.emit = tri.m->getEmission();
+		pdf      = 1.0f / total;
 	}
 	float getArea() {
 		return area;
 	}
+	float getEmitArea() {
+		return emitArea;
+	}
 	bool hasEmit() {
-		return m->hasEmission();
+		return emitArea > 0;
+	}
+	void getEmitters(std::vector<Object *> &emitters) {
+		// Without emissive triangles emitTriangles may hold the whole surface, for instances (see Sample)
+		if(emitArea > 0)
+			for(uint32_t k: emitTriangles)
+				emitters.push_back(&triangles[k]);
+	}
+	void getMaterials(std::vector<Material *> &materials) {
+		if(ownedMaterials.empty())
+			materials.push_back(m);
+		for(Material &material: ownedMaterials)
+			materials.push_back(&material);
 	}
 
 	Bounds3 bounding_box;
-	std::unique_ptr<Vector3f[]> vertices;
-	uint32_t numTriangles;
-	std::unique_ptr<uint32_t[]> vertexIndex;
+	std::vector<Vector3f> vertices;
+	uint32_t numTriangles = 0;
+	std::vector<uint32_t> vertexIndex;
 	std::unique_ptr<Vector2f[]> stCoordinates;
 
 	std::vector<Triangle> triangles;
 
-	BVHAccel *bvh;
+	// Per-triangle material slots into materialTable (empty: every triangle uses m)
+	std::vector<uint32_t> materialIndex;
+	std::vector<MeshCacheMaterial> materialTable;
+	std::vector<Material> ownedMaterials;
+
+	std::vector<uint32_t> emitTriangles;
+	std::vector<float> emitCdf;
+	float emitArea = 0;
+	std::once_flag surfaceCdfOnce;
+
+	std::unique_ptr<BVHAccel> bvh;
 	float area;
 
 	Material *m;
 };
 
-inline bool Triangle::intersect(const Ray &ray) { return true; }
+// Any hit in [tMin, tMax), from either side: occlusion must not depend on which way the surface faces
+inline bool Triangle::intersect(const Ray &ray) {
+	double t, u, v;
+	return hit(ray, false, t, u, v);
+}
 inline bool Triangle::intersect(const Ray &ray, float &tnear,
                                 uint32_t &index) const {
 	return false;
@@ -218,34 +460,74 @@ inline bool Triangle::intersect(const Ray &ray, float &tnear,
 
 inline Bounds3 Triangle::getBounds() { return Union(Bounds3(v0, v1), v2); }
 
-inline Intersection Triangle::getIntersection(Ray ray) {
-	Intersection inter;
+inline Bounds3 Triangle::getClippedBounds(const Bounds3 &box) {
+	// Sutherland-Hodgman: clip the triangle against the six planes of box; at most nine vertices remain
+	Vector3f poly[10] = {v0, v1, v2}, clipped[10];
+	int n = 3;
+	for(int axis = 0; axis < 3 && n > 0; ++axis) {
+		for(int side = 0; side < 2 && n > 0; ++side) {
+			float plane = side ? (&box.pMax.x)[axis] : (&box.pMin.x)[axis];
+			auto inside = [&](const Vector3f &p) { return side ? (&p.x)[axis] <= plane : (&p.x)[axis] >= plane; };
+			int kept    = 0;
+			for(int i = 0; i < n; ++i) {
+				const Vector3f &a = poly[i], &b = poly[(i + 1) % n];
+				if(inside(a))
+					clipped[kept++] = a;
+				if(inside(a) != inside(b)) {
+					float t                  = (plane - (&a.x)[axis]) / ((&b.x)[axis] - (&a.x)[axis]);
+					clipped[kept]            = a + (b - a) * t;
+					(&clipped[kept].x)[axis] = plane;
+					++kept;
+				}
+			}
+			std::copy(clipped, clipped + kept, poly);
+			n = kept;
+		}
+	}
+	Bounds3 bounds;
+	for(int i = 0; i < n; ++i)
+		bounds = Union(bounds, poly[i]);
+	return bounds;
+}
 
-	if(dotProduct(ray.direction, normal) > 0)
-		return inter;
-	double u, v, t_tmp = 0;
+inline bool Triangle::hit(const Ray &ray, bool cullBackFaces, double &t, double &u, double &v) const {
+	if(cullBackFaces && dotProduct(ray.direction, normal) > 0)
+		return false;
 	Vector3f pvec = crossProduct(ray.direction, e2);
 	double det    = dotProduct(e1, pvec);
 	if(fabs(det) < EPSILON)
-		return inter;
+		return false;
 
 	double det_inv = 1. / det;
 	Vector3f tvec  = ray.origin - v0;
 	u              = dotProduct(tvec, pvec) * det_inv;
 	if(u < 0 || u > 1)
-		return inter;
+		return false;
 	Vector3f qvec = crossProduct(tvec, e1);
 	v             = dotProduct(ray.direction, qvec) * det_inv;
 	if(v < 0 || u + v > 1)
-		return inter;
-	t_tmp = dotProduct(e2, qvec) * det_inv;
+		return false;
+	t = dotProduct(e2, qvec) * det_inv;
 
-	// find ray triangle intersection
-	if(t_tmp > 0) {
+	// only the part of the ray that is still of interest counts
+	return t > ray.tMin && t < ray.tMax;
+}
+
+inline void Triangle::setHitPoint(Intersection &inter, float u, float v) const {
+	// Interpolating the vertices is far more accurate than o + t * d, and its error is easy to bound
+	float b0     = 1 - u - v;
+	inter.coords = v0 * b0 + v1 * u + v2 * v;
+	inter.pError = (Vector3f::Abs(v0 * b0) + Vector3f::Abs(v1 * u) + Vector3f::Abs(v2 * v)) * errorGamma(7);
+}
+
+inline Intersection Triangle::getIntersection(Ray ray) {
+	Intersection inter;
+	double t, u, v;
+	if(hit(ray, true, t, u, v)) {
 		inter.happened = true;
-		inter.coords   = ray.origin + ray.direction * t_tmp;
+		setHitPoint(inter, u, v);
 		inter.normal   = normal;
-		inter.distance = t_tmp;
+		inter.distance = t;
 		inter.obj      = this;
 		inter.m        = this->m;
 	}
@@ -253,6 +535,20 @@ inline Intersection Triangle::getIntersection(Ray ray) {
 	return inter;
 }
 
+inline void Triangle::intersectPacket(RayPacket &packet, Intersection *hits, uint32_t active) {
+	PacketTriangle tri = {{v0.x, v0.y, v0.z}, {e1.x, e1.y, e1.z}, {e2.x, e2.y, e2.z}, {normal.x, normal.y, normal.z}, EPSILON};
+	for(uint32_t hit = simdKernels().intersectTriangle(tri, packet, active); hit; hit &= hit - 1) {
+		int i           = __builtin_ctz(hit);
+		Intersection &h = hits[i];
+		h.happened      = true;
+		h.distance      = packet.tMax[i];
+		setHitPoint(h, packet.u[i], packet.v[i]);
+		h.normal = normal;
+		h.obj    = this;
+		h.m      = this->m;
+	}
+}
+
 inline Vector3f Triangle::evalDiffuseColor(const Vector2f &) const {
 	return Vector3f(0.5, 0.5, 0.5);
 }
@@ -27,6 +27,7 @@ public:
 	Vector3f operator*(const Vector3f &v) const { return Vector3f(x * v.x, y * v.y, z * v.z); }
 	Vector3f operator-(const Vector3f &v) const { return Vector3f(x - v.x, y - v.y, z - v.z); }
 	Vector3f operator+(const Vector3f &v) const { return Vector3f(x + v.x, y + v.y, z + v.z); }
+	Vector3f operator/(const Vector3f &v) const { return Vector3f(x / v.x, y / v.y, z / v.z); }
 	Vector3f operator-() const { return Vector3f(-x, -y, -z); }
 	Vector3f &operator+=(const Vector3f &v) {
 		x += v.x, y += v.y, z += v.z;
@@ -34,8 +35,8 @@ public:
 	}
 	friend Vector3f operator*(const float &r, const Vector3f &v) { return Vector3f(v.x * r, v.y * r, v.z * r); }
 	friend std::ostream &operator<<(std::ostream &os, const Vector3f &v) { return os << v.x << ", " << v.y << ", " << v.z; }
-	double operator[](int index) const;
-	double &operator[](int index);
+	float operator[](int index) const;
+	float &operator[](int index);
 
 
 	static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
@@ -47,8 +48,17 @@ public:
 		return Vector3f(std::max(p1.x, p2.x), std::max(p1.y, p2.y),
 		                std::max(p1.z, p2.z));
 	}
+
+	static Vector3f Abs(const Vector3f &v) {
+		return Vector3f(std::fabs(v.x), std::fabs(v.y), std::fabs(v.z));
+	}
 };
-inline double Vector3f::operator[](int index) const {
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "arrays of Vector3f are written out as interleaved floats");
+
+inline float Vector3f::operator[](int index) const {
+	return (&x)[index];
+}
+inline float &Vector3f::operator[](int index) {
 	return (&x)[index];
 }
 
@@ -84,5 +94,17 @@ inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b) {
 	        a.x * b.y - a.y * b.x);
 }
 
+// Complete the unit vector N to an orthonormal basis (B, C, N)
+inline void coordinateSystem(const Vector3f &N, Vector3f &B, Vector3f &C) {
+	if(std::fabs(N.x) > std::fabs(N.y)) {
+		float invLen = 1.0f / std::sqrt(N.x * N.x + N.z * N.z);
+		C            = Vector3f(N.z * invLen, 0.0f, -N.x * invLen);
+	} else {
+		float invLen = 1.0f / std::sqrt(N.y * N.y + N.z * N.z);
+		C            = Vector3f(0.0f, N.z * invLen, -N.y * invLen);
+	}
+	B = crossProduct(C, N);
+}
+
 
 #endif//RAYTRACING_VECTOR_H
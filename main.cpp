@@ -1,49 +1,631 @@
+#include "ImageIO.hpp"
+#include "Instance.hpp"
+#include "MeshCache.hpp"
+#include "RenderServer.hpp"
 #include "Renderer.hpp"
 #include "Scene.hpp"
 #include "Sphere.hpp"
+#include "TileFarm.hpp"
 #include "Triangle.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
-// In the main function of the program, we create the scene (create objects and
-// lights) as well as set the options for the render (image width and height,
-// maximum recursion depth, field-of-view, etc.). We then call the render
-// function().
-int main(int argc, char **argv) {
+#ifdef HEAP_REPORT
+// Heap allocations made by the whole process, for the allocation report. Only benchmark builds (cmake -DHEAP_REPORT=ON)
+// replace the global allocator; every other build leaves operator new alone.
+static std::atomic<size_t> heapAllocations{0}, heapFrees{0};
 
-	// Change the definition here to change resolution
-	Scene scene(784, 784);
+void *operator new(size_t size) {
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if(void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+static void countedFree(void *p) {
+	if(p)
+		heapFrees.fetch_add(1, std::memory_order_relaxed);
+	std::free(p);
+}
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+
+// Runs after main has returned and the scene is gone: whatever is still live has leaked
+static struct HeapReport {
+	~HeapReport() {
+		printf("Heap: %zu allocations, %zu still live at exit\n", heapAllocations.load(), heapAllocations.load() - heapFrees.load());
+	}
+} heapReport;
+#endif
+
+// Build a BVH over prims with every builder and report build time, SAH cost, references and the time to trace a
+// fixed set of random rays through the scene bounds, to weigh build speed against trace speed.
+static void benchmarkBVH(const std::string &name, const std::vector<Object *> &prims) {
+	Bounds3 box;
+	for(Object *prim: prims)
+		box = Union(box, prim->getBounds());
+	Vector3f center = box.Centroid();
+	float radius    = 0.5f * box.Diagonal().norm();
+
+	constexpr int nRays = 1 << 19;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> u(0, 1);
+	std::vector<Ray> rays;
+	rays.reserve(nRays);
+	for(int i = 0; i < nRays; ++i) {
+		float z = 1 - 2 * u(rng), phi = 2 * M_PI * u(rng), r = std::sqrt(std::max(0.0f, 1 - z * z));
+		Vector3f origin = center + 2 * radius * Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+		Vector3f target = box.pMin + Vector3f(u(rng), u(rng), u(rng)) * box.Diagonal();
+		rays.emplace_back(origin, normalize(target - origin));
+	}
+
+	struct Config {
+		const char *name;
+		BVHAccel::SplitMethod method;
+		int treeletPasses;
+	};
+	const Config configs[] = {{"naive", BVHAccel::SplitMethod::NAIVE, 0},
+	                          {"sah", BVHAccel::SplitMethod::SAH, 0},
+	                          {"sbvh", BVHAccel::SplitMethod::SBVH, 0},
+	                          {"lbvh", BVHAccel::SplitMethod::LBVH, 0},
+	                          {"lbvh+treelet x1", BVHAccel::SplitMethod::LBVH, 1},
+	                          {"lbvh+treelet x3", BVHAccel::SplitMethod::LBVH, 3}};
+	std::vector<std::string> lines;
+	for(const Config &config: configs) {
+		BVHAccel::lbvhTreeletPasses = config.treeletPasses;
+		BVHAccel bvh(prims, MeshTriangle::kLeafSize, config.method);
+		char line[320];
+		snprintf(line, sizeof(line), "%-16s build %9.2f ms  SAH %8.2f  refs %8zu", config.name, bvh.buildTimeMs, bvh.SAHCost(),
+		         bvh.primitives.size());
+		lines.push_back(line);
+		// Timed pass, then a measurement pass counting the node memory each ray touches
+		auto trace = [&](const char *layout, size_t bytes) {
+			int hits   = 0;
+			auto start = std::chrono::steady_clock::now();
+			for(const Ray &ray: rays)
+				hits += bvh.Intersect(ray).happened;
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			BVHAccel::TraversalStats stats;
+			for(const Ray &ray: rays)
+				bvh.Intersect(ray, stats);
+			snprintf(line, sizeof(line), "  %-13s trace %9.2f ms (%.2f Mrays/s, %d hits, %zu KiB)  per ray: %.1f nodes, %.1f lines, %.1f pages",
+			         layout, ms, nRays / ms / 1000, hits, bytes / 1024, double(stats.nodes) / stats.rays,
+			         double(stats.cacheLines) / stats.rays, double(stats.pages) / stats.rays);
+			lines.push_back(line);
+		};
+		trace("depth-first", bvh.nodeBytes());
+		bvh.reorderNodes();
+		trace("van Emde Boas", bvh.nodeBytes());
+		bvh.compress();
+		trace("compressed", bvh.compressedNodeBytes());
+	}
+	printf("%s: %zu primitives, %d rays\n", name.c_str(), prims.size(), nRays);
+	for(const std::string &line: lines)
+		printf("%s\n", line.c_str());
+}
 
-	Material *red   = new Material(DIFFUSE, Vector3f(0.0f));
+// "cornell" (the Cornell box meshes), "slivers[:N]" (N long, thin, diagonal triangles) or a mesh file
+static void benchmarkBVH(const std::string &what) {
+	MeshCache::enabled = false;
+	Material material;
+	std::vector<std::unique_ptr<MeshTriangle>> meshes;
+	std::vector<Triangle> slivers;
+	std::vector<Object *> prims;
+	if(what == "cornell") {
+		for(const char *part: {"floor", "shortbox", "tallbox", "left", "right", "light"})
+			meshes.push_back(std::make_unique<MeshTriangle>(std::string("../models/cornellbox/") + part + ".obj", &material));
+	} else if(what == "slivers" || what.compare(0, 8, "slivers:") == 0) {
+		int n = what.size() > 8 ? std::stoi(what.substr(8)) : 20000;
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<float> u(0, 1);
+		slivers.reserve(n);
+		for(int i = 0; i < n; ++i) {
+			// Runs 30 units diagonally through a 100^3 room but is only a fraction of a unit wide
+			Vector3f a(100 * u(rng), 100 * u(rng), 100 * u(rng));
+			Vector3f along = 30 * normalize(Vector3f(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f));
+			Vector3f side  = 0.2f * normalize(Vector3f(u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f));
+			slivers.emplace_back(a, a + along, a + side, &material);
+		}
+		for(Triangle &t: slivers)
+			prims.push_back(&t);
+	} else {
+		meshes.push_back(std::make_unique<MeshTriangle>(what, &material, BVHAccel::SplitMethod::SAH));
+	}
+	for(auto &mesh: meshes)
+		for(Object *prim: mesh->trianglePointers())
+			prims.push_back(prim);
+	benchmarkBVH(what, prims);
+}
+
+// Image resolution; render service jobs can ask for another one
+static constexpr int kImageWidth = 784, kImageHeight = 784;
+
+// How the scene is put together, from the command line
+struct SceneSetup {
+	std::string importPath;// OBJ asset rendered instead of the Cornell box
+	BVHAccel::SplitMethod importSplit = BVHAccel::SplitMethod::SAH;// how the asset's BVH is built
+	int numInstances    = 0;
+	bool compressBVH    = false;
+	bool reorderBVH     = false;
+	int numLights       = 0;
+	Scene::LightSampling lightSampling = Scene::LightSampling::BVH;
+	int lightCandidates = 1;
+};
+
+// Create the materials, load the meshes, add the instances and lights and build every BVH. meshes and instances
+// receive the loaded meshes and the instances, for animating them.
+static void buildScene(Scene &scene, const SceneSetup &setup, std::vector<MeshTriangle *> &meshes, std::vector<Instance *> &instances) {
+	// Meshes, materials and instances live in the scene's arena and are released together with the scene
+	Material *red   = scene.make<Material>(DIFFUSE, Vector3f(0.0f));
 	red->Kd         = Vector3f(0.63f, 0.065f, 0.05f);
-	Material *green = new Material(DIFFUSE, Vector3f(0.0f));
+	Material *green = scene.make<Material>(DIFFUSE, Vector3f(0.0f));
 	green->Kd       = Vector3f(0.14f, 0.45f, 0.091f);
-	Material *white = new Material(DIFFUSE, Vector3f(0.0f));
+	Material *white = scene.make<Material>(DIFFUSE, Vector3f(0.0f));
 	white->Kd       = Vector3f(0.725f, 0.71f, 0.68f);
-	Material *light = new Material(DIFFUSE, (8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f) + 15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f) + 18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f)));
+	Material *light = scene.make<Material>(DIFFUSE, (8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f) + 15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f) + 18.4f * Vector3f(0.737f + 0.642f, 0.737f + 0.159f, 0.737f)));
 	light->Kd       = Vector3f(0.65f);
 
-	MeshTriangle floor("../models/cornellbox/floor.obj", white);
-	MeshTriangle shortbox("../models/cornellbox/shortbox.obj", white);
-	MeshTriangle tallbox("../models/cornellbox/tallbox.obj", white);
-	MeshTriangle left("../models/cornellbox/left.obj", red);
-	MeshTriangle right("../models/cornellbox/right.obj", green);
-	MeshTriangle light_("../models/cornellbox/light.obj", light);
+	auto loadStart = std::chrono::steady_clock::now();
+	if(!setup.importPath.empty()) {
+		// A whole multi-material OBJ asset becomes one object with one BVH
+		meshes.push_back(scene.make<MeshTriangle>(setup.importPath, nullptr, setup.importSplit));
+	} else {
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/floor.obj", white));
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/shortbox.obj", white));
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/tallbox.obj", white));
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/left.obj", red));
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/right.obj", green));
+		meshes.push_back(scene.make<MeshTriangle>("../models/cornellbox/light.obj", light));
+	}
+	auto loadStop = std::chrono::steady_clock::now();
+	std::cout << "Scene load: " << std::chrono::duration<double, std::milli>(loadStop - loadStart).count() << " ms\n";
+
+	for(MeshTriangle *mesh: meshes)
+		scene.Add(mesh);
+
+	// Scatter copies of one bottom-level mesh over the floor; every copy shares its triangles and BVH
+	if(setup.numInstances > 0) {
+		MeshTriangle *blas = scene.make<MeshTriangle>("../models/cornellbox/shortbox.obj", white);
+		if(setup.reorderBVH)
+			blas->bvh->reorderNodes();
+		if(setup.compressBVH)
+			blas->bvh->compress();
+		Bounds3 box        = blas->getBounds();
+		Vector3f center    = box.Centroid();
+		float size         = std::max(box.Diagonal().x, box.Diagonal().z);
+		int perRow         = std::ceil(std::sqrt((float) setup.numInstances));
+		float spacing      = 500.0f / perRow;
+		Transform toUnit   = Transform::Scale(Vector3f(0.5f * spacing / size)) * Transform::Translate(Vector3f(-center.x, 0, -center.z));
+		for(int i = 0; i < setup.numInstances; ++i) {
+			Vector3f pos(30 + spacing * (i % perRow + 0.5f), 0, 30 + spacing * (i / perRow + 0.5f));
+			instances.push_back(scene.make<Instance>(blas, Transform::Translate(pos) * Transform::RotateY(37.0f * i) * toUnit, i % 2 ? red : green));
+			scene.Add(instances.back());
+		}
+		std::cout << "Instances: " << setup.numInstances << " x " << blas->numTriangles << " triangles, "
+		          << setup.numInstances * sizeof(Instance) / 1024 << " KiB of instance data\n";
+	}
 
-	scene.Add(&floor);
-	scene.Add(&shortbox);
-	scene.Add(&tallbox);
-	scene.Add(&left);
-	scene.Add(&right);
-	scene.Add(&light_);
+	// Many-light rig: small emissive spheres under the ceiling, together as bright as the ceiling light
+	if(setup.numLights > 0) {
+		float radius     = 4.0f;
+		float lightArea  = 130.0f * 105.0f;// the ceiling light's quad
+		Material *bulb   = scene.make<Material>(DIFFUSE, light->getEmission() * (lightArea / (setup.numLights * 4 * M_PI * radius * radius)));
+		bulb->Kd         = Vector3f(0.65f);
+		std::mt19937 rng(11);
+		std::uniform_real_distribution<float> u(0, 1);
+		for(int i = 0; i < setup.numLights; ++i)
+			scene.Add(scene.make<Sphere>(Vector3f(40 + 470 * u(rng), 380 + 150 * u(rng), 40 + 470 * u(rng)), radius, bulb));
+	}
+	scene.lightSampling   = setup.lightSampling;
+	scene.lightCandidates = setup.lightCandidates;
 
 	scene.buildBVH();
+	printf("Lights: %zu emitters, %s sampling\n", scene.get_emitters().size(),
+	       scene.lightSampling == Scene::LightSampling::BVH ? "light BVH" : "area");
+	if(setup.reorderBVH) {
+		// Cache-oblivious node order for every mesh and the top level
+		for(MeshTriangle *mesh: meshes)
+			mesh->bvh->reorderNodes();
+		scene.bvh->reorderNodes();
+	}
+	if(setup.compressBVH) {
+		// 8-bit quantized 4-wide nodes, one cache line each, for every mesh and the top level
+		size_t bytes = 0, compressedBytes = 0;
+		for(MeshTriangle *mesh: meshes) {
+			mesh->bvh->compress();
+			bytes += mesh->bvh->nodeBytes();
+			compressedBytes += mesh->bvh->compressedNodeBytes();
+		}
+		scene.bvh->compress();
+		printf("BVH nodes: %zu KiB binary, %zu KiB compressed\n", (bytes + scene.bvh->nodeBytes()) / 1024,
+		       (compressedBytes + scene.bvh->compressedNodeBytes()) / 1024);
+	}
+}
+
+// path with _NNN inserted before its extension: the output of view NNN of a batch
+static std::string viewOutput(const std::string &path, int index) {
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "_%03d", index);
+	size_t dot = path.find_last_of('.');
+	if(dot == std::string::npos || path.find('/', dot) != std::string::npos)
+		return path + suffix;
+	return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+// Read a list of views, one per line: "perspective ex ey ez tx ty tz fov output [ux uy uz]" or
+// "orthographic ex ey ez tx ty tz height output [ux uy uz]", looking from e at t with u (by default +y) up. Blank lines
+// and lines starting with # are skipped. False, with the offending line reported, if the file cannot be read or a line
+// is malformed.
+static bool readViews(const std::string &path, std::vector<Renderer::View> &views) {
+	std::ifstream file(path);
+	if(!file) {
+		printf("Could not read %s\n", path.c_str());
+		return false;
+	}
+	std::string line;
+	for(int number = 1; std::getline(file, line); ++number) {
+		std::istringstream words(line);
+		std::string kind, output;
+		Vector3f eye, target;
+		float size;
+		if(!(words >> kind) || kind[0] == '#')
+			continue;
+		bool parsed = words >> eye.x >> eye.y >> eye.z >> target.x >> target.y >> target.z >> size >> output &&
+		              (kind == "perspective" || kind == "orthographic");
+		Vector3f up(0, 1, 0);
+		std::string extra;
+		if(parsed && !(words >> std::ws).eof())
+			parsed = words >> up.x >> up.y >> up.z && !(words >> extra);
+		Camera camera = kind == "perspective" ? Camera::lookAt(eye, target, up, size) : Camera::orthographic(eye, target, up, size);
+		if(!parsed || !camera.valid()) {
+			printf("%s:%d: expected perspective|orthographic ex ey ez tx ty tz fov|height output [ux uy uz]\n", path.c_str(), number);
+			return false;
+		}
+		views.push_back({camera, output});
+	}
+	return true;
+}
+
+// Render the image with a farm of worker processes (this program with the same arguments, less the farm's own) and
+// write it. With scaling, render it with 1, 2, 4, ... and then workers workers and report the speedup of each.
+static int coordinateFarm(int argc, char **argv, const Renderer &r, int workers, bool scaling, double leaseTimeout) {
+	std::vector<std::string> command{"/proc/self/exe"};
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--farm" || arg == "--farm-scaling" || arg == "--farm-lease-timeout")
+			++i;
+		else
+			command.push_back(arg);
+	}
+	std::vector<int> counts;
+	for(int n = 1; scaling && n < workers; n *= 2)
+		counts.push_back(n);
+	counts.push_back(workers);
+
+	TileFarm farm(command);
+	farm.leaseTimeout = leaseTimeout;
+	std::vector<Vector3f> image;
+	double baseline = 0;
+	for(int n: counts) {
+		TileFileWriter tileFile;
+		if(!r.tilePath.empty() && !tileFile.create(r.tilePath, kImageWidth, kImageHeight, r.tileSize))
+			printf("Could not create %s\n", r.tilePath.c_str());
+		FarmStats stats;
+		bool complete = farm.render(n, kImageWidth, kImageHeight, r.tileSize, image, stats, [&](int index, const Tile &tile) {
+			if(!r.tilePath.empty())
+				tileFile.append(index, tile, image);
+		});
+		if(!complete) {
+			printf("Farm: every worker died before the image was complete\n");
+			return 1;
+		}
+		printf("Farm: %d workers, setup %.1f ms, render %.1f ms", n, stats.setupMs, stats.renderMs);
+		// Against the time of a single worker
+		if(scaling) {
+			if(n == 1)
+				baseline = stats.renderMs;
+			printf(", speedup %.2f, efficiency %.0f%%", baseline / stats.renderMs, 100 * baseline / (stats.renderMs * n));
+		}
+		printf(", %d tiles reassigned, %d workers timed out; tiles per worker:", stats.reassigned, stats.expired);
+		for(int tiles: stats.tilesPerWorker)
+			printf(" %d", tiles);
+		printf("\n");
+	}
+	if(!writeImage(r.outputPath, kImageWidth, kImageHeight, 3, reinterpret_cast<const float *>(image.data()))) {
+		printf("Could not write %s\n", r.outputPath.c_str());
+		return 1;
+	}
+	return 0;
+}
 
+// In the main function of the program, we create the scene (create objects and
+// lights) as well as set the options for the render (image width and height,
+// maximum recursion depth, field-of-view, etc.). We then call the render
+// function().
+int main(int argc, char **argv) {
+	SceneSetup setup;
+	int animateFrames = 0;
+	bool serveStdio   = false;
+	std::string servePath;
+	int farmWorkers   = 0;
+	bool farmScaling  = false;
+	int farmWorkerFd  = -1;
+	double farmLeaseTimeout = 300;// seconds
+	int turntableViews = 0;// views of a turntable batch
+	std::string viewsPath;
 	Renderer r;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--no-cache")
+			MeshCache::enabled = false;
+		else if(arg == "--obj" && i + 1 < argc)
+			setup.importPath = argv[++i];
+		else if(arg == "--split" && i + 1 < argc) {
+			std::string method = argv[++i];
+			if(method == "naive")
+				setup.importSplit = BVHAccel::SplitMethod::NAIVE;
+			else if(method == "sah")
+				setup.importSplit = BVHAccel::SplitMethod::SAH;
+			else if(method == "sbvh")
+				setup.importSplit = BVHAccel::SplitMethod::SBVH;
+			else if(method == "lbvh")
+				setup.importSplit = BVHAccel::SplitMethod::LBVH;
+			else {
+				printf("Split method %s is unknown; use naive, sah, sbvh or lbvh\n", argv[i]);
+				return 1;
+			}
+		}
+		else if(arg == "--instances" && i + 1 < argc)
+			setup.numInstances = std::stoi(argv[++i]);
+		else if(arg == "--animate" && i + 1 < argc)
+			animateFrames = std::stoi(argv[++i]);
+		else if(arg == "--compress-bvh")
+			setup.compressBVH = true;
+		else if(arg == "--reorder-bvh")
+			setup.reorderBVH = true;
+		else if(arg == "--lights" && i + 1 < argc)
+			setup.numLights = std::stoi(argv[++i]);
+		else if(arg == "--light-sampling" && i + 1 < argc)
+			setup.lightSampling = std::string(argv[++i]) == "area" ? Scene::LightSampling::Area : Scene::LightSampling::BVH;
+		else if(arg == "--spp" && i + 1 < argc)
+			r.spp = std::stoi(argv[++i]);
+		else if(arg == "--ris" && i + 1 < argc)
+			setup.lightCandidates = std::stoi(argv[++i]);
+		else if(arg == "--restir")
+			r.restir.enabled = true;
+		else if(arg == "--restir-candidates" && i + 1 < argc)
+			r.restir.candidates = std::stoi(argv[++i]);
+		else if(arg == "--restir-spatial" && i + 1 < argc)
+			r.restir.spatialNeighbors = std::stoi(argv[++i]);
+		else if(arg == "--restir-radius" && i + 1 < argc)
+			r.restir.spatialRadius = std::stoi(argv[++i]);
+		else if(arg == "--restir-temporal")
+			r.restir.temporal = true;
+		else if(arg == "--restir-history" && i + 1 < argc)
+			r.restir.maxHistory = std::stoi(argv[++i]);
+		else if(arg == "--aov")
+			r.writeAOVs = true;
+		else if(arg == "--aov-format" && i + 1 < argc)
+			r.aovFormat = std::string(".") + argv[++i];
+		else if(arg == "--output" && i + 1 < argc)
+			r.outputPath = argv[++i];
+		else if(arg == "--look-at" && i + 6 < argc) {
+			r.camera.eye    = Vector3f(std::stof(argv[i + 1]), std::stof(argv[i + 2]), std::stof(argv[i + 3]));
+			r.camera.target = Vector3f(std::stof(argv[i + 4]), std::stof(argv[i + 5]), std::stof(argv[i + 6]));
+			i += 6;
+		}
+		else if(arg == "--up" && i + 3 < argc) {
+			r.camera.up = Vector3f(std::stof(argv[i + 1]), std::stof(argv[i + 2]), std::stof(argv[i + 3]));
+			i += 3;
+		}
+		else if(arg == "--fov" && i + 1 < argc) {
+			r.camera.projection = Camera::Projection::Perspective;
+			r.camera.fov        = std::stof(argv[++i]);
+		}
+		else if(arg == "--ortho" && i + 1 < argc) {
+			r.camera.projection = Camera::Projection::Orthographic;
+			r.camera.viewHeight = std::stof(argv[++i]);
+		}
+		else if(arg == "--turntable" && i + 1 < argc)
+			turntableViews = std::stoi(argv[++i]);
+		else if(arg == "--views" && i + 1 < argc)
+			viewsPath = argv[++i];
+		else if(arg == "--seed" && i + 1 < argc)
+			r.seed = std::stoull(argv[++i]);
+		else if(arg == "--checkpoint" && i + 1 < argc)
+			r.checkpoint.path = argv[++i];
+		else if(arg == "--resume" && i + 1 < argc) {
+			r.checkpoint.path   = argv[++i];
+			r.checkpoint.resume = true;
+		}
+		else if(arg == "--checkpoint-interval" && i + 1 < argc)
+			r.checkpoint.interval = std::stof(argv[++i]);
+		else if(arg == "--checkpoint-round" && i + 1 < argc)
+			r.checkpoint.roundSamples = std::stoi(argv[++i]);
+		else if(arg == "--farm" && i + 1 < argc)
+			farmWorkers = std::stoi(argv[++i]);
+		else if(arg == "--farm-scaling" && i + 1 < argc) {
+			farmWorkers = std::stoi(argv[++i]);
+			farmScaling = true;
+		}
+		else if(arg == "--farm-lease-timeout" && i + 1 < argc)
+			farmLeaseTimeout = std::stod(argv[++i]);
+		else if(arg == "--farm-worker" && i + 1 < argc)
+			farmWorkerFd = std::stoi(argv[++i]);
+		else if(arg == "--serve")
+			serveStdio = true;
+		else if(arg == "--serve-socket" && i + 1 < argc)
+			servePath = argv[++i];
+		else if(arg == "--crop" && i + 4 < argc) {
+			r.region.crop = Tile{std::stoi(argv[i + 1]), std::stoi(argv[i + 2]), std::stoi(argv[i + 3]), std::stoi(argv[i + 4])};
+			i += 4;
+		}
+		else if(arg == "--mask" && i + 1 < argc)
+			r.region.maskPath = argv[++i];
+		else if(arg == "--base" && i + 1 < argc)
+			r.region.basePath = argv[++i];
+		else if(arg == "--region-restart")
+			r.region.restart = true;
+		else if(arg == "--tiles" && i + 1 < argc)
+			r.tilePath = argv[++i];
+		else if(arg == "--tile-size" && i + 1 < argc)
+			r.tileSize = std::max(1, std::stoi(argv[++i]));
+		else if(arg == "--convert-tiles" && i + 2 < argc) {
+			// Turn a (possibly unfinished) tile file into an image; missing tiles are black
+			int width, height;
+			std::vector<Vector3f> image;
+			int tiles = readTileFile(argv[i + 1], width, height, image);
+			if(tiles < 0 || !writeImage(argv[i + 2], width, height, 3, reinterpret_cast<const float *>(image.data()))) {
+				printf("Could not convert %s to %s\n", argv[i + 1], argv[i + 2]);
+				return 1;
+			}
+			printf("%s: %d tiles written to %s\n", argv[i + 1], tiles, argv[i + 2]);
+			return 0;
+		}
+		else if(arg == "--denoise")
+			r.denoise.enabled = true;
+		else if(arg == "--denoise-passes" && i + 1 < argc)
+			r.denoise.iterations = std::stoi(argv[++i]);
+		else if(arg == "--simd" && i + 1 < argc) {
+			if(!selectSimdISA(argv[++i]))
+				printf("SIMD: %s is unknown or not supported by this CPU\n", argv[i]);
+		}
+		else if(arg == "--bvh-bench" && i + 1 < argc) {
+			benchmarkBVH(argv[++i]);
+			return 0;
+		}
+	}
+
+	if(!r.camera.valid()) {
+		printf("Camera: the view direction is degenerate or the field of view out of range\n");
+		return 1;
+	}
+	// Batches of views: a turntable circles the camera around the vertical axis through its target
+	std::vector<Renderer::View> views;
+	if(!viewsPath.empty() && !readViews(viewsPath, views))
+		return 1;
+	for(int v = 0; v < turntableViews; ++v) {
+		float angle     = 2 * M_PI * v / turntableViews;
+		Vector3f offset = r.camera.eye - r.camera.target;
+		Camera camera   = r.camera;
+		camera.eye      = r.camera.target + Vector3f(offset.x * std::cos(angle) + offset.z * std::sin(angle), offset.y,
+		                                             offset.z * std::cos(angle) - offset.x * std::sin(angle));
+		views.push_back({camera, viewOutput(r.outputPath, v)});
+	}
+
+	if(farmWorkers > 0 && !views.empty()) {
+		// The workers render the command line's camera, and the coordinator writes one image
+		printf("Farm: batches of views (--views, --turntable) are not supported\n");
+		return 1;
+	}
+	if(farmWorkers > 0 && (r.region.enabled() || !r.region.basePath.empty())) {
+		// Workers render whole tiles and the coordinator assembles a whole image from them
+		printf("Farm: crop windows, masks and base images are not supported\n");
+		return 1;
+	}
+	if(farmWorkers > 0 && (r.restir.enabled || r.denoise.enabled || r.writeAOVs || !r.checkpoint.path.empty())) {
+		// ReSTIR shares reservoirs between neighbouring pixels across tiles, the denoiser and the AOVs need the whole
+		// frame's buffers, and a checkpoint holds one process's sums
+		printf("Farm: --restir, --denoise, --aov, --checkpoint and --resume are not supported\n");
+		return 1;
+	}
+	if(farmWorkers > 0)
+		return coordinateFarm(argc, argv, r, farmWorkers, farmScaling, farmLeaseTimeout);
+
+	// A render service on standard input replies on the real standard output; everything else printed goes to
+	// standard error instead
+	int replies = STDOUT_FILENO;
+	if(serveStdio) {
+		replies = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	printf("SIMD: %s kernels\n", simdKernels().name);
+
+	if(serveStdio || !servePath.empty()) {
+		// Scenes are loaded by the first job that names them and stay resident: "default" is the scene the command
+		// line describes, any other name an OBJ asset rendered like --obj
+		RenderServer server([&](const std::string &name) -> std::unique_ptr<Scene> {
+			SceneSetup sceneSetup = setup;
+			if(name != "default") {
+				if(access(name.c_str(), R_OK) != 0)
+					return nullptr;
+				sceneSetup.importPath = name;
+			}
+			auto scene = std::make_unique<Scene>(kImageWidth, kImageHeight);
+			std::vector<MeshTriangle *> meshes;
+			std::vector<Instance *> instances;
+			buildScene(*scene, sceneSetup, meshes, instances);
+			return scene;
+		}, r);
+		if(!servePath.empty()) {
+			if(!server.serveSocket(servePath)) {
+				printf("Could not listen on %s\n", servePath.c_str());
+				return 1;
+			}
+			return 0;
+		}
+		server.serveStream(STDIN_FILENO, replies);
+		return 0;
+	}
+#ifdef HEAP_REPORT
+	size_t setupAllocations = heapAllocations;
+#endif
+
+	// Change the definition here to change resolution
+	Scene scene(kImageWidth, kImageHeight);
+
+	std::vector<MeshTriangle *> meshes;
+	std::vector<Instance *> instances;
+	buildScene(scene, setup, meshes, instances);
+#ifdef HEAP_REPORT
+	printf("Scene setup: %zu heap allocations\n", heapAllocations - setupAllocations);
+#endif
+	printf("Scene arena: %zu objects in %zu blocks (%zu KiB)\n", scene.arena.objectCount(), scene.arena.blockCount(),
+	       scene.arena.bytesAllocated() / 1024);
+
+	// Turntable: spin one mesh (vertex animation) and the instances (transforms), refitting instead of rebuilding
+	if(animateFrames > 0) {
+		MeshTriangle *spin         = meshes[std::min<size_t>(2, meshes.size() - 1)];
+		std::vector<Vector3f> rest = spin->vertices;
+		Vector3f pivot             = spin->getBounds().Centroid();
+		// What a refit saves is measured against a full build, which a BVH from the mesh cache never went through
+		double meshBuildMs = spin->bvh->buildTimeMs > 0 ? spin->bvh->buildTimeMs : spin->timeFullBuild();
+		for(int frame = 1; frame <= animateFrames; ++frame) {
+			Transform t = Transform::Translate(pivot) * Transform::RotateY(10.0f * frame) * Transform::Translate(-pivot);
+			std::vector<Vector3f> positions(rest.size());
+			for(size_t v = 0; v < rest.size(); ++v)
+				positions[v] = t.point(rest[v]);
+			BVHAccel::UpdateStats mesh = spin->updateVertices(positions);
+			for(Instance *instance: instances)
+				instance->setTransform(instance->toWorld * Transform::RotateY(10.0f));
+			BVHAccel::UpdateStats top = scene.updateBVH();
+			printf("Frame %d: mesh refit %.3f ms + rebuild %.3f ms (%d subtrees, SAH x%.2f), scene refit %.3f ms + rebuild %.3f ms"
+			       " | full build: mesh %.3f ms, scene %.3f ms\n",
+			       frame, mesh.refitMs, mesh.rebuildMs, mesh.rebuiltSubtrees, mesh.costRatio, top.refitMs, top.rebuildMs,
+			       meshBuildMs, scene.bvh->buildTimeMs);
+		}
+	}
+
+	if(farmWorkerFd >= 0)
+		return serveFarmTiles(farmWorkerFd, r, scene) ? 0 : 1;
+
+	if(r.restir.enabled)
+		printf("ReSTIR: %d candidates, %s temporal reuse, %d spatial neighbours\n", r.restir.candidates,
+		       r.restir.temporal ? "with" : "no", r.restir.spatialNeighbors);
 
 	auto start = std::chrono::system_clock::now();
-	r.Render(scene);
+	bool written = views.empty() ? r.Render(scene) : r.RenderViews(scene, views) == int(views.size());
 	auto stop = std::chrono::system_clock::now();
 
 	std::cout << "Render complete: \n";
@@ -51,5 +633,12 @@ int main(int argc, char **argv) {
 	std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
 	std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
 
-	return 0;
+#ifdef LIGHT_STATS
+	const Scene::LightSampleStats &nee = scene.lightStats;
+	uint64_t samples = nee.samples, shadowRays = nee.shadowRays, kept = nee.kept;
+	printf("NEE: %llu light samples, %llu shadow rays, %llu kept (%.1f%%)\n", (unsigned long long) samples,
+	       (unsigned long long) shadowRays, (unsigned long long) kept, samples ? 100.0 * kept / samples : 0.0);
+#endif
+
+	return written ? 0 : 1;
 }
\ No newline at end of file
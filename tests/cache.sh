@@ -0,0 +1,44 @@
+#!/bin/sh
+# Mesh cache: renders from freshly written caches, from reused ones and from none at all must be bit-identical; a stale
+# or damaged cache must be ignored and replaced.
+# Usage: cache.sh <RayTracing binary>
+. "$(dirname "$0")/cornellbox.sh"
+
+"$bin" --spp 4 --no-cache --output none.pfm > /dev/null
+for cache in "$meshes"/*.rtcache; do
+	[ -e "$cache" ] && fail "a cache was written with --no-cache"
+done
+
+"$bin" --spp 4 --output written.pfm > /dev/null
+for mesh in "$meshes"/*.obj; do
+	[ -s "$mesh.rtcache" ] || fail "no cache was written for $mesh"
+done
+cmp none.pfm written.pfm || fail "render that wrote the caches differs from the render without them"
+"$bin" --spp 4 --output reused.pfm > /dev/null
+cmp none.pfm reused.pfm || fail "render from the caches differs from the render without them"
+
+# Cut short
+for cache in "$meshes"/*.rtcache; do
+	head -c 100 "$cache" > cut
+	mv cut "$cache"
+done
+"$bin" --spp 4 --output cut.pfm > /dev/null
+cmp none.pfm cut.pfm || fail "render from truncated caches differs from the render without them"
+
+# Everything past the header (the arrays start at byte 128) set to 0xff: every index is out of range
+size=$(stat -c %s "$meshes/floor.obj.rtcache")
+[ "$size" -gt 128 ] || fail "the truncated cache was not replaced"
+head -c $((size - 128)) /dev/zero | tr '\0' '\377' | dd of="$meshes/floor.obj.rtcache" bs=128 seek=1 conv=notrunc 2> /dev/null
+"$bin" --spp 4 --output scrambled.pfm > /dev/null
+cmp none.pfm scrambled.pfm || fail "render from a scrambled cache differs from the render without it"
+
+# Swapping the walls leaves each with the other's cache, which must not be taken for it
+mv "$meshes/left.obj" left
+mv "$meshes/right.obj" "$meshes/left.obj"
+mv left "$meshes/right.obj"
+"$bin" --spp 4 --no-cache --output swapped.pfm > /dev/null
+cmp -s none.pfm swapped.pfm && fail "swapping the walls left the image as it was"
+"$bin" --spp 4 --output stale.pfm > /dev/null
+cmp swapped.pfm stale.pfm || fail "render with stale caches differs from the render without them"
+
+echo "cache: ok"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Checkpoints: a render continued from its checkpoint, also after being killed in the middle of a save, must be
+# bit-identical to the same render done in one go, and a checkpoint of another render must be refused. Renders with
+# the same seed, ReSTIR's too, must be identical.
+# Usage: checkpoint.sh <RayTracing binary>
+. "$(dirname "$0")/cornellbox.sh"
+
+"$bin" --spp 8 --output direct.pfm > /dev/null
+
+# Saved after every round of three samples per pixel; the rounds add up to the same sums as a single pass
+"$bin" --spp 8 --checkpoint rounds.ckpt --checkpoint-round 3 --checkpoint-interval 0 --output rounds.pfm > /dev/null
+cmp direct.pfm rounds.pfm || fail "render in checkpointed rounds differs from the direct render"
+
+# More samples on top of a finished render
+"$bin" --spp 4 --checkpoint more.ckpt --output four.pfm > /dev/null
+"$bin" --spp 8 --resume more.ckpt --output more.pfm > resume.log
+grep -q "^Resumed " resume.log || fail "the finished render's samples were not resumed"
+cmp direct.pfm more.pfm || fail "render resumed with more samples differs from the direct render"
+
+# Killed in the middle of a round, saving after every sample: at 30 % of the samples at least two rounds are saved
+"$bin" --spp 8 --checkpoint killed.ckpt --checkpoint-round 1 --checkpoint-interval 0 --output killed.pfm > progress.log &
+render=$!
+while kill -0 "$render" 2> /dev/null && ! grep -q '] [3-9][0-9] %' progress.log; do sleep 0.05; done
+kill -KILL "$render" 2> /dev/null || true
+wait "$render" 2> /dev/null || true
+"$bin" --spp 8 --resume killed.ckpt --output killed.pfm > resume.log
+grep -q "^Resumed " resume.log || fail "the killed render's samples were not resumed"
+cmp direct.pfm killed.pfm || fail "render resumed after a kill differs from the direct render"
+
+# The samples of another seed would not match
+if "$bin" --spp 8 --seed 1 --resume more.ckpt --output other.pfm > /dev/null 2>&1; then
+	fail "checkpoint of a render with another seed was resumed"
+fi
+
+# ReSTIR's passes draw their random numbers from the seed as well
+"$bin" --spp 2 --restir --restir-temporal --output restir1.pfm > /dev/null
+"$bin" --spp 2 --restir --restir-temporal --output restir2.pfm > /dev/null
+cmp restir1.pfm restir2.pfm || fail "ReSTIR renders with the same seed differ"
+
+echo "checkpoint: ok"
@@ -0,0 +1,52 @@
+# Setup shared by the tests that render the built-in Cornell box scene; sourced by them with the RayTracing binary as
+# their first argument. It writes the box's meshes to $dir/models/cornellbox ($meshes), where the scene loads them
+# from, changes to $dir/run and removes $dir on exit.
+set -e
+bin=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+meshes=$dir/models/cornellbox
+mkdir -p "$meshes" "$dir/run"
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# Quads read as lines of four corners, x y z each, written as OBJ triangles (a b c) and (a c d)
+quads() {
+	awk '{
+		for(k = 0; k < 12; k += 3)
+			printf "v %s %s %s\n", $(k + 1), $(k + 2), $(k + 3)
+		n = 4 * (NR - 1)
+		printf "f %d %d %d\nf %d %d %d\n", n + 1, n + 2, n + 3, n + 1, n + 3, n + 4
+	}'
+}
+# A box standing on the floor, read as its height and the x z of its four top corners: the top and the four sides
+box() {
+	awk '{
+		h = $1
+		printf "%s %s %s", $2, h, $3
+		for(k = 1; k < 4; ++k)
+			printf "  %s %s %s", $(2 * k + 2), h, $(2 * k + 3)
+		printf "\n"
+		for(k = 0; k < 4; ++k) {
+			x0 = $(2 * k + 2); z0 = $(2 * k + 3); x1 = $((2 * k + 2) % 8 + 2); z1 = $((2 * k + 2) % 8 + 3)
+			printf "%s %s %s  %s 0 %s  %s 0 %s  %s %s %s\n", x0, h, z0, x0, z0, x1, z1, x1, h, z1
+		}
+	}' | quads
+}
+
+# The floor, ceiling and back wall
+quads > "$meshes/floor.obj" << EOF
+552.8 0 0  0 0 0  0 0 559.2  549.6 0 559.2
+556 548.8 0  556 548.8 559.2  0 548.8 559.2  0 548.8 0
+549.6 0 559.2  0 0 559.2  0 548.8 559.2  556 548.8 559.2
+EOF
+echo "552.8 0 0  549.6 0 559.2  556 548.8 559.2  556 548.8 0" | quads > "$meshes/left.obj"
+echo "0 0 559.2  0 0 0  0 548.8 0  0 548.8 559.2" | quads > "$meshes/right.obj"
+echo "343 548.7 227  343 548.7 332  213 548.7 332  213 548.7 227" | quads > "$meshes/light.obj"
+echo "165  130 65  82 225  240 272  290 114" | box > "$meshes/shortbox.obj"
+echo "330  423 247  265 296  314 456  472 406" | box > "$meshes/tallbox.obj"
+
+cd "$dir/run"
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Tile farm: the farm's image must be bit-identical to the single-process render, also after a worker is killed or
+# hangs in the middle of the render.
+# Usage: farm.sh <RayTracing binary>
+. "$(dirname "$0")/cornellbox.sh"
+
+# Wait until the farm started by the caller has written its first tile to farm.tiles, then send the signal to one of
+# its workers
+signalWorker() {
+	while [ ! -s farm.tiles ]; do sleep 0.05; done
+	header=$(stat -c %s farm.tiles)
+	while [ "$(stat -c %s farm.tiles)" -le "$header" ]; do sleep 0.05; done
+	worker=$(pgrep -P "$1" | head -n 1)
+	[ -n "$worker" ] || fail "no worker to signal"
+	kill "-$2" "$worker"
+}
+
+"$bin" --spp 4 --tile-size 16 --output single.pfm > /dev/null
+
+"$bin" --spp 4 --tile-size 16 --farm 3 --output farm.pfm > farm.log
+cmp single.pfm farm.pfm || fail "farm image differs from the single-process image"
+
+# A killed worker's tile is leased again
+rm -f farm.pfm farm.tiles
+"$bin" --spp 4 --tile-size 16 --farm 2 --tiles farm.tiles --output farm.pfm > farm.log &
+signalWorker $! KILL
+wait $! || fail "farm with a killed worker failed"
+grep -q ", 0 tiles reassigned" farm.log && fail "the killed worker's tile was not reassigned"
+cmp single.pfm farm.pfm || fail "farm image differs after a worker was killed"
+
+# A stopped worker misses its deadline, is killed and its tile leased again
+rm -f farm.pfm farm.tiles
+"$bin" --spp 4 --tile-size 16 --farm 2 --farm-lease-timeout 1 --tiles farm.tiles --output farm.pfm > farm.log &
+signalWorker $! STOP
+wait $! || fail "farm with a hung worker failed"
+grep -q ", 1 workers timed out" farm.log || fail "the hung worker did not time out"
+cmp single.pfm farm.pfm || fail "farm image differs after a worker hung"
+
+# Options whose images would differ from the single-process render's are refused
+for option in --restir --denoise --aov "--checkpoint farm.ckpt"; do
+	if "$bin" --spp 1 --farm 2 $option --output refused.pfm > /dev/null 2>&1; then
+		fail "farm accepted $option"
+	fi
+done
+
+echo "farm: ok"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Image output: the same pixels written as PFM, OpenEXR and PPM must all hold the render's image, the float formats bit
+# for bit.
+# Usage: hdr.sh <RayTracing binary>
+. "$(dirname "$0")/cornellbox.sh"
+
+# One render, written directly and kept as a tile file to write again in every format
+"$bin" --spp 4 --tiles image.tiles --output image.pfm > /dev/null
+"$bin" --spp 4 --output image.ppm > /dev/null
+for format in pfm exr ppm; do
+	"$bin" --convert-tiles image.tiles "converted.$format" > /dev/null || fail "could not write the tiles as .$format"
+done
+cmp image.pfm converted.pfm || fail "PFM written from the tiles differs from the rendered PFM"
+cmp image.ppm converted.ppm || fail "PPM written from the tiles differs from the rendered PPM"
+
+# The second line of the PFM header is the image size
+set -- $(sed -n 2p image.pfm)
+width=$1
+height=$2
+[ "$(od -An -tx1 -N4 converted.exr | tr -d ' ')" = 762f3101 ] || fail "EXR file does not start with the OpenEXR magic number"
+# Uncompressed scanlines after the header and the offset table: y, the data size, then the row's B, G and R planes
+exrSize=$(stat -c %s converted.exr)
+exrPixels=$((exrSize - height * (8 + 8 + width * 12)))
+pfmPixels=$(head -n 3 image.pfm | wc -c)
+od -An -v -tu4 -w4 -j "$pfmPixels" image.pfm > pfm.words
+od -An -v -tu4 -w4 -j $((exrPixels + height * 8)) converted.exr > exr.words
+# The PFM's rows run bottom to top with the channels interleaved; compare the float bits of every sample
+awk -v w="$width" -v h="$height" '
+	NR == FNR { pfm[NR - 1] = $1; next }
+	{
+		k = FNR - 1; y = int(k / (2 + 3 * w)); i = k % (2 + 3 * w)
+		if(i == 0) expected = y
+		else if(i == 1) expected = 12 * w
+		else expected = pfm[((h - 1 - y) * w + (i - 2) % w) * 3 + 2 - int((i - 2) / w)]
+		if($1 != expected) { print "EXR word " k ": " $1 ", expected " expected; differs = 1; exit 1 }
+	}
+	END { if(!differs && FNR != h * (2 + 3 * w)) { print "EXR holds " FNR " words"; exit 1 } }' pfm.words exr.words ||
+	fail "EXR pixels differ from the PFM pixels"
+
+echo "hdr: ok"
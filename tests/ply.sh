@@ -0,0 +1,118 @@
+#!/bin/sh
+# PLY import: a binary PLY mesh must render exactly like the same mesh written as an OBJ, and a PLY file that cannot
+# be read, or holds negative indices or counts, must be reported and leave the mesh empty.
+# Usage: ply.sh <RayTracing binary>
+set -e
+bin=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# Little-endian bytes of the coordinates used below
+float() {
+	case $1 in
+	0) printf '\000\000\000\000' ;;
+	100) printf '\000\000\310\102' ;;
+	150) printf '\000\000\026\103' ;;
+	200) printf '\000\000\110\103' ;;
+	300) printf '\000\000\226\103' ;;
+	400) printf '\000\000\310\103' ;;
+	456) printf '\000\000\344\103' ;;
+	-100) printf '\000\000\310\302' ;;
+	-200) printf '\000\000\110\303' ;;
+	esac
+}
+# A 32-bit index below 256
+index() {
+	printf "\\$(printf %03o "$1")\\000\\000\\000"
+}
+
+# A quad facing the camera and a triangle tilted in front of it
+vertices="100 100 0  100 456 0  456 456 0  456 100 0  200 150 -200  300 400 -100  400 150 -200"
+{
+	echo "# two triangles of the quad, then the tilted one"
+	set -- $vertices
+	while [ $# -gt 0 ]; do
+		echo "v $1 $2 $3"
+		shift 3
+	done
+	echo "f 1 2 3"
+	echo "f 1 3 4"
+	echo "f 5 6 7"
+} > mesh.obj
+# The quad is one face the loader splits into a fan; each vertex carries a byte the loader must skip
+header() {
+	printf 'ply\nformat %s 1.0\ncomment written by ply.sh\n' "$1"
+	printf 'element vertex 7\nproperty float x\nproperty float y\nproperty float z\nproperty uchar flags\n'
+	printf 'element face 2\nproperty list %s int vertex_indices\nend_header\n' "${2:-uchar}"
+}
+vertexData() {
+	set -- $vertices
+	while [ $# -gt 0 ]; do
+		float "$1"
+		float "$2"
+		float "$3"
+		printf '\001'
+		shift 3
+	done
+}
+{
+	header binary_little_endian
+	vertexData
+	printf '\004'
+	for i in 0 1 2 3; do index $i; done
+	printf '\003'
+	for i in 4 5 6; do index $i; done
+} > mesh.ply
+
+for mesh in obj ply; do
+	mkdir "$mesh"
+	(cd "$mesh" && "$bin" --spp 1 --no-cache --obj "../mesh.$mesh" --aov --output image.pfm > log 2>&1) ||
+		fail "render of the $mesh mesh failed"
+done
+for image in image.pfm aov_depth.pfm aov_normal.pfm aov_object.pfm; do
+	cmp "obj/$image" "ply/$image" || fail "$image of the PLY mesh differs from the OBJ mesh's"
+done
+# Identical because both were rendered at all: a missing mesh leaves the depths empty
+mkdir none
+(cd none && "$bin" --spp 1 --no-cache --obj ../missing.obj --aov --output image.pfm > log 2>&1) || true
+cmp -s obj/aov_depth.pfm none/aov_depth.pfm && fail "the meshes were not hit"
+
+# Cut off in the middle of the faces
+head -c $(($(stat -c %s mesh.ply) - 5)) mesh.ply > cut.ply
+"$bin" --spp 1 --no-cache --obj cut.ply --output cut.pfm > cut.log 2>&1 || true
+grep -q "unexpected end of PLY" cut.log || fail "truncated PLY file was not reported"
+grep -q "Could not load cut.ply" cut.log || fail "truncated PLY file was not refused"
+
+# A negative vertex index, and a negative vertex count in a signed count type
+{
+	header binary_little_endian
+	vertexData
+	printf '\003'
+	index 0
+	printf '\377\377\377\377'
+	index 2
+} > index.ply
+"$bin" --spp 1 --no-cache --obj index.ply --output index.pfm > index.log 2>&1 || true
+grep -q "bad PLY face index" index.log || fail "negative face index was not refused"
+{
+	header binary_little_endian char
+	vertexData
+	printf '\377'
+} > count.ply
+"$bin" --spp 1 --no-cache --obj count.ply --output count.pfm > count.log 2>&1 || true
+grep -q "bad PLY list count" count.log || fail "negative list count was not refused"
+
+{
+	header ascii
+	echo "100 100 0 1"
+} > ascii.ply
+"$bin" --spp 1 --no-cache --obj ascii.ply --output ascii.pfm > ascii.log 2>&1 || true
+grep -q "only binary_little_endian" ascii.log || fail "ASCII PLY file was not refused"
+
+echo "ply: ok"
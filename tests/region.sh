@@ -0,0 +1,32 @@
+#!/bin/sh
+# Region renders: a crop window or a mask rendered over the full image must reproduce it bit for bit, and a crop window
+# outside the image must be refused.
+# Usage: region.sh <RayTracing binary>
+. "$(dirname "$0")/cornellbox.sh"
+
+"$bin" --spp 4 --output full.pfm > /dev/null
+# The second line of the PFM header is the image size
+set -- $(sed -n 2p full.pfm)
+width=$1
+height=$2
+
+# Every pixel of the window is rendered afresh, every other one is taken from the base image
+"$bin" --spp 4 --crop $((width / 4)) $((height / 4)) $((width / 2)) $((height * 3 / 4)) --base full.pfm --output crop.pfm > /dev/null
+cmp full.pfm crop.pfm || fail "crop window rendered over the full image differs from it"
+"$bin" --spp 4 --crop $((width / 4)) $((height / 4)) $((width / 2)) $((height * 3 / 4)) --output crop.pfm > /dev/null
+cmp -s full.pfm crop.pfm && fail "crop window without a base image left no pixel black"
+
+# Mask: the top half white, the bottom half black
+{
+	printf 'P6\n%d %d\n255\n' "$width" "$height"
+	head -c $((width * (height / 2) * 3)) /dev/zero | tr '\0' '\377'
+	head -c $((width * (height - height / 2) * 3)) /dev/zero
+} > mask.ppm
+"$bin" --spp 4 --mask mask.ppm --base full.pfm --output masked.pfm > /dev/null
+cmp full.pfm masked.pfm || fail "masked region rendered over the full image differs from it"
+
+if "$bin" --spp 4 --crop 0 0 $((width + 1)) "$height" --output outside.pfm > /dev/null 2>&1; then
+	fail "crop window outside the image was accepted"
+fi
+
+echo "region: ok"
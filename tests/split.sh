@@ -0,0 +1,44 @@
+#!/bin/sh
+# BVH builders: the naive, SAH, spatial-split (SBVH) and Morton-code (LBVH) BVHs of one mesh must find the same closest
+# hits, so an imported mesh renders bit-identically whichever builds its BVH. The mesh is made of long, thin, diagonal
+# triangles, whose boxes overlap heavily and which the SBVH splits.
+# Usage: split.sh <RayTracing binary>
+set -e
+bin=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+# 2000 slivers, each 160 units long and 2 wide, in the 556^3 room the camera looks into
+awk 'BEGIN {
+	srand(3)
+	for(i = 0; i < 2000; ++i) {
+		x = 556 * rand(); y = 556 * rand(); z = 556 * rand()
+		dx = rand() - 0.5; dy = rand() - 0.5; dz = rand() - 0.5
+		s = 160 / sqrt(dx * dx + dy * dy + dz * dz)
+		printf "v %f %f %f\nv %f %f %f\nv %f %f %f\n", x, y, z, x + s * dx, y + s * dy, z + s * dz, x + 2, y + 2, z
+		printf "f %d %d %d\n", 3 * i + 1, 3 * i + 2, 3 * i + 3
+	}
+}' > slivers.obj
+
+for method in naive sah sbvh lbvh; do
+	mkdir "$method"
+	(cd "$method" && "$bin" --spp 1 --lights 4 --no-cache --obj ../slivers.obj --split "$method" --aov --output image.pfm > log 2>&1) ||
+		fail "render with the $method BVH failed"
+done
+for method in sah sbvh lbvh; do
+	for image in image.pfm aov_depth.pfm aov_normal.pfm aov_object.pfm; do
+		cmp "naive/$image" "$method/$image" || fail "$image rendered with the $method BVH differs from the naive BVH's"
+	done
+done
+
+if "$bin" --spp 1 --obj slivers.obj --split octree --output unknown.pfm > /dev/null 2>&1; then
+	fail "unknown split method was accepted"
+fi
+
+echo "split: ok"